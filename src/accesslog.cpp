@@ -0,0 +1,145 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <fstream>
+#include "accesslog.h"
+#include "utils.h"
+
+#define CTIME_LENGTH 24
+
+using std::string;
+using std::vector;
+
+namespace Cerver {
+
+AccessCapture::AccessCapture(const string& path) {
+  pthread_mutex_init(&lock_, nullptr);
+  fd_ = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, S_IRWXO | S_IRWXG | S_IRWXU);
+  if (fd_ != -1 && lseek(fd_, 0, SEEK_END) == 0) {
+    write(fd_, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH);
+  }
+}
+
+AccessCapture::~AccessCapture() {
+  Close();
+  pthread_mutex_destroy(&lock_);
+}
+
+int AccessCapture::Append(uint64_t arrival_us, const string& method, const string& uri) {
+  if (fd_ == -1) {
+    return -1;
+  }
+  uint32_t method_len = method.length();
+  uint32_t uri_len = uri.length();
+  string record(CAPTURE_RECORD_METADATA_LENGTH, '\0');
+  memcpy(&record[0], &arrival_us, sizeof(arrival_us));
+  memcpy(&record[8], &method_len, sizeof(method_len));
+  memcpy(&record[12], &uri_len, sizeof(uri_len));
+  record += method;
+  record += uri;
+  // One write per record so concurrent workers never interleave.
+  pthread_mutex_lock(&lock_);
+  ssize_t ret = write(fd_, record.c_str(), record.length());
+  pthread_mutex_unlock(&lock_);
+  return ret == static_cast<ssize_t>(record.length()) ? 0 : -1;
+}
+
+void AccessCapture::Close() {
+  pthread_mutex_lock(&lock_);
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+uint64_t NowMicros() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+int ParseAccessLog(const string& path, vector<AccessRecord>* records) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    return -1;
+  }
+  string line;
+  while (std::getline(in, line)) {
+    // Lines look like "Thu Oct 19 13:08:00 2026: get /poetry http/1.1".
+    if (line.length() < CTIME_LENGTH + 2 || line.compare(CTIME_LENGTH, 2, ": ") != 0) {
+      continue;
+    }
+    vector<string> tokens;
+    if (Utils::Split(line.substr(CTIME_LENGTH + 2), " ", &tokens) != 3) {
+      continue;
+    }
+    if (tokens[2].compare(0, 5, "http/") != 0) {
+      continue;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(line.substr(0, CTIME_LENGTH).c_str(), "%a %b %d %H:%M:%S %Y", &tm) == nullptr) {
+      continue;
+    }
+    tm.tm_isdst = -1;
+    AccessRecord record;
+    record.arrival_us = static_cast<uint64_t>(mktime(&tm)) * 1000000;
+    record.method = tokens[0];
+    record.uri = tokens[1];
+    records->push_back(record);
+  }
+  return records->size();
+}
+
+int ReadCapture(const string& path, vector<AccessRecord>* records) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  char magic[CAPTURE_MAGIC_LENGTH];
+  if (read(fd, magic, CAPTURE_MAGIC_LENGTH) != CAPTURE_MAGIC_LENGTH ||
+      memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) != 0) {
+    close(fd);
+    return -1;
+  }
+  char metadata[CAPTURE_RECORD_METADATA_LENGTH];
+  while (read(fd, metadata, CAPTURE_RECORD_METADATA_LENGTH) == CAPTURE_RECORD_METADATA_LENGTH) {
+    AccessRecord record;
+    uint32_t method_len;
+    uint32_t uri_len;
+    memcpy(&record.arrival_us, metadata, sizeof(record.arrival_us));
+    memcpy(&method_len, metadata + 8, sizeof(method_len));
+    memcpy(&uri_len, metadata + 12, sizeof(uri_len));
+    vector<char> buf(method_len + uri_len);
+    if (read(fd, buf.data(), buf.size()) != static_cast<ssize_t>(buf.size())) {
+      // Torn tail from a server that was killed mid-write.
+      break;
+    }
+    record.method = string(buf.data(), method_len);
+    record.uri = string(buf.data() + method_len, uri_len);
+    records->push_back(record);
+  }
+  close(fd);
+  return records->size();
+}
+
+int ReadAccessRecords(const string& path, vector<AccessRecord>* records) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  char magic[CAPTURE_MAGIC_LENGTH];
+  bool is_capture = read(fd, magic, CAPTURE_MAGIC_LENGTH) == CAPTURE_MAGIC_LENGTH &&
+                    memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) == 0;
+  close(fd);
+  if (is_capture) {
+    return ReadCapture(path, records);
+  }
+  return ParseAccessLog(path, records);
+}
+
+} // namespace Cerver
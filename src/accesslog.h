@@ -0,0 +1,52 @@
+#ifndef ACCESS_LOG_H_
+#define ACCESS_LOG_H_
+
+#define CAPTURE_MAGIC "CVCAP001"
+#define CAPTURE_MAGIC_LENGTH 8
+#define CAPTURE_RECORD_METADATA_LENGTH 16
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+namespace Cerver {
+
+// One request as seen by the server.
+struct AccessRecord {
+  uint64_t arrival_us; // Microseconds since epoch
+  std::string method;
+  std::string uri;
+};
+
+// Writes a compact binary capture of incoming requests.
+// Capture file format:
+// 8 bytes: magic "CVCAP001"
+// Repeated:
+// 8 bytes: arrival time in microseconds since epoch
+// 4 bytes: method length
+// 4 bytes: uri length
+// n bytes: method
+// n bytes: uri
+class AccessCapture {
+  public:
+    AccessCapture(const std::string& path);
+    ~AccessCapture();
+    int Append(uint64_t arrival_us, const std::string& method, const std::string& uri);
+    void Close();
+  private:
+    int fd_;
+    pthread_mutex_t lock_;
+};
+
+uint64_t NowMicros();
+// Parses the method/URI/protocol lines that HttpServer::ThreadLoop writes to
+// cerverlog/run.log. Timestamps only have second resolution.
+int ParseAccessLog(const std::string& path, std::vector<AccessRecord>* records);
+// Reads a file written by AccessCapture.
+int ReadCapture(const std::string& path, std::vector<AccessRecord>* records);
+// Reads either format, detected by the capture magic.
+int ReadAccessRecords(const std::string& path, std::vector<AccessRecord>* records);
+
+} // namespace Cerver
+
+#endif
@@ -0,0 +1,141 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+#include "assetloader.h"
+
+using std::string;
+using std::vector;
+
+namespace Cerver {
+
+AssetLoader::AssetLoader(ThreadPool* pool) : pool_(pool), pending_(0), failed_(0) {
+  pthread_mutex_init(&lock_, nullptr);
+  pthread_cond_init(&cond_, nullptr);
+}
+
+AssetLoader::~AssetLoader() {
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&lock_);
+}
+
+void AssetLoader::Exclude(const string& name) {
+  excluded_.push_back(name);
+}
+
+void AssetLoader::SetFilter(Filter filter) {
+  filter_ = filter;
+}
+
+int AssetLoader::Load(const string& root, vector<Asset>* assets, Report* report) {
+  struct timeval start;
+  gettimeofday(&start, nullptr);
+  vector<string> paths;
+  Walk(root, "", &paths);
+  std::sort(paths.begin(), paths.end());
+
+  size_t first = assets->size();
+  assets->resize(first + paths.size());
+  pthread_mutex_lock(&lock_);
+  pending_ = paths.size();
+  failed_ = 0;
+  pthread_mutex_unlock(&lock_);
+  for (size_t i = 0; i < paths.size(); i++) {
+    (*assets)[first + i].path = paths[i];
+    pool_->Dispatch(std::make_unique<ReadTask>(this, root + "/" + paths[i], &(*assets)[first + i]));
+  }
+  pthread_mutex_lock(&lock_);
+  while (pending_ > 0) {
+    pthread_cond_wait(&cond_, &lock_);
+  }
+  size_t failed = failed_;
+  pthread_mutex_unlock(&lock_);
+
+  struct timeval end;
+  gettimeofday(&end, nullptr);
+  report->files = paths.size() - failed;
+  report->failed = failed;
+  report->bytes = 0;
+  for (size_t i = first; i < assets->size(); i++) {
+    report->bytes += (*assets)[i].content.Size();
+  }
+  report->seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+  return report->files;
+}
+
+void AssetLoader::Walk(const string& root, const string& rel, vector<string>* paths) {
+  string dir_path = rel.empty() ? root : root + "/" + rel;
+  DIR* dir = opendir(dir_path.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    string name = entry->d_name;
+    if (name[0] == '.') {
+      continue;
+    }
+    string child = rel.empty() ? name : rel + "/" + name;
+    struct stat st;
+    if (stat((root + "/" + child).c_str(), &st) == -1) {
+      continue;
+    }
+    if (filter_ && !filter_(child, S_ISDIR(st.st_mode))) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      if (std::find(excluded_.begin(), excluded_.end(), name) == excluded_.end()) {
+        Walk(root, child, paths);
+      }
+    } else if (S_ISREG(st.st_mode)) {
+      paths->push_back(child);
+    }
+  }
+  closedir(dir);
+}
+
+void AssetLoader::Done(bool ok) {
+  pthread_mutex_lock(&lock_);
+  if (!ok) {
+    failed_++;
+  }
+  if (--pending_ == 0) {
+    pthread_cond_broadcast(&cond_);
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+AssetLoader::ReadTask::ReadTask(AssetLoader* loader, const string& path, Asset* asset)
+  : loader_(loader), path_(path), asset_(asset) { }
+
+void AssetLoader::ReadTask::Run() {
+  int fd = open(path_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    loader_->Done(false);
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    loader_->Done(false);
+    return;
+  }
+  // One exact-size buffer per file, filled with pread.
+  string content(st.st_size, '\0');
+  off_t offset = 0;
+  while (offset < st.st_size) {
+    ssize_t bytes_read = pread(fd, &content[offset], st.st_size - offset, offset);
+    if (bytes_read <= 0) {
+      break;
+    }
+    offset += bytes_read;
+  }
+  close(fd);
+  content.resize(offset);
+  asset_->content = Utils::SharedBuffer(std::move(content));
+  loader_->Done(offset == st.st_size);
+}
+
+} // namespace Cerver
@@ -0,0 +1,62 @@
+#ifndef ASSET_LOADER_H_
+#define ASSET_LOADER_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "threadpool.h"
+#include "sharedbuffer.h"
+
+namespace Cerver {
+
+// Reads every file under a directory tree, in parallel on a thread pool.
+class AssetLoader {
+  public:
+    struct Asset {
+      std::string path; // Relative to the root, e.g. "images/kung.png"
+      Utils::SharedBuffer content;
+    };
+    struct Report {
+      size_t files;
+      size_t bytes;
+      size_t failed;
+      double seconds;
+    };
+    AssetLoader(ThreadPool* pool);
+    ~AssetLoader();
+    // Directories with this name are not walked, e.g. "tabula-data".
+    void Exclude(const std::string& name);
+    // Asked about every file and directory by its path relative to the
+    // root; files it rejects are not read and directories not walked.
+    typedef std::function<bool(const std::string& path, bool is_dir)> Filter;
+    void SetFilter(Filter filter);
+    // Loads every regular file under [root] the filter lets through into
+    // [assets], sorted by path.
+    // Returns the number of files loaded.
+    int Load(const std::string& root, std::vector<Asset>* assets, Report* report);
+
+  private:
+    class ReadTask : public ThreadPool::Task {
+      public:
+        ReadTask(AssetLoader* loader, const std::string& path, Asset* asset);
+        void Run() override;
+      private:
+        AssetLoader* loader_;
+        std::string path_;
+        Asset* asset_;
+    };
+    void Walk(const std::string& root, const std::string& rel, std::vector<std::string>* paths);
+    void Done(bool ok);
+    ThreadPool* pool_;
+    std::vector<std::string> excluded_;
+    Filter filter_;
+    pthread_mutex_t lock_;
+    pthread_cond_t cond_;
+    size_t pending_;
+    size_t failed_;
+};
+
+} // namespace Cerver
+
+#endif
@@ -0,0 +1,179 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "accesslog.h"
+#include "lrucache.h"
+#include "utils.h"
+
+using std::string;
+using std::vector;
+using namespace Cerver;
+
+// Compares hit ratios of the LRUCache replacement policies on a request
+// trace. The trace is either a run.log/capture.bin replayed through the
+// cache, or a synthetic mix of a hot set of HTML pages and a crawler that
+// periodically walks every image once.
+
+struct Request {
+  string key;
+  size_t size;
+};
+
+// Values are just their sizes, so the simulation does not allocate bodies.
+struct SizeWeigher {
+  size_t operator()(const string& key, const size_t& val) const {
+    return val;
+  }
+};
+
+template <typename Policy>
+using SimCache = LRUCache<string, size_t, Policy, SizeWeigher>;
+
+struct HitRatio {
+  double requests;
+  double bytes;
+};
+
+template <typename Policy>
+HitRatio Simulate(const vector<Request>& trace, size_t capacity) {
+  SimCache<Policy> cache(capacity);
+  size_t hits = 0;
+  size_t hit_bytes = 0;
+  size_t total_bytes = 0;
+  for (const Request& req : trace) {
+    size_t val;
+    total_bytes += req.size;
+    if (cache.Get(req.key, &val) == 0) {
+      hits++;
+      hit_bytes += req.size;
+      continue;
+    }
+    cache.Put(req.key, req.size);
+  }
+  return {100.0 * hits / trace.size(), 100.0 * hit_bytes / total_bytes};
+}
+
+static string Format(const HitRatio& ratio) {
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(1) << ratio.requests << "% / " << ratio.bytes << "%";
+  return ss.str();
+}
+
+static void AddScan(vector<Request>* trace, int num_images) {
+  std::uniform_int_distribution<size_t> image_size(100 * 1024, 300 * 1024);
+  std::mt19937 sizes(7);
+  for (int i = 0; i < num_images; i++) {
+    trace->push_back({"/images/crawl-" + std::to_string(i) + ".jpeg", image_size(sizes)});
+  }
+}
+
+static void SyntheticTrace(vector<Request>* trace, int num_scans, int scan_length) {
+  std::mt19937 rng(42);
+  const int num_pages = 500;
+  vector<double> weights;
+  vector<size_t> sizes;
+  std::uniform_int_distribution<size_t> page_size(8 * 1024, 64 * 1024);
+  for (int i = 0; i < num_pages; i++) {
+    weights.push_back(1.0 / (i + 1)); // Zipf with s = 1
+    sizes.push_back(page_size(rng));
+  }
+  std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+  const int requests_between_scans = 10000;
+  for (int scan = 0; scan <= num_scans; scan++) {
+    for (int i = 0; i < requests_between_scans; i++) {
+      int page = zipf(rng);
+      trace->push_back({"/page-" + std::to_string(page), sizes[page]});
+    }
+    if (scan < num_scans) {
+      AddScan(trace, scan_length);
+    }
+  }
+}
+
+static void RecordedTrace(
+  const vector<AccessRecord>& records,
+  const string& dir,
+  vector<Request>* trace
+) {
+  std::unordered_map<string, size_t> sizes;
+  for (const AccessRecord& record : records) {
+    string uri = record.uri.substr(0, record.uri.find("?"));
+    auto it = sizes.find(uri);
+    if (it == sizes.end()) {
+      size_t size = 16 * 1024;
+      struct stat st;
+      if (!dir.empty() && stat((dir + uri).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        size = st.st_size;
+      }
+      it = sizes.insert({uri, size}).first;
+    }
+    trace->push_back({uri, it->second});
+  }
+}
+
+int main(int argc, char** argv) {
+  string dir;
+  int num_scans = 20;
+  int scan_length = 2000;
+  int c;
+  while ((c = getopt(argc, argv, "d:s:l:")) != -1) {
+    switch(c) {
+      case 'd':
+        dir = optarg;
+        break;
+      case 's':
+        num_scans = atoi(optarg);
+        break;
+      case 'l':
+        scan_length = atoi(optarg);
+        break;
+      case '?':
+        std::cout << optopt << " is not an accepted argument." << std::endl;
+        return 1;
+      default:
+        abort();
+    }
+  }
+  vector<Request> trace;
+  if (optind < argc) {
+    vector<AccessRecord> records;
+    if (ReadAccessRecords(argv[optind], &records) <= 0) {
+      std::cout << "No requests found in " << argv[optind] << std::endl;
+      return EXIT_FAILURE;
+    }
+    RecordedTrace(records, dir, &trace);
+    // Interleave the crawler into the recorded traffic.
+    vector<Request> mixed;
+    size_t chunk = trace.size() / (num_scans + 1) + 1;
+    for (size_t i = 0; i < trace.size(); i++) {
+      mixed.push_back(trace[i]);
+      if ((i + 1) % chunk == 0 && num_scans-- > 0) {
+        AddScan(&mixed, scan_length);
+      }
+    }
+    trace.swap(mixed);
+  } else {
+    SyntheticTrace(&trace, num_scans, scan_length);
+  }
+
+  std::cout << "Requests: " << trace.size() << std::endl;
+  std::cout << std::left << std::setw(12) << "capacity"
+            << std::setw(22) << "LRU (req/bytes)"
+            << std::setw(22) << "TinyLFU (req/bytes)"
+            << std::setw(22) << "ARC (req/bytes)" << std::endl;
+  const size_t capacities_mb[] = {1, 2, 4, 16, 64};
+  for (size_t mb : capacities_mb) {
+    size_t capacity = mb * 1024 * 1024;
+    std::cout << std::setw(12) << (std::to_string(mb) + " MB")
+              << std::setw(22) << Format(Simulate<LRUPolicy<string> >(trace, capacity))
+              << std::setw(22) << Format(Simulate<TinyLFUPolicy<string> >(trace, capacity))
+              << std::setw(22) << Format(Simulate<ARCPolicy<string> >(trace, capacity)) << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,238 @@
+#include <iostream>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "handoff.h"
+#include "utils.h"
+
+#define MAX_HANDOFF_FDS 64
+#define HANDOFF_READY 'R'
+
+using std::string;
+using std::vector;
+
+namespace Cerver {
+
+// Sent with the listen sockets attached; the hot keys follow as
+// newline-separated text.
+struct HandoffHeader {
+  uint32_t num_fds;
+  uint32_t snapshot_len;
+};
+
+static int FillAddr(const string& path, struct sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (path.length() >= sizeof(addr->sun_path)) {
+    return -1;
+  }
+  memcpy(addr->sun_path, path.c_str(), path.length());
+  return 0;
+}
+
+static int WriteAll(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int ReadAll(int fd, char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, buf, len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+UpgradeListener::UpgradeListener(const string& path, Snapshot snapshot, std::function<void()> on_handoff)
+  : path_(path), snapshot_(snapshot), on_handoff_(on_handoff), fd_(-1), stopping_(false), handed_off_(false) { }
+
+UpgradeListener::~UpgradeListener() {
+  Stop();
+}
+
+int UpgradeListener::Start(const vector<int>& listen_fds) {
+  if (listen_fds.size() > MAX_HANDOFF_FDS) {
+    return -1;
+  }
+  struct sockaddr_un addr;
+  if (FillAddr(path_, &addr) == -1) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  // The socket of the process we replaced, if any, is still bound to the
+  // path; unlinking it leaves that process reachable by nobody.
+  unlink(path_.c_str());
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, 1) == -1) {
+    close(fd);
+    return -1;
+  }
+  listen_fds_ = listen_fds;
+  fd_ = fd;
+  if (pthread_create(&thread_, nullptr, &UpgradeListener::AcceptLoop, this) != 0) {
+    close(fd_);
+    fd_ = -1;
+    return -1;
+  }
+  return 0;
+}
+
+void UpgradeListener::Stop() {
+  if (fd_ == -1) {
+    return;
+  }
+  stopping_ = true;
+  // Wakes the blocked accept.
+  shutdown(fd_, SHUT_RDWR);
+  pthread_join(thread_, nullptr);
+  close(fd_);
+  fd_ = -1;
+  if (!handed_off_) {
+    unlink(path_.c_str());
+  }
+}
+
+int UpgradeListener::Fd() const {
+  return fd_;
+}
+
+void* UpgradeListener::AcceptLoop(void* arg) {
+  UpgradeListener* listener = static_cast<UpgradeListener*>(arg);
+  while (!listener->stopping_) {
+    int conn_fd = accept(listener->fd_, nullptr, nullptr);
+    if (conn_fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break;
+    }
+    int ret = listener->HandOff(conn_fd);
+    close(conn_fd);
+    if (ret == 0) {
+      listener->handed_off_ = true;
+      listener->on_handoff_();
+      break;
+    }
+    std::cout << "Upgrade abandoned; still serving" << std::endl;
+  }
+  return nullptr;
+}
+
+int UpgradeListener::HandOff(int conn_fd) {
+  vector<string> hot_keys;
+  snapshot_(&hot_keys);
+  string snapshot;
+  for (const string& key : hot_keys) {
+    snapshot += key + "\n";
+  }
+  HandoffHeader header = {static_cast<uint32_t>(listen_fds_.size()), static_cast<uint32_t>(snapshot.length())};
+  struct iovec iov = {&header, sizeof(header)};
+  char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * listen_fds_.size());
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * listen_fds_.size());
+  memcpy(CMSG_DATA(cmsg), listen_fds_.data(), sizeof(int) * listen_fds_.size());
+  if (sendmsg(conn_fd, &msg, MSG_NOSIGNAL) != sizeof(header)) {
+    return -1;
+  }
+  if (WriteAll(conn_fd, snapshot.data(), snapshot.length()) == -1) {
+    return -1;
+  }
+  // Blocks while the new process warms up; EOF if it dies first.
+  char ready;
+  if (ReadAll(conn_fd, &ready, 1) == -1 || ready != HANDOFF_READY) {
+    return -1;
+  }
+  return 0;
+}
+
+int RequestUpgrade(const string& path, vector<int>* fds, vector<string>* hot_keys) {
+  struct sockaddr_un addr;
+  if (FillAddr(path, &addr) == -1) {
+    return -1;
+  }
+  int conn_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (conn_fd == -1) {
+    return -1;
+  }
+  if (connect(conn_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    close(conn_fd);
+    return -1;
+  }
+  HandoffHeader header;
+  struct iovec iov = {&header, sizeof(header)};
+  char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n;
+  do {
+    n = recvmsg(conn_fd, &msg, 0);
+  } while (n == -1 && errno == EINTR);
+  if (n != sizeof(header) || (msg.msg_flags & MSG_CTRUNC)) {
+    close(conn_fd);
+    return -1;
+  }
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const int* received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+    fds->insert(fds->end(), received, received + count);
+  }
+  string snapshot(header.snapshot_len, '\0');
+  if (fds->size() != header.num_fds ||
+      ReadAll(conn_fd, &snapshot[0], snapshot.length()) == -1) {
+    for (int fd : *fds) {
+      close(fd);
+    }
+    fds->clear();
+    close(conn_fd);
+    return -1;
+  }
+  Utils::Split(snapshot, "\n", hot_keys);
+  return conn_fd;
+}
+
+int CompleteUpgrade(int conn_fd) {
+  char ready = HANDOFF_READY;
+  int ret = WriteAll(conn_fd, &ready, 1);
+  close(conn_fd);
+  return ret;
+}
+
+} // namespace Cerver
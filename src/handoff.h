@@ -0,0 +1,62 @@
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+namespace Cerver {
+
+// Zero-downtime upgrades. A running server listens on a Unix socket; the
+// new binary connects to it and receives the listen sockets themselves
+// (SCM_RIGHTS), plus a snapshot of the old process's hot keys to warm its
+// caches with. Both processes accept from the same sockets until the new one
+// reports it is serving, so no connection is refused, and only then does the
+// old one stop accepting and drain.
+//
+// If the new process dies before it is ready, the old one never notices a
+// thing and keeps serving.
+class UpgradeListener {
+  public:
+    typedef std::function<void(std::vector<std::string>*)> Snapshot;
+    // [snapshot] is asked for the hot keys when a new process connects.
+    // [on_handoff] runs on the listener's thread once the new process is
+    // serving; the listener accepts no further upgrades after that.
+    UpgradeListener(const std::string& path, Snapshot snapshot, std::function<void()> on_handoff);
+    ~UpgradeListener();
+    // Binds [path], replacing any socket left there, and starts handing
+    // [listen_fds] to whoever connects. Returns -1 on failure.
+    int Start(const std::vector<int>& listen_fds);
+    // Stops listening, and removes the socket from [path] unless a new
+    // process has taken over.
+    void Stop();
+    // The listening Unix socket, which forked children should close.
+    int Fd() const;
+
+  private:
+    static void* AcceptLoop(void* arg);
+    // Returns 0 once the new process is ready, -1 if it went away.
+    int HandOff(int conn_fd);
+
+    std::string path_;
+    Snapshot snapshot_;
+    std::function<void()> on_handoff_;
+    std::vector<int> listen_fds_;
+    int fd_;
+    pthread_t thread_;
+    volatile bool stopping_;
+    volatile bool handed_off_;
+};
+
+// Run by the new process. Connects to the server listening at [path] and
+// receives its listen sockets in [fds] and its hot keys in [hot_keys].
+// Returns the connection, to be passed to CompleteUpgrade, or -1 if no
+// server is listening there.
+int RequestUpgrade(const std::string& path, std::vector<int>* fds, std::vector<std::string>* hot_keys);
+// Tells the old process that the new one is serving, so it may drain.
+int CompleteUpgrade(int conn_fd);
+
+} // namespace Cerver
+
+#endif
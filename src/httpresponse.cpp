@@ -4,18 +4,27 @@ using std::string;
 
 namespace Cerver {
 
-HttpResponse::HttpResponse(TCPConnection* conn) : status_code_(200), reason_phrase_("OK"), has_body_(false), body_(""), conn_(conn) { }
+HttpResponse::HttpResponse(TCPConnection* conn) : status_code_(200), reason_phrase_("OK"), has_body_(false), body_(""), conn_(conn), written_(false) { }
 HttpResponse::HttpResponse() : HttpResponse(nullptr){ }
 HttpResponse::~HttpResponse() { }
 void HttpResponse::PutHeader(const string& k, const string& v) {headers_.insert({k, v});}
 void HttpResponse::SetProtocol(const string& protocol) {protocol_ = protocol;}
 void HttpResponse::SetStatusCode(int status_code, const string& reason_phrase) {status_code_ = status_code;reason_phrase_ = reason_phrase;}
-void HttpResponse::SetBody(const string& body) {has_body_ = true; body_ = body;}
-void HttpResponse::AppendBody(const std::string& body) {has_body_ = true; body_ += body;}
+void HttpResponse::SetBody(const string& body) {has_body_ = true; body_ = body; body_ref_ = Utils::SharedBuffer();}
+void HttpResponse::SetBody(const Utils::SharedBuffer& body) {has_body_ = true; body_.clear(); body_ref_ = body;}
+void HttpResponse::AppendBody(const std::string& body) {
+	has_body_ = true;
+	if (!body_ref_.Empty()) {
+		body_ = body_ref_.ToString();
+		body_ref_ = Utils::SharedBuffer();
+	}
+	body_ += body;
+}
 void HttpResponse::SetContentType(const string& type) {PutHeader("Content-Type", type);}
 int HttpResponse::StatusCode() const {return status_code_;}
 const std::string& HttpResponse::Reason() const {return reason_phrase_;}
 const string& HttpResponse::Body() const {return body_;}
+const Utils::SharedBuffer& HttpResponse::BodyRef() const {return body_ref_;}
 std::string* HttpResponse::BodyPtr() {return &body_;}
 bool HttpResponse::Written() const {return written_;}
 void HttpResponse::UseBody() {has_body_ = true;}
@@ -16,6 +16,8 @@ public:
   void SetProtocol(const std::string& protocol);
   void SetStatusCode(int status_code, const std::string& reason_phrase);
   void SetBody(const std::string& body);
+  // Adopts [body] without copying it; it is sent straight from its buffer.
+  void SetBody(const Utils::SharedBuffer& body);
   void AppendBody(const std::string& body);
   void SetContentType(const std::string& type);
   void write(const std::string& content);
@@ -23,6 +25,7 @@ public:
   int StatusCode() const;
   const std::string& Reason() const;
   const std::string& Body() const;
+  const Utils::SharedBuffer& BodyRef() const;
   std::string* BodyPtr();
   void UseBody();
   bool HasBody() const;
@@ -34,6 +37,7 @@ private:
   std::unordered_map<std::string, std::string> headers_;
   bool has_body_;
   std::string body_;
+  Utils::SharedBuffer body_ref_;
   TCPConnection* conn_;
   bool written_;
 };
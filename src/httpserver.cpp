@@ -3,12 +3,21 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <cstring>
+#include <algorithm>
 #include "httpserver.h"
 #include "utils.h"
+#include "mimetypes.h"
+#include "handoff.h"
 
 #define REQ_INVALID 1
 #define ROUTE_FOUND 2
 #define NO_ROUTE 3
+#define STATIC_ROUTE_FOUND 4
+#define MOUNT_FOUND 5
+
+#define DRAIN_TIMEOUT_US 10000000 // Connections still open after this are cut
 
 using std::string;
 using std::unique_ptr;
@@ -19,8 +28,9 @@ namespace Cerver {
 
 volatile bool running = false;
 volatile bool stat = false;
+volatile bool drain = false;
 
-HttpServer::Stats::Stats() : num_conn_(0), num_req_(0) {
+HttpServer::Stats::Stats() : num_conn_(0), num_req_(0), slot_(nullptr) {
   pthread_mutex_init(&lock_, nullptr);
 }
 HttpServer::Stats::~Stats() {
@@ -30,16 +40,41 @@ void HttpServer::Stats::IncConn() {
   pthread_mutex_lock(&lock_);
   num_conn_++;
   pthread_mutex_unlock(&lock_);
+  if (slot_ != nullptr) {
+    slot_->connections++;
+  }
 }
 void HttpServer::Stats::DecConn() {
   pthread_mutex_lock(&lock_);
   num_conn_--;
   pthread_mutex_unlock(&lock_);
+  if (slot_ != nullptr) {
+    slot_->connections--;
+  }
 }
 void HttpServer::Stats::IncReq() {
   pthread_mutex_lock(&lock_);
   num_req_++;
   pthread_mutex_unlock(&lock_);
+  if (slot_ != nullptr) {
+    slot_->requests++;
+  }
+}
+void HttpServer::Stats::IncShed() {
+  if (slot_ != nullptr) {
+    slot_->shed++;
+  }
+}
+void HttpServer::Stats::IncRateLimited() {
+  if (slot_ != nullptr) {
+    slot_->rate_limited++;
+  }
+}
+void HttpServer::Stats::Attach(SharedStats::Slot* slot) {slot_ = slot;}
+void HttpServer::Stats::SetServing(bool serving) {
+  if (slot_ != nullptr) {
+    slot_->serving = serving;
+  }
 }
 int HttpServer::Stats::GetConn() const {return num_conn_;}
 int HttpServer::Stats::GetReq() const {return num_req_;}
@@ -49,32 +84,74 @@ static void HandleSignal(int signum) {
     running = false;
   } else if (signum == SIGUSR1) {
     stat = true;
+  } else if (signum == SIGUSR2) {
+    drain = true;
   }
 }
 
 static unordered_map<int, string> err_codes = {{404, "Not Found"},
                                                {405, "Method Not Allowed"},
+                                               {429, "Too Many Requests"},
+                                               {503, "Service Unavailable"},
                                                {505, "HTTP Version not supported"}};
 
-HttpServer::HttpServer(int max_thread, int listen_port)
-  : threadpool_(std::make_unique<ThreadPool>(max_thread)),
+static ServerConfig MakeConfig(int max_thread, int listen_port) {
+  ServerConfig config;
+  config.threads = max_thread;
+  config.port = listen_port;
+  return config;
+}
+
+HttpServer::HttpServer(int max_thread, int listen_port) : HttpServer(MakeConfig(max_thread, listen_port)) { }
+
+HttpServer::HttpServer(const ServerConfig& config)
+  : threadpool_(std::make_unique<ThreadPool>(config.threads, config.worker_cpus, &TCPConnection::PrepareThreadBuffer)),
     log_(std::make_unique<Logger>("cerverlog", 1024 * 1024 * 1024)),
-    listen_port_(listen_port),
-    stat_()
-{ }
+    listen_port_(config.port),
+    listen_fd_(-1),
+    backlog_(config.backlog),
+    acceptor_cpus_(config.acceptor_cpus),
+    stat_(),
+    shedder_(std::make_unique<LoadShedder>()),
+    static_max_age_(86400)
+{
+  pthread_mutex_init(&conns_lock_, nullptr);
+}
 
-HttpServer::~HttpServer() { }
+HttpServer::~HttpServer() {
+  pthread_mutex_destroy(&conns_lock_);
+}
 
 void HttpServer::Run() {
   running = true;
+  drain = false;
+  acceptor_ = pthread_self();
   PrepareToHandleSignal(SIGINT, HandleSignal);
   PrepareToHandleSignal(SIGUSR1, HandleSignal);
+  PrepareToHandleSignal(SIGUSR2, HandleSignal);
   *log_ << Utils::GetTime() << "Server starts\n";
-  int listen_fd = CreateListenSocket(listen_port_, 100);
+  for (auto& mount : mounts_) {
+    mount.second->Watch();
+  }
+  if (!acceptor_cpus_.empty() && ThreadPool::PinThread(pthread_self(), acceptor_cpus_) == -1) {
+    std::cout << "Failed to pin the acceptor thread" << std::endl;
+  }
+  int listen_fd = listen_fd_ != -1 ? listen_fd_ : CreateListenSocket(listen_port_, backlog_);
   if (listen_fd == -1) {
     std::cout << "Failed to create listen socket" << std::endl;
     return;
   }
+  unique_ptr<UpgradeListener> upgrade;
+  if (!upgrade_path_.empty()) {
+    pthread_t acceptor = acceptor_;
+    upgrade = std::make_unique<UpgradeListener>(upgrade_path_,
+      [this](vector<string>* keys) { HotKeys(keys); },
+      [acceptor]() { drain = true; pthread_kill(acceptor, SIGUSR2); });
+    if (upgrade->Start({listen_fd}) == -1) {
+      std::cout << "Failed to listen for upgrades on " << upgrade_path_ << std::endl;
+    }
+  }
+  stat_.SetServing(true);
   while (true) {
     string addr;
     int port;
@@ -84,30 +161,87 @@ void HttpServer::Run() {
         if (stat) {
           PrintStat();
         }
-        if (!running) {
+        if (!running || drain) {
           break;
         }
       }
       continue;
     }
+    if (client_limiter_ != nullptr && !client_limiter_->Allow(addr)) {
+      Shed(comm_fd, 429);
+      stat_.IncRateLimited();
+      *log_ << Utils::GetTime() << "Rate limited connection from " << addr << ":" << port << "\n";
+      continue;
+    }
+    uint64_t oldest_enqueue_us;
+    size_t queue_depth = threadpool_->QueueDepth(&oldest_enqueue_us);
+    int verdict = shedder_->Admit(stat_.GetConn(), queue_depth, oldest_enqueue_us);
+    if (verdict != ADMIT) {
+      Shed(comm_fd, 503);
+      stat_.IncShed();
+      *log_ << Utils::GetTime() << "Shed connection from " << addr << ":" << port << " (" << verdict << ")\n";
+      continue;
+    }
     stat_.IncConn();
     *log_ << Utils::GetTime() << "Connection from " << addr << ":" << port << "\n";
-    unique_ptr<ThreadPool::Task> task = std::make_unique<HttpServerTask>(comm_fd, this);
+    unique_ptr<ThreadPool::Task> task = std::make_unique<HttpServerTask>(comm_fd, addr, this);
     threadpool_->Dispatch(std::move(task));
   }
+  stat_.SetServing(false);
+  if (upgrade != nullptr) {
+    upgrade->Stop();
+  }
+  if (drain && running) {
+    Drain(listen_fd);
+  }
   threadpool_->KillThreads();
   *log_ << Utils::GetTime() << "Server shut down\n";
   std::cout << "Server shut down" << std::endl;
 }
 
 
-HttpServerTask::HttpServerTask(int comm_fd, HttpServer* server) : comm_fd_(comm_fd), server_(server) { }
+void HttpServer::Drain(int listen_fd) {
+  *log_ << Utils::GetTime() << "Draining " << stat_.GetConn() << " connections\n";
+  // Whoever shares the socket keeps accepting from it.
+  close(listen_fd);
+  uint64_t deadline = ThreadPool::NowMicros() + DRAIN_TIMEOUT_US;
+  while (stat_.GetConn() > 0 && ThreadPool::NowMicros() < deadline) {
+    // Idle keep-alive connections see EOF at once; busy ones after their
+    // response. Repeated for connections that were still queued.
+    pthread_mutex_lock(&conns_lock_);
+    for (int fd : conns_) {
+      shutdown(fd, SHUT_RD);
+    }
+    pthread_mutex_unlock(&conns_lock_);
+    usleep(10000);
+  }
+}
+
+void HttpServer::Unregister(int comm_fd) {
+  pthread_mutex_lock(&conns_lock_);
+  conns_.erase(comm_fd);
+  pthread_mutex_unlock(&conns_lock_);
+}
+
+HttpServerTask::HttpServerTask(int comm_fd, const string& addr, HttpServer* server) : comm_fd_(comm_fd), addr_(addr), server_(server) { }
 HttpServerTask::~HttpServerTask() { }
-void HttpServerTask::Run() { server_->ThreadLoop(comm_fd_); }
+void HttpServerTask::Run() {
+  server_->GetLoadShedder()->OnDequeue(ThreadPool::NowMicros() - enqueue_us);
+  server_->ThreadLoop(comm_fd_, addr_);
+}
 
-void HttpServer::ThreadLoop(int comm_fd) {
+void HttpServer::ThreadLoop(int comm_fd, const string& addr) {
   TCPConnection conn = TCPConnection(comm_fd);
+  pthread_mutex_lock(&conns_lock_);
+  conns_.insert(comm_fd);
+  pthread_mutex_unlock(&conns_lock_);
+  // The first request was paid for when the connection was accepted.
+  bool charged = true;
   while (true) {
+    // While draining, keep-alive ends after the request in flight.
+    if (drain && !charged) {
+      break;
+    }
     string header;
     int ret = conn.ReadUntilDoubleCRLF(&header);
     if (ret <= 0) {
@@ -116,12 +250,28 @@ void HttpServer::ThreadLoop(int comm_fd) {
       }
       break;
     }
+    uint64_t arrival_us = NowMicros();
+    if (!charged && client_limiter_ != nullptr && !client_limiter_->Allow(addr)) {
+      HttpResponse limited;
+      SetErrCode(429, &limited);
+      limited.PutHeader("Retry-After", "1");
+      limited.PutHeader("Connection", "close");
+      SendResponse(&limited, &conn, limited.Body());
+      stat_.IncRateLimited();
+      break;
+    }
+    charged = false;
     HttpRequest req;
     HttpResponse res;
     Route* route = nullptr;
-    int req_status = PrepareRequest(header, &req, &conn, &route);
+    const StaticResponse* static_res = nullptr;
+    StaticFileHandler* mount = nullptr;
+    int req_status = PrepareRequest(header, &req, &conn, &route, &static_res, &mount);
     *log_ << Utils::GetTime() << req.Method() << " " << req.URI() << " " << req.Protocol() << "\n";
     stat_.IncReq();
+    if (capture_ != nullptr && req_status != REQ_INVALID) {
+      capture_->Append(arrival_us, req.Method(), req.URI());
+    }
     if (req_status == REQ_INVALID) {
       SetErrCode(404, &res);
       SendResponse(&res, &conn, res.Body());
@@ -132,27 +282,58 @@ void HttpServer::ThreadLoop(int comm_fd) {
       SendResponse(&res, &conn, res.Body());
       continue;
     }
+    if (req_status == STATIC_ROUTE_FOUND) {
+      SendStaticResponse(static_res, req, &conn);
+      continue;
+    }
+    if (req_status == MOUNT_FOUND) {
+      string path;
+      req.PathParam("*", &path);
+      std::shared_ptr<const StaticResponse> file = mount->Lookup(path);
+      if (file == nullptr) {
+        SetErrCode(404, &res);
+        SendResponse(&res, &conn, res.Body());
+        continue;
+      }
+      SendStaticResponse(file.get(), req, &conn);
+      continue;
+    }
+    auto limiter_it = route_limiters_.find(route);
+    if (limiter_it != route_limiters_.end() && !limiter_it->second->Allow(addr)) {
+      SetErrCode(429, &res);
+      res.PutHeader("Retry-After", "1");
+      SendResponse(&res, &conn, res.Body());
+      stat_.IncRateLimited();
+      continue;
+    }
     string out = (*route)(req, &res);
     if (res.Written()) {
+      Unregister(comm_fd);
       conn.Close();
+      stat_.DecConn();
       return;
     }
     if (out.length() > 0) {
       SendResponse(&res, &conn, out);
       continue;
     }
+    if (!res.BodyRef().Empty()) {
+      SendResponse(&res, &conn, res.BodyRef());
+      continue;
+    }
     if (res.HasBody()) {
       SendResponse(&res, &conn, res.Body());
       continue;
     }
     SendResponse(&res, &conn, "");
   }
+  Unregister(comm_fd);
   conn.Close();
   stat_.DecConn();
   *log_ << Utils::GetTime() << "Connection closed\n";
 }
 
-int HttpServer::PrepareRequest(const string& header, HttpRequest* req, TCPConnection* conn, Route** route) {
+int HttpServer::PrepareRequest(const string& header, HttpRequest* req, TCPConnection* conn, Route** route, const StaticResponse** static_res, StaticFileHandler** mount) {
   vector<string> lines;
   int num_lines = Utils::Split(header, "\r\n", &lines);
   if (num_lines < 1) {
@@ -168,10 +349,26 @@ int HttpServer::PrepareRequest(const string& header, HttpRequest* req, TCPConnec
   req->SetMethod(first_line[0]);
   req->SetURI(first_line[1]);
   req->SetProtocol(first_line[2]);
-  if (routes_.find(req->Method()) == routes_.end()) {
+  const StaticResponse* s = nullptr;
+  if (req->Method() == "get" && !static_routes_.empty()) {
+    auto static_it = static_routes_.find(req->URI().substr(0, req->URI().find("?")));
+    if (static_it != static_routes_.end()) {
+      s = static_it->second.get();
+    }
+  }
+  bool has_routes = routes_.find(req->Method()) != routes_.end();
+  if (s == nullptr && !has_routes && (req->Method() != "get" || mounts_.empty())) {
     return NO_ROUTE;
   }
-  Route* r = CollectPathParam(req);
+  Route* r = s == nullptr && has_routes ? CollectPathParam(req) : nullptr;
+  StaticFileHandler* m = nullptr;
+  if (s == nullptr && r == nullptr && req->Method() == "get") {
+    string rest;
+    m = FindMount(req->URI().substr(0, req->URI().find("?")), &rest);
+    if (m != nullptr) {
+      req->PutPathParam("*", rest);
+    }
+  }
   CollectQueryParam(req);
   for (uint i = 1; i < lines.size(); i++) {
     vector<string> kv;
@@ -188,6 +385,14 @@ int HttpServer::PrepareRequest(const string& header, HttpRequest* req, TCPConnec
   if (len > 0) {
     conn->ReadSize(len, &(req->body_));
   }
+  if (s != nullptr) {
+    *static_res = s;
+    return STATIC_ROUTE_FOUND;
+  }
+  if (m != nullptr) {
+    *mount = m;
+    return MOUNT_FOUND;
+  }
   if (r == nullptr) {
     return NO_ROUTE;
   }
@@ -211,39 +416,33 @@ void HttpServer::SendResponse(HttpResponse* res, TCPConnection* conn, const stri
   *log_ << Utils::GetTime() << "Response sent\n";
 }
 
-string HttpServer::GetContentType(const string& path) {
-  string ext = ""; 
-  for (uint i = path.length() - 1; i >= 0; i--) {
-    ext += path[i];
-    if (path[i] == '.') {
-      break;
-    }
-  }
-  int l = 0;
-  int r = ext.length() - 1;
-  while (l < r) {
-    char temp = ext[l];
-    ext[l] = ext[r];
-    ext[r] = temp;
-    l++;
-    r--;
-  }
-  if (ext == ".jpeg") {
-    return "image/jpeg";
-  }
-  if (ext == ".png") {
-    return "image/png";
-  }
-  if (ext == ".jpg") {
-    return "image/jpg";
-  }
-  if (ext == ".html") {
-    return "text/html";
+void HttpServer::SendResponse(HttpResponse* res, TCPConnection* conn, const Utils::SharedBuffer& body) {
+  *log_ << Utils::GetTime() << "Sending response header " << res->StatusCode() << "\n";
+  res->PutHeader("Content-Length", std::to_string(body.Size()));
+  string header = "HTTP/1.1 " + std::to_string(res->StatusCode()) + " " + res->Reason() + "\r\n";
+  for (auto it = res->Headers().begin(); it != res->Headers().end(); it++) {
+    header += it->first + ": " + it->second + "\r\n";
   }
-  if (ext == ".css") {
-    return "text/css";
+  header += "\r\n";
+  // Header and body leave in one writev; the body is never copied.
+  conn->Send(Utils::SharedBuffer(std::move(header)), body);
+  *log_ << Utils::GetTime() << "Response sent\n";
+}
+
+void HttpServer::SendStaticResponse(const StaticResponse* static_res, const HttpRequest& req, TCPConnection* conn) {
+  string etag;
+  if (req.Header("if-none-match", &etag) == 0 && etag == static_res->etag) {
+    *log_ << Utils::GetTime() << "Sending response header 304\n";
+    conn->Send(static_res->not_modified, Utils::SharedBuffer());
+  } else {
+    *log_ << Utils::GetTime() << "Sending response header 200\n";
+    conn->Send(static_res->header, static_res->body);
   }
-  return "text/plain";
+  *log_ << Utils::GetTime() << "Response sent\n";
+}
+
+string HttpServer::GetContentType(const string& path) {
+  return string(MimeTypeFor(path));
 }
 
 void HttpServer::SetErrCode(int err_code, HttpResponse* res) {
@@ -267,13 +466,20 @@ void HttpServer::GetStats(const HttpRequest& req, HttpResponse* res) {
   res->SetStatusCode(200, "OK");
   res->PutHeader("Content-Type", "text/html");
 
+  LoadShedder::Stats shed;
+  shedder_->GetStats(&shed);
   char* body = new char[4096];
-  int len = sprintf(body, "<html><h2>HttpServer status</h2><body><p>Listening on port %d<br>Number of threads: %d<br>Number of active connections: %d<br>Number of tasks in work queue: %ld<br>Accumulative number of requests: %d</p></body></html>",
+  int len = sprintf(body, "<html><h2>HttpServer status</h2><body><p>Listening on port %d<br>Number of threads: %d<br>Number of active connections: %d<br>Number of tasks in work queue: %ld<br>Accumulative number of requests: %d<br>Connections shed: %llu (connection cap %llu, queue depth %llu, queue wait %llu)<br>Requests rate limited: %llu</p></body></html>",
                           listen_port_,
                           threadpool_->num_threads_running_,
                           stat_.GetConn(),
                           threadpool_->work_queue_.size(),
-                          stat_.GetReq());
+                          stat_.GetReq(),
+                          static_cast<unsigned long long>(shed.shed_connections + shed.shed_queue_depth + shed.shed_queue_wait),
+                          static_cast<unsigned long long>(shed.shed_connections),
+                          static_cast<unsigned long long>(shed.shed_queue_depth),
+                          static_cast<unsigned long long>(shed.shed_queue_wait),
+                          static_cast<unsigned long long>(RateLimited()));
   res->PutHeader("Content-Length", std::to_string(len));
   res->SetBody(string(body, len));
   delete[] body;
@@ -284,7 +490,14 @@ void HttpServer::PrintStat() {
   std::cout << "Listening on port " << listen_port_ << "\n";
   std::cout << "Number of threads: " << threadpool_->num_threads_running_ << "\n";
   std::cout << "Number of active connections: " << stat_.GetConn() << "\n";
-  std::cout << "Number of tasks in work queue: " << threadpool_->work_queue_.size() << std::endl;
+  std::cout << "Number of tasks in work queue: " << threadpool_->work_queue_.size() << "\n";
+  LoadShedder::Stats shed;
+  shedder_->GetStats(&shed);
+  std::cout << "Connections shed: " << shed.shed_connections + shed.shed_queue_depth + shed.shed_queue_wait
+            << " (connection cap " << shed.shed_connections
+            << ", queue depth " << shed.shed_queue_depth
+            << ", queue wait " << shed.shed_queue_wait << ")\n";
+  std::cout << "Requests rate limited: " << RateLimited() << std::endl;
   stat = false;
 }
 
@@ -370,6 +583,137 @@ void HttpServer::ReadFile(HttpResponse* res, const string& path) {
   delete[] buf;
 }
 
+void HttpServer::StaticGet(const string& route, const Utils::SharedBuffer& body, const string& content_type) {
+  static_routes_[route] = MakeStaticResponse(body, content_type, MakeETag(body), static_max_age_);
+}
+
+void HttpServer::StaticGet(const string& route, const Utils::SharedBuffer& body) {
+  StaticGet(route, body, GetContentType(route));
+}
+
+StaticFileHandler* HttpServer::ServeDirectory(const string& prefix, const string& dir, size_t cache_bytes) {
+  mounts_.emplace_back(prefix, std::make_unique<StaticFileHandler>(dir, cache_bytes, static_max_age_));
+  StaticFileHandler* mount = mounts_.back().second.get();
+  std::stable_sort(mounts_.begin(), mounts_.end(), [](const auto& a, const auto& b) {
+    return a.first.length() > b.first.length();
+  });
+  return mount;
+}
+
+StaticFileHandler* HttpServer::FindMount(const string& path, string* rest) {
+  for (auto& prefix_mount : mounts_) {
+    const string& prefix = prefix_mount.first;
+    // "/static" matches "/static" and "/static/...", not "/staticfoo".
+    if (path.compare(0, prefix.length(), prefix) == 0 &&
+        (path.length() == prefix.length() || prefix.back() == '/' || path[prefix.length()] == '/')) {
+      *rest = path.substr(prefix.length());
+      return prefix_mount.second.get();
+    }
+  }
+  return nullptr;
+}
+
+void HttpServer::HotKeys(vector<string>* paths) {
+  for (auto& prefix_mount : mounts_) {
+    string prefix = prefix_mount.first;
+    if (prefix.back() != '/') {
+      prefix += '/';
+    }
+    vector<string> keys;
+    prefix_mount.second->HotKeys(&keys);
+    for (const string& key : keys) {
+      paths->push_back(prefix + key);
+    }
+  }
+}
+
+void HttpServer::Warm(const vector<string>& paths) {
+  for (const string& path : paths) {
+    string rest;
+    StaticFileHandler* mount = FindMount(path, &rest);
+    if (mount != nullptr) {
+      mount->Lookup(rest);
+    }
+  }
+}
+
+void HttpServer::EnableUpgrade(const string& path) {
+  upgrade_path_ = path;
+}
+
+void HttpServer::UseListenSocket(int listen_fd) {
+  listen_fd_ = listen_fd;
+}
+
+void HttpServer::AttachStats(SharedStats::Slot* slot) {
+  stat_.Attach(slot);
+}
+
+ThreadPool* HttpServer::GetThreadPool() {
+  return threadpool_.get();
+}
+
+LoadShedder* HttpServer::GetLoadShedder() {
+  return shedder_.get();
+}
+
+void HttpServer::SetLoadShedding(const LoadShedder::Options& options) {
+  shedder_ = std::make_unique<LoadShedder>(options);
+}
+
+uint64_t HttpServer::RateLimited() {
+  uint64_t limited = client_limiter_ != nullptr ? client_limiter_->Limited() : 0;
+  for (auto& limiter : route_limiters_) {
+    limited += limiter.second->Limited();
+  }
+  return limited;
+}
+
+void HttpServer::LimitClients(double rate, double burst) {
+  client_limiter_ = std::make_unique<RateLimiter>(rate, burst);
+}
+
+void HttpServer::LimitRoute(const string& route, double rate, double burst) {
+  for (auto& method : routes_) {
+    auto it = method.second.find(route);
+    if (it != method.second.end()) {
+      route_limiters_[it->second.get()] = std::make_unique<RateLimiter>(rate, burst);
+    }
+  }
+}
+
+void HttpServer::Shed(int comm_fd, int status_code) {
+  static const char kServiceUnavailable[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                            "Retry-After: 1\r\n"
+                                            "Content-Length: 0\r\n"
+                                            "Connection: close\r\n\r\n";
+  static const char kTooManyRequests[] = "HTTP/1.1 429 Too Many Requests\r\n"
+                                         "Retry-After: 1\r\n"
+                                         "Content-Length: 0\r\n"
+                                         "Connection: close\r\n\r\n";
+  const char* response = status_code == 429 ? kTooManyRequests : kServiceUnavailable;
+#ifdef MSG_NOSIGNAL
+  int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+  int flags = MSG_DONTWAIT;
+#endif
+  // Consume whatever of the request has arrived, so that closing does not
+  // reset the connection before the client reads the response.
+  char buf[4096];
+  while (recv(comm_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) { }
+  send(comm_fd, response, strlen(response), flags);
+  shutdown(comm_fd, SHUT_WR);
+  close(comm_fd);
+}
+
+void HttpServer::SetStaticMaxAge(int seconds) {
+  static_max_age_ = seconds;
+}
+
+void HttpServer::EnableCapture(const string& path) {
+  capture_ = std::make_unique<AccessCapture>(path);
+}
+
 void HttpServer::Put(const string& route, Route lambda) {
   auto it = routes_.find("put");
   if (it == routes_.end()) {
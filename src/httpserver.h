@@ -5,6 +5,7 @@
 
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <pthread.h>
 #include "server.h"
@@ -14,6 +15,13 @@
 #include "lrucache.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "accesslog.h"
+#include "sharedbuffer.h"
+#include "staticfilehandler.h"
+#include "loadshedder.h"
+#include "ratelimiter.h"
+#include "serverconfig.h"
+#include "sharedstats.h"
 
 namespace Cerver {
 
@@ -22,18 +30,68 @@ class HttpServer : public Server {
 public:
   typedef std::function<std::string(const HttpRequest&, HttpResponse*)> Route;
   HttpServer(int max_thread, int listen_port);
+  explicit HttpServer(const ServerConfig& config);
   virtual ~HttpServer();
   void Run() override;
-  void ThreadLoop(int comm_fd);
-  int PrepareRequest(const std::string& header, HttpRequest* req, TCPConnection* conn, Route** route);
+  void ThreadLoop(int comm_fd, const std::string& addr);
+  int PrepareRequest(const std::string& header, HttpRequest* req, TCPConnection* conn, Route** route, const StaticResponse** static_res, StaticFileHandler** mount);
+  void SendStaticResponse(const StaticResponse* static_res, const HttpRequest& req, TCPConnection* conn);
   void SendResponse(HttpResponse* res, TCPConnection* conn, const std::string& body);
+  void SendResponse(HttpResponse* res, TCPConnection* conn, const Utils::SharedBuffer& body);
   void PrintStat();
   void GetStats(const HttpRequest& req, HttpResponse* res);
   Route* CollectPathParam(HttpRequest* req);
+  // The mount serving [path], with the part after its prefix in [rest].
+  StaticFileHandler* FindMount(const std::string& path, std::string* rest);
   void CollectQueryParam(HttpRequest* req);
   void Put(const std::string& route, Route lambda);
   void Get(const std::string& route, Route lambda);
+  ThreadPool* GetThreadPool();
+  LoadShedder* GetLoadShedder();
+  // Replaces the default admission limits. Must be called before Run.
+  void SetLoadShedding(const LoadShedder::Options& options);
+  // Limits each client address to [rate] requests per second with bursts of
+  // up to [burst]. A new connection over the limit is answered with 429 from
+  // the accept thread; a request over it on an open connection gets a 429
+  // and the connection is closed. Must be called before Run.
+  void LimitClients(double rate, double burst);
+  // Additionally limits each client's requests to [route], which must
+  // already be defined, answering 429 to those over the limit.
+  void LimitRoute(const std::string& route, double rate, double burst);
+  // Requests and connections refused by any rate limit so far.
+  uint64_t RateLimited();
+  // Serves [body] at exactly [route] for GET. The status line, headers, ETag
+  // and cache headers are built here once and every hit writes the same
+  // buffers to the socket. Must be called before Run.
+  void StaticGet(const std::string& route, const Utils::SharedBuffer& body, const std::string& content_type);
+  // Same, with the content type taken from the route's extension.
+  void StaticGet(const std::string& route, const Utils::SharedBuffer& body);
+  // Serves the files under [dir] for GETs under [prefix] that match no
+  // other route. Contents are cached in up to [cache_bytes] and invalidated
+  // when files change. Must be called before Run.
+  StaticFileHandler* ServeDirectory(const std::string& prefix, const std::string& dir, size_t cache_bytes = 64 * 1024 * 1024);
+  // max-age sent with static responses. Defaults to one day.
+  void SetStaticMaxAge(int seconds);
+  // Records every request with its arrival time to [path] for bin/replay.
+  void EnableCapture(const std::string& path);
+  // Accepts from [listen_fd], e.g. one inherited from a pre-fork master,
+  // instead of opening a socket on the configured port. Must be called
+  // before Run.
+  void UseListenSocket(int listen_fd);
+  // Mirrors this server's counters into [slot] of a SharedStats region.
+  void AttachStats(SharedStats::Slot* slot);
+  // Hands the listen socket to a new process that connects to the Unix
+  // socket at [path] (see handoff.h), then drains and returns from Run.
+  // SIGUSR2 drains the same way without a handoff. Must be called before Run.
+  void EnableUpgrade(const std::string& path);
+  // URL paths of the cached static files, most recently used first.
+  void HotKeys(std::vector<std::string>* paths);
+  // Loads [paths] into the static file caches.
+  void Warm(const std::vector<std::string>& paths);
 
+  // Answers a connection with [status_code] (503 or 429) and closes it
+  // without reading the request.
+  static void Shed(int comm_fd, int status_code);
   static void SetErrCode(int status_code, HttpResponse* res);
   static void ReadFile(HttpResponse* res, const std::string& path);
   static std::string GetContentType(const std::string& path);
@@ -45,29 +103,58 @@ public:
       void IncConn();
       void DecConn();
       void IncReq();
+      // Only counted in the attached slot; the shedder and limiters keep
+      // the local counts.
+      void IncShed();
+      void IncRateLimited();
+      void Attach(SharedStats::Slot* slot);
+      // Marks the attached slot as accepting connections.
+      void SetServing(bool serving);
       int GetConn() const;
       int GetReq() const;
     private:
       uint32_t num_conn_;
       uint32_t num_req_;
       pthread_mutex_t lock_;
+      SharedStats::Slot* slot_;
   };
 
 private:
+  // Stops accepting and waits for open connections to finish.
+  void Drain(int listen_fd);
+  void Unregister(int comm_fd);
+
   std::unique_ptr<ThreadPool> threadpool_;
   std::unique_ptr<Logger> log_;
   int listen_port_;
+  int listen_fd_;
+  int backlog_;
+  std::vector<int> acceptor_cpus_;
+  pthread_t acceptor_;
+  std::string upgrade_path_;
+  // Open connections, so draining can end idle keep-alives.
+  std::unordered_set<int> conns_;
+  pthread_mutex_t conns_lock_;
   Stats stat_;
+  std::unique_ptr<AccessCapture> capture_;
+  std::unique_ptr<LoadShedder> shedder_;
+  std::unique_ptr<RateLimiter> client_limiter_;
+  std::unordered_map<const Route*, std::unique_ptr<RateLimiter> > route_limiters_;
+  int static_max_age_;
+  std::unordered_map<std::string, std::shared_ptr<const StaticResponse> > static_routes_;
+  // Longest prefix first.
+  std::vector<std::pair<std::string, std::unique_ptr<StaticFileHandler> > > mounts_;
   std::unordered_map<std::string, std::unordered_map<std::string, std::unique_ptr<Route> > > routes_;
 };
 
 class HttpServerTask : public ThreadPool::Task {
 
 public:
-  explicit HttpServerTask(int comm_fd, HttpServer* server);
+  explicit HttpServerTask(int comm_fd, const std::string& addr, HttpServer* server);
   virtual ~HttpServerTask();
   void Run() override;
   int comm_fd_;
+  std::string addr_;
   HttpServer* server_;
 };
 
@@ -0,0 +1,74 @@
+#include "loadshedder.h"
+#include "threadpool.h"
+
+namespace Cerver {
+
+LoadShedder::Options LoadShedder::DefaultOptions() {
+  Options options;
+  options.max_connections = 1024;
+  options.max_queue = 256;
+  // Connections hold a worker for their whole life, so waits are longer
+  // than CoDel's usual 5 ms / 100 ms.
+  options.target_us = 50 * 1000;
+  options.interval_us = 500 * 1000;
+  return options;
+}
+
+LoadShedder::LoadShedder() : LoadShedder(DefaultOptions()) { }
+
+LoadShedder::LoadShedder(const Options& options)
+  : options_(options), first_above_us_(0), dropping_(false), stats_() {
+  pthread_mutex_init(&lock_, nullptr);
+}
+
+LoadShedder::~LoadShedder() {
+  pthread_mutex_destroy(&lock_);
+}
+
+int LoadShedder::Admit(int connections, size_t queue_depth, uint64_t oldest_enqueue_us) {
+  uint64_t now = ThreadPool::NowMicros();
+  int ret = ADMIT;
+  pthread_mutex_lock(&lock_);
+  if (queue_depth == 0) {
+    // Drained; whatever waits were last measured no longer stand.
+    first_above_us_ = 0;
+    dropping_ = false;
+  }
+  if (options_.max_connections > 0 && connections >= options_.max_connections) {
+    ret = SHED_CONNECTIONS;
+    stats_.shed_connections++;
+  } else if (options_.max_queue > 0 && queue_depth >= options_.max_queue) {
+    ret = SHED_QUEUE_DEPTH;
+    stats_.shed_queue_depth++;
+  } else if (dropping_ ||
+             (oldest_enqueue_us != 0 && now - oldest_enqueue_us > options_.target_us + options_.interval_us)) {
+    ret = SHED_QUEUE_WAIT;
+    stats_.shed_queue_wait++;
+  } else {
+    stats_.admitted++;
+  }
+  pthread_mutex_unlock(&lock_);
+  return ret;
+}
+
+void LoadShedder::OnDequeue(uint64_t wait_us) {
+  uint64_t now = ThreadPool::NowMicros();
+  pthread_mutex_lock(&lock_);
+  if (wait_us < options_.target_us) {
+    first_above_us_ = 0;
+    dropping_ = false;
+  } else if (first_above_us_ == 0) {
+    first_above_us_ = now + options_.interval_us;
+  } else if (now >= first_above_us_) {
+    dropping_ = true;
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+void LoadShedder::GetStats(Stats* stats) {
+  pthread_mutex_lock(&lock_);
+  *stats = stats_;
+  pthread_mutex_unlock(&lock_);
+}
+
+} // namespace Cerver
@@ -0,0 +1,60 @@
+#ifndef LOAD_SHEDDER_H_
+#define LOAD_SHEDDER_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define ADMIT 0
+#define SHED_CONNECTIONS 1
+#define SHED_QUEUE_DEPTH 2
+#define SHED_QUEUE_WAIT 3
+
+namespace Cerver {
+
+// Decides, at accept time, whether a new connection should be turned away
+// with a 503 instead of joining the work queue.
+//
+// Besides hard caps on connections and queue depth, it follows CoDel: the
+// time connections wait in the queue is measured as workers pick them up,
+// and once even the shortest wait has stayed above the target for a whole
+// interval the queue is a standing one, not a burst, and new connections
+// are shed until a wait drops below the target again. The age of the oldest
+// queued connection is checked too, so shedding starts even when no worker
+// frees up to report a wait.
+class LoadShedder {
+  public:
+    struct Options {
+      int max_connections;   // 0 for no cap
+      size_t max_queue;      // 0 for no cap
+      uint64_t target_us;    // Acceptable standing queue wait
+      uint64_t interval_us;  // How long the wait must stay above target
+    };
+    struct Stats {
+      uint64_t admitted;
+      uint64_t shed_connections;
+      uint64_t shed_queue_depth;
+      uint64_t shed_queue_wait;
+    };
+    LoadShedder();
+    explicit LoadShedder(const Options& options);
+    ~LoadShedder();
+    // Returns ADMIT or the SHED_* reason. [oldest_enqueue_us] is 0 if the
+    // queue is empty.
+    int Admit(int connections, size_t queue_depth, uint64_t oldest_enqueue_us);
+    // Records how long a connection waited in the queue.
+    void OnDequeue(uint64_t wait_us);
+    void GetStats(Stats* stats);
+
+    static Options DefaultOptions();
+
+  private:
+    Options options_;
+    pthread_mutex_t lock_;
+    uint64_t first_above_us_; // When the wait may first count as standing; 0 if below target
+    bool dropping_;
+    Stats stats_;
+};
+
+} // namespace Cerver
+
+#endif
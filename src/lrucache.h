@@ -1,139 +1,883 @@
 #ifndef LRU_CACHE_H_
 #define LRU_CACHE_H_
 
+#include <atomic>
 #include <list>
 #include <unordered_map>
 #include <memory>
 #include <string>
 #include <pthread.h>
+#include <vector>
+#include <functional>
+#include <time.h>
+#include "singleflight.h"
 
+// Replacement policies for LRUCache. A policy only tracks keys and their
+// weights; the cache owns the values and asks the policy for a Victim()
+// whenever it is over capacity. Record() is called on every lookup, hit or
+// miss, so frequency based policies can learn about keys they do not hold.
+
+// Plain least recently used.
+template <typename K>
+class LRUPolicy {
+  public:
+    // Per-entry bookkeeping, for LRUCache's byte accounting.
+    static const size_t kEntryOverhead = 6 * sizeof(void*);
+    static const int kKeyCopies = 2;
+    void SetCapacity(size_t capacity) { }
+    void Record(const K& key) { }
+    void OnHit(const K& key) {
+      queue_.splice(queue_.end(), queue_, map_.at(key));
+    }
+    void OnInsert(const K& key, size_t weight) {
+      queue_.push_back(key);
+      auto last = queue_.end();
+      last--;
+      map_.insert({key, last});
+    }
+    void OnUpdate(const K& key, size_t weight) { }
+    void OnEvict(const K& key) {
+      OnErase(key);
+    }
+    void OnErase(const K& key) {
+      auto it = map_.find(key);
+      queue_.erase(it->second);
+      map_.erase(it);
+    }
+    K Victim() {
+      return queue_.front();
+    }
+    // Coldest first.
+    void Keys(std::vector<K>* keys) {
+      keys->insert(keys->end(), queue_.begin(), queue_.end());
+    }
+  private:
+    std::list<K> queue_;
+    std::unordered_map<K, typename std::list<K>::iterator> map_;
+};
+
+// Count-min sketch of small saturating counters estimating how often a key
+// was requested recently. All counters are halved after every [10 * width]
+// increments so that popularity ages out.
+template <typename K>
+class FrequencySketch {
+  public:
+    FrequencySketch(size_t width) : additions_(0) {
+      size_t n = 1;
+      while (n < width) {
+        n <<= 1;
+      }
+      mask_ = n - 1;
+      sample_size_ = 10 * n;
+      table_ = std::vector<uint8_t>(4 * n, 0);
+    }
+    void Increment(const K& key) {
+      size_t hash = std::hash<K>()(key);
+      bool added = false;
+      for (int i = 0; i < 4; i++) {
+        uint8_t& counter = table_[i * (mask_ + 1) + Index(hash, i)];
+        if (counter < 15) {
+          counter++;
+          added = true;
+        }
+      }
+      if (added && ++additions_ >= sample_size_) {
+        Reset();
+      }
+    }
+    int Frequency(const K& key) {
+      size_t hash = std::hash<K>()(key);
+      int freq = 15;
+      for (int i = 0; i < 4; i++) {
+        int counter = table_[i * (mask_ + 1) + Index(hash, i)];
+        freq = counter < freq ? counter : freq;
+      }
+      return freq;
+    }
+  private:
+    size_t Index(size_t hash, int i) {
+      static const uint64_t seeds[] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                                       0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+      uint64_t h = (hash + seeds[i]) * 0x9e3779b97f4a7c15ULL;
+      h ^= h >> 32;
+      return h & mask_;
+    }
+    void Reset() {
+      for (size_t i = 0; i < table_.size(); i++) {
+        table_[i] >>= 1;
+      }
+      additions_ /= 2;
+    }
+    size_t mask_;
+    size_t sample_size_;
+    size_t additions_;
+    std::vector<uint8_t> table_;
+};
+
+// W-TinyLFU. New keys enter a small LRU window (1% of capacity). Keys that
+// overflow the window are admitted into the main space only if the sketch
+// says they are requested more often than the main space's LRU victim, so a
+// one-off scan cannot push out a frequently used working set. The main space
+// is a segmented LRU: keys hit while on probation move to the protected
+// segment (80% of the main space).
+template <typename K>
+class TinyLFUPolicy {
+  public:
+    static const size_t kEntryOverhead = 8 * sizeof(void*);
+    static const int kKeyCopies = 2;
+    TinyLFUPolicy(size_t sketch_width = 4096)
+      : sketch_(sketch_width), window_capacity_(0), main_capacity_(0), protected_capacity_(0),
+        window_size_(0), probation_size_(0), protected_size_(0) { }
+    void SetCapacity(size_t capacity) {
+      window_capacity_ = capacity / 100 > 0 ? capacity / 100 : 1;
+      main_capacity_ = capacity - window_capacity_;
+      protected_capacity_ = main_capacity_ * 4 / 5;
+    }
+    void Record(const K& key) {
+      sketch_.Increment(key);
+    }
+    void OnHit(const K& key) {
+      Node& node = nodes_.at(key);
+      if (node.segment == PROBATION) {
+        Move(key, PROTECTED);
+        while (protected_size_ > protected_capacity_ && protected_.size() > 1) {
+          Move(K(protected_.front()), PROBATION);
+        }
+      } else {
+        std::list<K>& queue = Queue(node.segment);
+        queue.splice(queue.end(), queue, node.pos);
+      }
+    }
+    void OnInsert(const K& key, size_t weight) {
+      window_.push_back(key);
+      auto last = window_.end();
+      last--;
+      nodes_.insert({key, {WINDOW, last, weight}});
+      window_size_ += weight;
+    }
+    void OnUpdate(const K& key, size_t weight) {
+      Node& node = nodes_.at(key);
+      SegmentSize(node.segment) += weight;
+      SegmentSize(node.segment) -= node.weight;
+      node.weight = weight;
+    }
+    void OnEvict(const K& key) {
+      OnErase(key);
+    }
+    void OnErase(const K& key) {
+      auto it = nodes_.find(key);
+      Queue(it->second.segment).erase(it->second.pos);
+      SegmentSize(it->second.segment) -= it->second.weight;
+      nodes_.erase(it);
+    }
+    K Victim() {
+      while (window_size_ > window_capacity_ && !window_.empty()) {
+        K candidate = window_.front();
+        if (probation_.empty() && protected_.empty()) {
+          Move(candidate, PROBATION);
+          continue;
+        }
+        if (probation_size_ + protected_size_ + nodes_.at(candidate).weight <= main_capacity_) {
+          // The main space still has room, admit without a contest.
+          Move(candidate, PROBATION);
+          continue;
+        }
+        K victim = MainVictim();
+        if (sketch_.Frequency(candidate) > sketch_.Frequency(victim)) {
+          Move(candidate, PROBATION);
+          return victim;
+        }
+        return candidate;
+      }
+      if (!probation_.empty() || !protected_.empty()) {
+        return MainVictim();
+      }
+      return window_.front();
+    }
+    // Coldest first.
+    void Keys(std::vector<K>* keys) {
+      keys->insert(keys->end(), probation_.begin(), probation_.end());
+      keys->insert(keys->end(), protected_.begin(), protected_.end());
+      keys->insert(keys->end(), window_.begin(), window_.end());
+    }
+  private:
+    enum Segment { WINDOW, PROBATION, PROTECTED };
+    struct Node {
+      Segment segment;
+      typename std::list<K>::iterator pos;
+      size_t weight;
+    };
+    std::list<K>& Queue(Segment segment) {
+      return segment == WINDOW ? window_ : (segment == PROBATION ? probation_ : protected_);
+    }
+    size_t& SegmentSize(Segment segment) {
+      return segment == WINDOW ? window_size_ : (segment == PROBATION ? probation_size_ : protected_size_);
+    }
+    void Move(const K& key, Segment to) {
+      Node& node = nodes_.at(key);
+      std::list<K>& from_queue = Queue(node.segment);
+      std::list<K>& to_queue = Queue(to);
+      to_queue.splice(to_queue.end(), from_queue, node.pos);
+      SegmentSize(node.segment) -= node.weight;
+      SegmentSize(to) += node.weight;
+      node.segment = to;
+    }
+    K MainVictim() {
+      return probation_.empty() ? protected_.front() : probation_.front();
+    }
+    FrequencySketch<K> sketch_;
+    size_t window_capacity_;
+    size_t main_capacity_;
+    size_t protected_capacity_;
+    size_t window_size_;
+    size_t probation_size_;
+    size_t protected_size_;
+    std::list<K> window_;
+    std::list<K> probation_;
+    std::list<K> protected_;
+    std::unordered_map<K, Node> nodes_;
+};
+
+// Adaptive Replacement Cache, with sizes measured in bytes. T1 holds keys
+// seen once recently and T2 keys seen at least twice. B1 and B2 remember
+// keys recently evicted from each, and a hit on a ghost shifts the target
+// size of T1 towards whichever list would have kept it.
+template <typename K>
+class ARCPolicy {
+  public:
+    // Ghost entries are not charged.
+    static const size_t kEntryOverhead = 8 * sizeof(void*);
+    static const int kKeyCopies = 2;
+    ARCPolicy() : capacity_(0), target_(0), t1_size_(0), t2_size_(0), b1_size_(0), b2_size_(0) { }
+    void SetCapacity(size_t capacity) {
+      capacity_ = capacity;
+    }
+    void Record(const K& key) { }
+    void OnHit(const K& key) {
+      Move(key, T2);
+    }
+    void OnInsert(const K& key, size_t weight) {
+      auto it = nodes_.find(key);
+      if (it == nodes_.end()) {
+        Push(key, T1, weight);
+        TrimGhosts();
+        return;
+      }
+      size_t old_weight = it->second.weight;
+      if (it->second.list == B1) {
+        size_t delta = b1_size_ > 0 && b2_size_ > b1_size_ ? old_weight * (b2_size_ / b1_size_) : old_weight;
+        target_ = target_ + delta < capacity_ ? target_ + delta : capacity_;
+      } else {
+        size_t delta = b2_size_ > 0 && b1_size_ > b2_size_ ? old_weight * (b1_size_ / b2_size_) : old_weight;
+        target_ = target_ > delta ? target_ - delta : 0;
+      }
+      OnErase(key);
+      Push(key, T2, weight);
+      TrimGhosts();
+    }
+    void OnUpdate(const K& key, size_t weight) {
+      Node& node = nodes_.at(key);
+      ListSize(node.list) += weight;
+      ListSize(node.list) -= node.weight;
+      node.weight = weight;
+    }
+    void OnEvict(const K& key) {
+      Node& node = nodes_.at(key);
+      Move(key, node.list == T1 ? B1 : B2);
+      TrimGhosts();
+    }
+    void OnErase(const K& key) {
+      auto it = nodes_.find(key);
+      Queue(it->second.list).erase(it->second.pos);
+      ListSize(it->second.list) -= it->second.weight;
+      nodes_.erase(it);
+    }
+    K Victim() {
+      if (!t1_.empty() && (t1_size_ > target_ || t2_.empty())) {
+        return t1_.front();
+      }
+      return t2_.front();
+    }
+    // Coldest first.
+    void Keys(std::vector<K>* keys) {
+      keys->insert(keys->end(), t1_.begin(), t1_.end());
+      keys->insert(keys->end(), t2_.begin(), t2_.end());
+    }
+  private:
+    enum List { T1, T2, B1, B2 };
+    struct Node {
+      List list;
+      typename std::list<K>::iterator pos;
+      size_t weight;
+    };
+    std::list<K>& Queue(List list) {
+      switch (list) {
+        case T1: return t1_;
+        case T2: return t2_;
+        case B1: return b1_;
+        default: return b2_;
+      }
+    }
+    size_t& ListSize(List list) {
+      switch (list) {
+        case T1: return t1_size_;
+        case T2: return t2_size_;
+        case B1: return b1_size_;
+        default: return b2_size_;
+      }
+    }
+    void Push(const K& key, List list, size_t weight) {
+      std::list<K>& queue = Queue(list);
+      queue.push_back(key);
+      auto last = queue.end();
+      last--;
+      nodes_.insert({key, {list, last, weight}});
+      ListSize(list) += weight;
+    }
+    void Move(const K& key, List to) {
+      Node& node = nodes_.at(key);
+      std::list<K>& from_queue = Queue(node.list);
+      std::list<K>& to_queue = Queue(to);
+      to_queue.splice(to_queue.end(), from_queue, node.pos);
+      ListSize(node.list) -= node.weight;
+      ListSize(to) += node.weight;
+      node.list = to;
+    }
+    void TrimGhosts() {
+      while (t1_size_ + b1_size_ > capacity_ && !b1_.empty()) {
+        OnErase(K(b1_.front()));
+      }
+      while (t1_size_ + t2_size_ + b1_size_ + b2_size_ > 2 * capacity_ && !b2_.empty()) {
+        OnErase(K(b2_.front()));
+      }
+    }
+    size_t capacity_;
+    size_t target_; // Target size of T1
+    size_t t1_size_;
+    size_t t2_size_;
+    size_t b1_size_;
+    size_t b2_size_;
+    std::list<K> t1_;
+    std::list<K> t2_;
+    std::list<K> b1_;
+    std::list<K> b2_;
+    std::unordered_map<K, Node> nodes_;
+};
+
+// Heap footprint of a value: its inline size plus whatever it owns.
+template <typename T>
+struct HeapSize {
+  static size_t Of(const T& val) {
+    return sizeof(T);
+  }
+};
+
+template <>
+struct HeapSize<std::string> {
+  static size_t Of(const std::string& val) {
+    // Short strings live inside the object itself.
+    return sizeof(std::string) + (val.capacity() > 15 ? val.capacity() + 1 : 0);
+  }
+};
+
+template <typename T>
+struct HeapSize<std::vector<T> > {
+  static size_t Of(const std::vector<T>& val) {
+    size_t size = sizeof(std::vector<T>) + (val.capacity() - val.size()) * sizeof(T);
+    for (const T& element : val) {
+      size += HeapSize<T>::Of(element);
+    }
+    return size;
+  }
+};
+
+// Default weigher for LRUCache. A weigher returns the bytes an entry's key
+// and value occupy; the cache adds its own per-entry bookkeeping on top.
 template <typename K, typename V>
+struct HeapWeigher {
+  size_t operator()(const K& key, const V& val) const {
+    return HeapSize<K>::Of(key) + HeapSize<V>::Of(val);
+  }
+};
+
+struct CacheStats {
+  size_t bytes;
+  size_t entries;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t expirations;
+  uint64_t stale_hits;
+  uint64_t coalesced; // Misses that waited on another caller's load
+};
+
+// Thread safe cache bounded by bytes. Each entry is charged what the
+// Weigher reports plus the hash table node, and the policy's list node and
+// key copies, so Capacity() bounds real memory rather than entry count.
+//
+// Entries may carry a TTL. Expired entries are dropped lazily by Get and,
+// if StartSweeper was called, by a background thread. With
+// SetStaleWhileRevalidate, Get with a loader keeps serving an expired entry
+// for up to max_stale_ms while exactly one refresh runs on the refresh
+// executor, so a popular key expiring does not send every reader to disk.
+//
+// With SetLazyPromotion, a hit on an entry that is already among the most
+// recently promoted quarter is served under a read lock and not passed on to
+// the policy, which makes hits on a hot working set mostly read-only.
+template <typename K, typename V, typename Policy = LRUPolicy<K>, typename Weigher = HeapWeigher<K, V> >
 class LRUCache {
   public:
-    LRUCache(size_t capacity) : capacity_(capacity), size_(0) {
-      pthread_mutex_init(&lock_, nullptr);
+    typedef std::function<int(const K&, V*)> Loader;
+    typedef std::function<void(std::function<void()>)> Executor;
+
+    LRUCache(size_t capacity)
+      : capacity_(capacity), size_(0), default_ttl_ms_(0), max_stale_ms_(0),
+        hits_(0), misses_(0), evictions_(0), expirations_(0), stale_hits_(0), coalesced_(0),
+        pending_refreshes_(0), tick_(0), lazy_promotion_(false), sweeping_(false) {
+      pthread_rwlock_init(&lock_, nullptr);
+      pthread_mutex_init(&state_lock_, nullptr);
+      pthread_cond_init(&cond_, nullptr);
+      policy_.SetCapacity(capacity);
     }
     virtual ~LRUCache() {
-      pthread_mutex_destroy(&lock_);
+      StopSweeper();
+      pthread_mutex_lock(&state_lock_);
+      while (pending_refreshes_ > 0) {
+        pthread_cond_wait(&cond_, &state_lock_);
+      }
+      pthread_mutex_unlock(&state_lock_);
+      pthread_cond_destroy(&cond_);
+      pthread_mutex_destroy(&state_lock_);
+      pthread_rwlock_destroy(&lock_);
     }
 
+    // Returns 0 if a new element is cached, 1 if an existing element is
+    // overwritten, and -1 if the element is too large or the policy
+    // declined to admit it.
     int Put(const K& key, const V& val) {
-      if (sizeof(val) > capacity_) {
+      return Put(key, val, default_ttl_ms_);
+    }
+    // A ttl_ms of 0 never expires.
+    int Put(const K& key, const V& val, uint64_t ttl_ms) {
+      size_t weight = Weight(key, val);
+      if (weight > capacity_) {
         return -1;
       }
-      pthread_mutex_lock(&lock_);
-      auto it = map_.find(key);
-      if (it == map_.end()) { // New element
-        while (size_ + sizeof(val) >= capacity_) {
-          Evict();
-        }
-        queue_.push_back(key);
-        auto last = queue_.end();
-        last--;
-        map_.insert({key, last});
-        kv_.insert({key, val});
-        size_ += sizeof(val);
-        pthread_mutex_unlock(&lock_);
-        return 0;
+      uint64_t expires_ms = ttl_ms > 0 ? NowMs() + ttl_ms : 0;
+      pthread_rwlock_wrlock(&lock_);
+      auto it = kv_.find(key);
+      if (it == kv_.end()) { // New element
+        kv_.insert({key, {val, weight, expires_ms, false, ++tick_}});
+        size_ += weight;
+        policy_.OnInsert(key, weight);
+        EvictToCapacity();
+        int ret = kv_.find(key) == kv_.end() ? -1 : 0;
+        pthread_rwlock_unlock(&lock_);
+        return ret;
       } else { // Existing element
-        size_ -= sizeof(kv_.at(key));
-        kv_[key] = val;
-        size_ += sizeof(val);
-        queue_.splice(queue_.end(), queue_, it->second);
-        pthread_mutex_unlock(&lock_);
+        size_ -= it->second.weight;
+        it->second.val = val;
+        it->second.weight = weight;
+        it->second.expires_ms = expires_ms;
+        it->second.refreshing = false;
+        it->second.stamp = ++tick_;
+        size_ += weight;
+        policy_.OnUpdate(key, weight);
+        policy_.OnHit(key);
+        EvictToCapacity();
+        pthread_rwlock_unlock(&lock_);
         return 1;
       }
     }
     int Get(const K& key, V* val) {
-      pthread_mutex_lock(&lock_);
-      auto it = map_.find(key);
-      if (it == map_.end()) { // Does not exist
-        pthread_mutex_unlock(&lock_);
+      if (lazy_promotion_ && GetRecent(key, val)) {
+        return 0;
+      }
+      pthread_rwlock_wrlock(&lock_);
+      policy_.Record(key);
+      auto it = kv_.find(key);
+      if (it != kv_.end() && Expired(it->second, NowMs())) {
+        Expire(it);
+        it = kv_.end();
+      }
+      if (it == kv_.end()) { // Does not exist
+        misses_++;
+        pthread_rwlock_unlock(&lock_);
+        return -1;
+      }
+      hits_++;
+      *val = it->second.val;
+      Promote(it);
+      pthread_rwlock_unlock(&lock_);
+      return 0;
+    }
+    // Like Get, but loads and caches the value on a miss. Returns the
+    // loader's result on a miss and 0 on a hit, stale or not. Callers that
+    // miss on a key while it is being loaded wait for that load.
+    int Get(const K& key, V* val, const Loader& loader) {
+      if (lazy_promotion_ && GetRecent(key, val)) {
+        return 0;
+      }
+      pthread_rwlock_wrlock(&lock_);
+      policy_.Record(key);
+      auto it = kv_.find(key);
+      uint64_t now = NowMs();
+      if (it != kv_.end() && Expired(it->second, now)) {
+        if (max_stale_ms_ == 0 || now >= it->second.expires_ms + max_stale_ms_) {
+          Expire(it);
+          it = kv_.end();
+        } else {
+          stale_hits_++;
+          *val = it->second.val;
+          if (!it->second.refreshing) {
+            it->second.refreshing = true;
+            pthread_mutex_lock(&state_lock_);
+            pending_refreshes_++;
+            pthread_mutex_unlock(&state_lock_);
+            pthread_rwlock_unlock(&lock_);
+            Refresh(key, loader);
+            return 0;
+          }
+          pthread_rwlock_unlock(&lock_);
+          return 0;
+        }
+      }
+      if (it == kv_.end()) { // Does not exist
+        misses_++;
+        pthread_rwlock_unlock(&lock_);
+        // Concurrent misses on the same key share one load.
+        bool shared = false;
+        int ret = flights_.Do(key, val, [&key, &loader](V* loaded) {
+          return loader(key, loaded);
+        }, &shared);
+        if (shared) {
+          pthread_rwlock_wrlock(&lock_);
+          coalesced_++;
+          pthread_rwlock_unlock(&lock_);
+        } else if (ret == 0) {
+          Put(key, *val);
+        }
+        return ret;
+      }
+      hits_++;
+      *val = it->second.val;
+      Promote(it);
+      pthread_rwlock_unlock(&lock_);
+      return 0;
+    }
+    // Returns 0 if the key was cached, -1 otherwise.
+    int Erase(const K& key) {
+      pthread_rwlock_wrlock(&lock_);
+      auto it = kv_.find(key);
+      if (it == kv_.end()) {
+        pthread_rwlock_unlock(&lock_);
         return -1;
       }
-      *val = kv_.at(it->first);
-      // LRU cache tracks Get access.
-      queue_.splice(queue_.end(), queue_, it->second);
-      pthread_mutex_unlock(&lock_);
+      size_ -= it->second.weight;
+      kv_.erase(it);
+      policy_.OnErase(key);
+      pthread_rwlock_unlock(&lock_);
       return 0;
     }
+    void Clear() {
+      pthread_rwlock_wrlock(&lock_);
+      for (auto it = kv_.begin(); it != kv_.end(); it++) {
+        policy_.OnErase(it->first);
+      }
+      kv_.clear();
+      size_ = 0;
+      pthread_rwlock_unlock(&lock_);
+    }
+    // Cached keys, roughly in eviction order: the next victim first.
+    void Keys(std::vector<K>* keys) {
+      pthread_rwlock_rdlock(&lock_);
+      policy_.Keys(keys);
+      pthread_rwlock_unlock(&lock_);
+    }
+
+    // TTL for Put without an explicit ttl_ms. 0 disables expiry.
+    void SetDefaultTTL(uint64_t ttl_ms) {
+      default_ttl_ms_ = ttl_ms;
+    }
+    void SetStaleWhileRevalidate(uint64_t max_stale_ms) {
+      max_stale_ms_ = max_stale_ms;
+    }
+    // Meant for LRUPolicy; other policies learn less from skipped hits.
+    void SetLazyPromotion(bool lazy_promotion) {
+      lazy_promotion_ = lazy_promotion;
+    }
+    // Runs refreshes for stale-while-revalidate. Defaults to a detached thread.
+    void SetRefreshExecutor(Executor executor) {
+      executor_ = executor;
+    }
+    // Periodically drops expired entries so cold keys do not hold memory
+    // until they happen to be evicted.
+    void StartSweeper(uint64_t interval_ms) {
+      pthread_mutex_lock(&state_lock_);
+      if (sweeping_) {
+        pthread_mutex_unlock(&state_lock_);
+        return;
+      }
+      sweeping_ = true;
+      sweep_interval_ms_ = interval_ms;
+      pthread_mutex_unlock(&state_lock_);
+      pthread_create(&sweeper_, nullptr, &LRUCache::SweepLoop, static_cast<void*>(this));
+    }
+    void StopSweeper() {
+      pthread_mutex_lock(&state_lock_);
+      if (!sweeping_) {
+        pthread_mutex_unlock(&state_lock_);
+        return;
+      }
+      sweeping_ = false;
+      pthread_cond_broadcast(&cond_);
+      pthread_mutex_unlock(&state_lock_);
+      pthread_join(sweeper_, nullptr);
+    }
     
     size_t Capacity() {
       return capacity_;
     }
 
     size_t Size() {
-      return size_;
+      pthread_rwlock_rdlock(&lock_);
+      size_t size = size_;
+      pthread_rwlock_unlock(&lock_);
+      return size;
     }
 
     int Entry() {
-      return queue_.size();
+      pthread_rwlock_rdlock(&lock_);
+      int entry = kv_.size();
+      pthread_rwlock_unlock(&lock_);
+      return entry;
     }
 
-  private:
-    void Evict() {
-      auto first_it = queue_.begin();
-      size_ -= sizeof(kv_.at(*first_it));
-      kv_.erase(*first_it);
-      map_.erase(*first_it);
-      queue_.pop_front();
+    void GetStats(CacheStats* stats) {
+      pthread_rwlock_rdlock(&lock_);
+      stats->bytes = size_;
+      stats->entries = kv_.size();
+      stats->hits = hits_;
+      stats->misses = misses_;
+      stats->evictions = evictions_;
+      stats->expirations = expirations_;
+      stats->stale_hits = stale_hits_;
+      stats->coalesced = coalesced_;
+      pthread_rwlock_unlock(&lock_);
+    }
+
+    static uint64_t NowMs() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+  protected:
+    struct Node {
+      V val;
+      size_t weight;
+      uint64_t expires_ms; // 0 if the entry never expires
+      bool refreshing;
+      uint64_t stamp; // tick_ at the last promotion
+    };
+    size_t Weight(const K& key, const V& val) {
+      // Hash table node and bucket, plus the policy's copies of the key.
+      size_t overhead = 3 * sizeof(void*) + Policy::kEntryOverhead + Policy::kKeyCopies * HeapSize<K>::Of(key);
+      return weigher_(key, val) + overhead;
+    }
+    // Lazy promotion's hit path: an entry promoted recently enough to stay
+    // put is served under the read lock, without telling the policy.
+    bool GetRecent(const K& key, V* val) {
+      pthread_rwlock_rdlock(&lock_);
+      auto it = kv_.find(key);
+      bool recent = it != kv_.end() &&
+                    (it->second.expires_ms == 0 || !Expired(it->second, NowMs())) &&
+                    tick_ - it->second.stamp < kv_.size() / 4;
+      if (recent) {
+        *val = it->second.val;
+        hits_++;
+      }
+      pthread_rwlock_unlock(&lock_);
+      return recent;
+    }
+    void Promote(typename std::unordered_map<K, Node>::iterator it) {
+      if (lazy_promotion_ && tick_ - it->second.stamp < kv_.size() / 4) {
+        // Promoted recently enough that moving it again changes little.
+        return;
+      }
+      policy_.OnHit(it->first);
+      it->second.stamp = ++tick_;
+    }
+    static bool Expired(const Node& node, uint64_t now) {
+      return node.expires_ms != 0 && now >= node.expires_ms;
+    }
+    void Expire(typename std::unordered_map<K, Node>::iterator it) {
+      K key = it->first;
+      size_ -= it->second.weight;
+      kv_.erase(it);
+      policy_.OnErase(key);
+      expirations_++;
+    }
+    void EvictToCapacity() {
+      while (size_ > capacity_ && !kv_.empty()) {
+        K victim = policy_.Victim();
+        auto it = kv_.find(victim);
+        size_ -= it->second.weight;
+        kv_.erase(it);
+        policy_.OnEvict(victim);
+        evictions_++;
+      }
+    }
+    void Refresh(const K& key, const Loader& loader) {
+      std::function<void()> task = [this, key, loader]() {
+        V fresh;
+        if (loader(key, &fresh) == 0) {
+          Put(key, fresh);
+        }
+        pthread_rwlock_wrlock(&lock_);
+        auto it = kv_.find(key);
+        if (it != kv_.end()) {
+          it->second.refreshing = false;
+        }
+        pthread_rwlock_unlock(&lock_);
+        pthread_mutex_lock(&state_lock_);
+        pending_refreshes_--;
+        pthread_cond_broadcast(&cond_);
+        pthread_mutex_unlock(&state_lock_);
+      };
+      if (executor_) {
+        executor_(task);
+        return;
+      }
+      pthread_t thread;
+      std::function<void()>* heap_task = new std::function<void()>(task);
+      if (pthread_create(&thread, nullptr, &LRUCache::RunTask, static_cast<void*>(heap_task)) != 0) {
+        RunTask(heap_task);
+        return;
+      }
+      pthread_detach(thread);
+    }
+    static void* RunTask(void* arg) {
+      std::unique_ptr<std::function<void()> > task(static_cast<std::function<void()>*>(arg));
+      (*task)();
+      return nullptr;
+    }
+    static void* SweepLoop(void* arg) {
+      LRUCache* cache = static_cast<LRUCache*>(arg);
+      pthread_mutex_lock(&cache->state_lock_);
+      while (cache->sweeping_) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += cache->sweep_interval_ms_ / 1000;
+        deadline.tv_nsec += (cache->sweep_interval_ms_ % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&cache->cond_, &cache->state_lock_, &deadline);
+        if (!cache->sweeping_) {
+          break;
+        }
+        pthread_mutex_unlock(&cache->state_lock_);
+        pthread_rwlock_wrlock(&cache->lock_);
+        uint64_t now = NowMs();
+        for (auto it = cache->kv_.begin(); it != cache->kv_.end();) {
+          auto next = std::next(it);
+          // Entries that can still be served stale are left for their refresh.
+          if (Expired(it->second, now) && now >= it->second.expires_ms + cache->max_stale_ms_) {
+            cache->Expire(it);
+          }
+          it = next;
+        }
+        pthread_rwlock_unlock(&cache->lock_);
+        pthread_mutex_lock(&cache->state_lock_);
+      }
+      pthread_mutex_unlock(&cache->state_lock_);
+      return nullptr;
     }
     size_t capacity_;
     size_t size_;
-    typename std::list<K> queue_;
-    std::unordered_map<K, typename std::list<K>::iterator> map_;
-    typename std::unordered_map<K, V> kv_;
-    pthread_mutex_t lock_;
+    uint64_t default_ttl_ms_;
+    uint64_t max_stale_ms_;
+    uint64_t sweep_interval_ms_;
+    // Also counted by hits served under the read lock
+    std::atomic<uint64_t> hits_;
+    uint64_t misses_;
+    uint64_t evictions_;
+    uint64_t expirations_;
+    uint64_t stale_hits_;
+    uint64_t coalesced_;
+    int pending_refreshes_;
+    // Bumped by every promotion
+    uint64_t tick_;
+    std::atomic<bool> lazy_promotion_;
+    bool sweeping_;
+    Policy policy_;
+    Weigher weigher_;
+    Executor executor_;
+    SingleFlight<K, V> flights_;
+    typename std::unordered_map<K, Node> kv_;
+    // Guards everything above bar the atomics. Only lazy promotion's hits
+    // take it shared.
+    pthread_rwlock_t lock_;
+    // Guards sweeping_, sweep_interval_ms_ and pending_refreshes_, for cond_.
+    pthread_mutex_t state_lock_;
+    pthread_cond_t cond_;
+    pthread_t sweeper_;
 };
 
-class LRUStringCache {
+template <typename Policy = LRUPolicy<std::string> >
+class BasicLRUStringCache : public LRUCache<std::string, std::string, Policy> {
   public:
-    LRUStringCache(size_t capacity) : capacity_(capacity), size_(0) {
-      pthread_mutex_init(&lock_, nullptr);
-    }
-    virtual ~LRUStringCache() {
-      pthread_mutex_destroy(&lock_);
+    BasicLRUStringCache(size_t capacity) : LRUCache<std::string, std::string, Policy>(capacity) { }
+    virtual ~BasicLRUStringCache() { }
+
+    void GetKeys(std::string* keys) {
+      std::vector<std::string> ordered;
+      pthread_rwlock_rdlock(&this->lock_);
+      this->policy_.Keys(&ordered);
+      pthread_rwlock_unlock(&this->lock_);
+      for (auto it = ordered.begin(); it != ordered.end(); it++) {
+        *keys += *it + "<br>";
+      }
     }
-    int Put(const std::string& key, const std::string& val) {
-      if (val.size() > capacity_) {
-        return -1;
+};
+
+typedef BasicLRUStringCache<> LRUStringCache;
+typedef BasicLRUStringCache<TinyLFUPolicy<std::string> > TinyLFUStringCache;
+typedef BasicLRUStringCache<ARCPolicy<std::string> > ARCStringCache;
+
+// An LRUCache split into a power-of-two number of shards by key hash. Each
+// shard is a whole LRUCache with an equal share of the byte budget, so
+// lookups only contend on keys in the same shard. [lazy_promotion] is
+// passed on to every shard; see LRUCache::SetLazyPromotion.
+template <typename K, typename V, typename Policy = LRUPolicy<K>, typename Weigher = HeapWeigher<K, V> >
+class ShardedLRUCache {
+  public:
+    ShardedLRUCache(size_t capacity, size_t num_shards = 16, bool lazy_promotion = false)
+      : capacity_(capacity) {
+      size_t n = 1;
+      while (n < num_shards) {
+        n <<= 1;
       }
-      pthread_mutex_lock(&lock_);
-      auto it = map_.find(key);
-      if (it == map_.end()) { // New element
-        while (size_ + val.size() >= capacity_) {
-          Evict();
-        }
-        queue_.push_back(key);
-        auto last = queue_.end();
-        last--;
-        map_.insert({key, last});
-        kv_.insert({key, val});
-        size_ += val.length();
-        pthread_mutex_unlock(&lock_);
-        return 0;
-      } else { // Existing element
-        size_ -= kv_.at(key).length();
-        kv_[key] = val;
-        size_ += val.length();
-        queue_.splice(queue_.end(), queue_, it->second);
-        pthread_mutex_unlock(&lock_);
-        return 1;
+      shard_mask_ = n - 1;
+      for (size_t i = 0; i < n; i++) {
+        shards_.push_back(std::make_unique<LRUCache<K, V, Policy, Weigher> >(capacity / n));
+        shards_.back()->SetLazyPromotion(lazy_promotion);
       }
     }
+    virtual ~ShardedLRUCache() { }
 
-    int Get(const std::string& key, std::string* val) {
-      pthread_mutex_lock(&lock_);
-      auto it = map_.find(key);
-      if (it == map_.end()) { // Does not exist
-        pthread_mutex_unlock(&lock_);
-        return -1;
-      }
-      *val = kv_.at(it->first);
-      // LRU cache tracks Get access.
-      queue_.splice(queue_.end(), queue_, it->second);
-      pthread_mutex_unlock(&lock_);
-      return 0;
+    int Put(const K& key, const V& val) {
+      return ShardFor(key)->Put(key, val);
+    }
+
+    int Get(const K& key, V* val) {
+      return ShardFor(key)->Get(key, val);
+    }
+
+    int Erase(const K& key) {
+      return ShardFor(key)->Erase(key);
     }
 
     size_t Capacity() {
@@ -141,33 +885,72 @@ class LRUStringCache {
     }
 
     size_t Size() {
-      return size_;
+      size_t size = 0;
+      for (auto& shard : shards_) {
+        size += shard->Size();
+      }
+      return size;
     }
 
     int Entry() {
-      return queue_.size();
+      int entry = 0;
+      for (auto& shard : shards_) {
+        entry += shard->Entry();
+      }
+      return entry;
     }
 
-    void GetKeys(std::string* keys) {
-      for (auto it = queue_.begin(); it != queue_.end(); it++) {
-        *keys += *it + "<br>";
-      } 
+    size_t NumShards() {
+      return shards_.size();
+    }
+
+    // Appends each shard's keys in turn, next victim first.
+    void Keys(std::vector<K>* keys) {
+      for (auto& shard : shards_) {
+        shard->Keys(keys);
+      }
+    }
+
+    // Sums the shards' stats.
+    void GetStats(CacheStats* stats) {
+      *stats = CacheStats();
+      for (auto& shard : shards_) {
+        CacheStats shard_stats;
+        shard->GetStats(&shard_stats);
+        stats->bytes += shard_stats.bytes;
+        stats->entries += shard_stats.entries;
+        stats->hits += shard_stats.hits;
+        stats->misses += shard_stats.misses;
+        stats->evictions += shard_stats.evictions;
+        stats->expirations += shard_stats.expirations;
+        stats->stale_hits += shard_stats.stale_hits;
+        stats->coalesced += shard_stats.coalesced;
+      }
     }
 
   private:
-    void Evict() {
-      auto first_it = queue_.begin();
-      size_ -= kv_.at(*first_it).length();
-      kv_.erase(*first_it);
-      map_.erase(*first_it);
-      queue_.pop_front();
+    LRUCache<K, V, Policy, Weigher>* ShardFor(const K& key) {
+      return shards_[std::hash<K>()(key) & shard_mask_].get();
     }
     size_t capacity_;
-    size_t size_;
-    typename std::list<std::string> queue_;
-    typename std::unordered_map<std::string, std::string> kv_;
-    std::unordered_map<std::string, typename std::list<std::string>::iterator> map_;
-    pthread_mutex_t lock_;
+    size_t shard_mask_;
+    std::vector<std::unique_ptr<LRUCache<K, V, Policy, Weigher> > > shards_;
+};
+
+// A ShardedLRUCache of strings, with GetKeys for the debug pages.
+class ShardedLRUStringCache : public ShardedLRUCache<std::string, std::string> {
+  public:
+    ShardedLRUStringCache(size_t capacity, size_t num_shards = 16, bool lazy_promotion = false)
+      : ShardedLRUCache<std::string, std::string>(capacity, num_shards, lazy_promotion) { }
+    virtual ~ShardedLRUStringCache() { }
+
+    void GetKeys(std::string* keys) {
+      std::vector<std::string> ordered;
+      Keys(&ordered);
+      for (auto it = ordered.begin(); it != ordered.end(); it++) {
+        *keys += *it + "<br>";
+      }
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef MIME_TYPES_H_
+#define MIME_TYPES_H_
+
+#include <string_view>
+
+namespace Cerver {
+
+struct MimeType {
+  std::string_view ext;
+  std::string_view type;
+};
+
+static constexpr MimeType kMimeTypes[] = {
+  {".html", "text/html"},
+  {".htm", "text/html"},
+  {".css", "text/css"},
+  {".js", "application/javascript"},
+  {".json", "application/json"},
+  {".txt", "text/plain"},
+  {".xml", "application/xml"},
+  {".png", "image/png"},
+  {".jpeg", "image/jpeg"},
+  {".jpg", "image/jpeg"},
+  {".gif", "image/gif"},
+  {".svg", "image/svg+xml"},
+  {".ico", "image/x-icon"},
+  {".webp", "image/webp"},
+  {".pdf", "application/pdf"},
+  {".woff", "font/woff"},
+  {".woff2", "font/woff2"},
+};
+
+// Content type for a path, from its last extension.
+constexpr std::string_view MimeTypeFor(std::string_view path) {
+  size_t dot = path.rfind('.');
+  if (dot == std::string_view::npos) {
+    return "text/plain";
+  }
+  std::string_view ext = path.substr(dot);
+  for (const MimeType& mime : kMimeTypes) {
+    if (mime.ext == ext) {
+      return mime.type;
+    }
+  }
+  return "text/plain";
+}
+
+static_assert(MimeTypeFor("images/kung.png") == "image/png");
+
+} // namespace Cerver
+
+#endif
@@ -0,0 +1,257 @@
+#include <iostream>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "prefork.h"
+#include "threadpool.h"
+#include "handoff.h"
+
+#define RESTART_BACKOFF_US 1000000 // A worker that dies sooner is restarted after a pause
+#define STOP_TIMEOUT_US 5000000    // Workers still running after this are killed
+#define DRAIN_TIMEOUT_US 15000000  // Past the workers' own drain timeout
+#define SERVING_TIMEOUT_US 30000000
+
+namespace Cerver {
+
+static volatile sig_atomic_t master_running = 0;
+static volatile sig_atomic_t master_stat = 0;
+static volatile sig_atomic_t master_drain = 0;
+
+static void HandleMasterSignal(int signum) {
+  if (signum == SIGINT) {
+    master_running = 0;
+  } else if (signum == SIGUSR1) {
+    master_stat = 1;
+  } else if (signum == SIGUSR2) {
+    master_drain = 1;
+  }
+}
+
+Prefork::Prefork(const ServerConfig& config, SharedStats* stats, WorkerMain worker_main)
+  : num_workers_(config.workers),
+    port_(config.port),
+    backlog_(config.backlog),
+    reuseport_(config.reuseport),
+    stats_(stats),
+    worker_main_(worker_main),
+    upgrade_fd_(-1),
+    handed_off_(false),
+    pids_(config.workers, 0),
+    started_us_(config.workers, 0) { }
+
+Prefork::~Prefork() {
+  for (int fd : listen_fds_) {
+    close(fd);
+  }
+}
+
+void Prefork::UseListenSockets(const std::vector<int>& fds) {
+  listen_fds_ = fds;
+}
+
+void Prefork::EnableUpgrade(const std::string& path) {
+  upgrade_path_ = path;
+}
+
+void Prefork::OnServing(std::function<void()> callback) {
+  on_serving_ = callback;
+}
+
+bool Prefork::HandedOff() const {
+  return handed_off_;
+}
+
+void Prefork::Run() {
+  size_t num_sockets = reuseport_ ? num_workers_ : 1;
+  if (!listen_fds_.empty() && listen_fds_.size() != num_sockets) {
+    std::cout << "Received " << listen_fds_.size() << " listen sockets but need " << num_sockets << std::endl;
+    return;
+  }
+  while (listen_fds_.size() < num_sockets) {
+    int listen_fd = CreateListenSocket(port_, backlog_, reuseport_);
+    if (listen_fd == -1) {
+      std::cout << "Failed to create listen socket" << std::endl;
+      return;
+    }
+    listen_fds_.push_back(listen_fd);
+  }
+  master_running = 1;
+  master_drain = 0;
+  PrepareToHandleSignal(SIGINT, HandleMasterSignal);
+  PrepareToHandleSignal(SIGUSR1, HandleMasterSignal);
+  PrepareToHandleSignal(SIGUSR2, HandleMasterSignal);
+  std::unique_ptr<UpgradeListener> upgrade;
+  if (!upgrade_path_.empty()) {
+    pthread_t master = pthread_self();
+    // The caches live in the workers, so there are no hot keys to offer.
+    upgrade = std::make_unique<UpgradeListener>(upgrade_path_,
+      [](std::vector<std::string>* keys) { },
+      [this, master]() { handed_off_ = true; master_drain = 1; pthread_kill(master, SIGUSR2); });
+    if (upgrade->Start(listen_fds_) == -1) {
+      std::cout << "Failed to listen for upgrades on " << upgrade_path_ << std::endl;
+    }
+    upgrade_fd_ = upgrade->Fd();
+  }
+  for (int i = 0; i < num_workers_; i++) {
+    Spawn(i);
+  }
+  if (on_serving_) {
+    uint64_t deadline = ThreadPool::NowMicros() + SERVING_TIMEOUT_US;
+    int serving = 0;
+    while (serving < num_workers_ && master_running && ThreadPool::NowMicros() < deadline) {
+      usleep(10000);
+      serving = 0;
+      for (int i = 0; i < num_workers_; i++) {
+        serving += stats_->GetSlot(i)->serving != 0;
+      }
+    }
+    if (serving == num_workers_) {
+      on_serving_();
+    } else {
+      std::cout << "Only " << serving << " of " << num_workers_ << " workers started" << std::endl;
+    }
+  }
+
+  while (master_running && !master_drain) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid == -1) {
+      if (errno == EINTR) {
+        if (master_stat) {
+          PrintStat();
+        }
+        continue;
+      }
+      // No children left, which only happens if every fork failed.
+      usleep(RESTART_BACKOFF_US);
+    }
+    for (int i = 0; i < num_workers_; i++) {
+      if (pid != -1 && pids_[i] != pid) {
+        continue;
+      }
+      if (pid == -1 && pids_[i] != 0) {
+        continue;
+      }
+      if (pid != -1) {
+        if (WIFSIGNALED(status)) {
+          std::cout << "Worker " << i << " (pid " << pid << ") killed by signal " << WTERMSIG(status) << std::endl;
+        } else {
+          std::cout << "Worker " << i << " (pid " << pid << ") exited with status " << WEXITSTATUS(status) << std::endl;
+        }
+        pids_[i] = 0;
+        SharedStats::Slot* slot = stats_->GetSlot(i);
+        slot->pid = 0;
+        slot->serving = 0;
+        // Connections the worker had open went down with it.
+        slot->connections = 0;
+      }
+      if (!master_running || master_drain) {
+        break;
+      }
+      if (ThreadPool::NowMicros() - started_us_[i] < RESTART_BACKOFF_US) {
+        usleep(RESTART_BACKOFF_US);
+      }
+      stats_->GetSlot(i)->restarts++;
+      Spawn(i);
+    }
+  }
+
+  if (upgrade != nullptr) {
+    upgrade->Stop();
+  }
+  bool draining = master_running && master_drain;
+  for (int i = 0; i < num_workers_; i++) {
+    if (pids_[i] != 0) {
+      kill(pids_[i], draining ? SIGUSR2 : SIGINT);
+    }
+  }
+  Reap(draining ? DRAIN_TIMEOUT_US : STOP_TIMEOUT_US);
+  for (int i = 0; i < num_workers_; i++) {
+    stats_->GetSlot(i)->pid = 0;
+    stats_->GetSlot(i)->serving = 0;
+  }
+  std::cout << "Server shut down" << std::endl;
+}
+
+void Prefork::Reap(uint64_t timeout_us) {
+  uint64_t deadline = ThreadPool::NowMicros() + timeout_us;
+  int remaining = 0;
+  for (pid_t pid : pids_) {
+    remaining += pid != 0;
+  }
+  while (remaining > 0) {
+    pid_t pid = waitpid(-1, nullptr, WNOHANG);
+    if (pid > 0) {
+      remaining--;
+      continue;
+    }
+    if (pid == -1 && errno != EINTR) {
+      break;
+    }
+    if (ThreadPool::NowMicros() > deadline) {
+      for (pid_t worker : pids_) {
+        if (worker != 0) {
+          kill(worker, SIGKILL);
+        }
+      }
+      while (waitpid(-1, nullptr, 0) > 0 || errno == EINTR) { }
+      break;
+    }
+    usleep(10000);
+  }
+}
+
+pid_t Prefork::Spawn(int worker) {
+  started_us_[worker] = ThreadPool::NowMicros();
+  pid_t pid = fork();
+  if (pid == -1) {
+    std::cout << "Failed to fork worker " << worker << std::endl;
+    return -1;
+  }
+  if (pid == 0) {
+    // The worker sets up its own handlers when its server runs.
+    signal(SIGINT, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+    signal(SIGUSR2, SIG_DFL);
+    if (upgrade_fd_ != -1) {
+      close(upgrade_fd_);
+    }
+#ifdef __linux__
+    // Do not outlive the master.
+    prctl(PR_SET_PDEATHSIG, SIGINT);
+#endif
+    int listen_fd = listen_fds_[reuseport_ ? worker : 0];
+    for (int fd : listen_fds_) {
+      if (fd != listen_fd) {
+        close(fd);
+      }
+    }
+    SharedStats::Slot* slot = stats_->GetSlot(worker);
+    slot->pid = getpid();
+    exit(worker_main_(worker, listen_fd, slot));
+  }
+  pids_[worker] = pid;
+  stats_->GetSlot(worker)->pid = pid;
+  return pid;
+}
+
+void Prefork::PrintStat() {
+  SharedStats::Totals totals;
+  stats_->Sum(&totals);
+  std::cout << "Prefork master status\n";
+  std::cout << "Listening on port " << port_ << (reuseport_ ? " (SO_REUSEPORT)" : "") << "\n";
+  std::cout << "Workers running: " << totals.workers << " of " << num_workers_ << "\n";
+  std::cout << "Worker restarts: " << totals.restarts << "\n";
+  std::cout << "Number of active connections: " << totals.connections << "\n";
+  std::cout << "Accumulative number of requests: " << totals.requests << "\n";
+  std::cout << "Connections shed: " << totals.shed << "\n";
+  std::cout << "Requests rate limited: " << totals.rate_limited << std::endl;
+  master_stat = 0;
+}
+
+} // namespace Cerver
@@ -0,0 +1,72 @@
+#ifndef PREFORK_H_
+#define PREFORK_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "server.h"
+#include "serverconfig.h"
+#include "sharedstats.h"
+
+namespace Cerver {
+
+// Pre-fork master: opens the listen socket(s), forks one worker process per
+// slot and restarts any worker that exits until it is told to stop. A crash
+// takes down one worker and its connections, not the server.
+//
+// Without reuseport every worker accepts from one shared socket. With it the
+// master opens one SO_REUSEPORT socket per slot and the kernel spreads new
+// connections across them; a restarted worker takes over its slot's socket,
+// so connections queued there are not lost.
+//
+// SIGINT stops the workers and returns from Run. SIGUSR1 prints the summed
+// counters of all workers. SIGUSR2, or handing the sockets to a new master
+// (see handoff.h), lets the workers drain their connections first.
+class Prefork : public Server {
+  public:
+    // Runs in the worker process. It gets the slot number, the socket to
+    // accept from and the slot's counters, and its return value is the
+    // worker's exit status.
+    typedef std::function<int(int worker, int listen_fd, SharedStats::Slot* slot)> WorkerMain;
+
+    // [stats] must have been created with at least config.workers slots.
+    Prefork(const ServerConfig& config, SharedStats* stats, WorkerMain worker_main);
+    ~Prefork();
+    void Run() override;
+    void PrintStat();
+    // Accepts from sockets received from an old process rather than opening
+    // new ones: one, or one per worker with reuseport. Must be called before
+    // Run.
+    void UseListenSockets(const std::vector<int>& fds);
+    // Offers the listen sockets to a new process connecting at [path].
+    void EnableUpgrade(const std::string& path);
+    // Runs once every worker has started accepting.
+    void OnServing(std::function<void()> callback);
+    // Whether Run returned because the sockets went to a new process.
+    bool HandedOff() const;
+
+  private:
+    // Returns the worker's pid, or -1 if fork failed.
+    pid_t Spawn(int worker);
+    // Waits for every worker to exit, killing them after [timeout_us].
+    void Reap(uint64_t timeout_us);
+
+    int num_workers_;
+    int port_;
+    int backlog_;
+    bool reuseport_;
+    SharedStats* stats_;
+    WorkerMain worker_main_;
+    std::string upgrade_path_;
+    int upgrade_fd_;
+    bool handed_off_;
+    std::function<void()> on_serving_;
+    std::vector<int> listen_fds_;     // One, or one per worker with reuseport
+    std::vector<pid_t> pids_;
+    std::vector<uint64_t> started_us_;
+};
+
+} // namespace Cerver
+
+#endif
@@ -0,0 +1,91 @@
+#include <time.h>
+#include <functional>
+#include "ratelimiter.h"
+
+namespace Cerver {
+
+RateLimiter::RateLimiter(double rate, double burst, size_t capacity)
+  : rate_milli_(static_cast<uint64_t>(rate * 1000)),
+    burst_milli_(static_cast<uint32_t>(burst * 1000)),
+    allowed_(0),
+    limited_(0) {
+  size_t sets = 1;
+  while (sets * kWays < capacity) {
+    sets <<= 1;
+  }
+  set_mask_ = sets - 1;
+  buckets_ = std::vector<Bucket>(sets * kWays, Bucket{0, 0, 0});
+  for (size_t i = 0; i < kStripes; i++) {
+    pthread_mutex_init(&locks_[i], nullptr);
+  }
+}
+
+RateLimiter::~RateLimiter() {
+  for (size_t i = 0; i < kStripes; i++) {
+    pthread_mutex_destroy(&locks_[i]);
+  }
+}
+
+uint32_t RateLimiter::NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint32_t>(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+bool RateLimiter::Allow(const std::string& key) {
+  uint64_t hash = std::hash<std::string>()(key);
+  uint64_t tag = hash | 1; // Never 0, which marks an unused bucket
+  size_t set = (hash >> 8) & set_mask_;
+  Bucket* ways = &buckets_[set * kWays];
+  uint32_t now = NowMs();
+
+  pthread_mutex_t* lock = &locks_[set % kStripes];
+  pthread_mutex_lock(lock);
+  Bucket* bucket = nullptr;
+  Bucket* oldest = &ways[0];
+  for (int i = 0; i < kWays; i++) {
+    if (ways[i].tag == tag) {
+      bucket = &ways[i];
+      break;
+    }
+    if (ways[i].tag == 0) {
+      oldest = &ways[i];
+      break;
+    }
+    if (oldest->tag != 0 && static_cast<int32_t>(ways[i].stamp_ms - oldest->stamp_ms) < 0) {
+      oldest = &ways[i];
+    }
+  }
+  if (bucket == nullptr) {
+    bucket = oldest;
+    bucket->tag = tag;
+    bucket->tokens = burst_milli_;
+  } else {
+    uint64_t elapsed = now - bucket->stamp_ms;
+    uint64_t tokens = bucket->tokens + elapsed * rate_milli_ / 1000;
+    bucket->tokens = tokens > burst_milli_ ? burst_milli_ : tokens;
+  }
+  bucket->stamp_ms = now;
+  bool allowed = bucket->tokens >= 1000;
+  if (allowed) {
+    bucket->tokens -= 1000;
+  }
+  pthread_mutex_unlock(lock);
+
+  if (allowed) {
+    allowed_++;
+  } else {
+    limited_++;
+  }
+  return allowed;
+}
+
+uint64_t RateLimiter::Allowed() const {
+  return allowed_;
+}
+
+uint64_t RateLimiter::Limited() const {
+  return limited_;
+}
+
+} // namespace Cerver
@@ -0,0 +1,56 @@
+#ifndef RATE_LIMITER_H_
+#define RATE_LIMITER_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace Cerver {
+
+// Token buckets per key (e.g. client address) in a fixed-size table, so
+// memory stays bounded no matter how many clients show up.
+//
+// The table is set-associative: a key hashes to one set of kWays buckets and
+// may live in any of them. When a new key finds its set full, the bucket used
+// least recently is reused, which approximates LRU over the whole table
+// without a global list. Sets are guarded by a fixed number of striped
+// mutexes, so concurrent callers rarely contend and each check is a hash, a
+// lock and a scan of one cache-line-sized set.
+//
+// A key that is evicted and comes back starts with a full bucket, so the
+// table should hold comfortably more buckets than active clients.
+class RateLimiter {
+  public:
+    static const int kWays = 4;
+
+    // [rate] tokens are added per second, up to [burst].
+    RateLimiter(double rate, double burst, size_t capacity = 64 * 1024);
+    ~RateLimiter();
+    // Takes one token from [key]'s bucket. Returns true if there was one.
+    bool Allow(const std::string& key);
+    uint64_t Allowed() const;
+    uint64_t Limited() const;
+
+  private:
+    struct Bucket {
+      uint64_t tag;       // Hash of the key; 0 if unused
+      uint32_t tokens;    // In thousandths of a token
+      uint32_t stamp_ms;  // Last refill, which is also the last use
+    };
+    static const size_t kStripes = 64;
+    static uint32_t NowMs();
+
+    uint64_t rate_milli_;   // Thousandths of a token per second
+    uint32_t burst_milli_;
+    size_t set_mask_;
+    std::vector<Bucket> buckets_;
+    pthread_mutex_t locks_[kStripes];
+    std::atomic<uint64_t> allowed_;
+    std::atomic<uint64_t> limited_;
+};
+
+} // namespace Cerver
+
+#endif
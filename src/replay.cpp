@@ -0,0 +1,248 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <pthread.h>
+#include "accesslog.h"
+#include "tcpconnection.h"
+#include "utils.h"
+
+using std::string;
+using std::vector;
+using namespace Cerver;
+
+// Replays a run.log or capture.bin against a running server and reports
+// the latency distribution. Latency is measured from the scheduled send time,
+// so a server that falls behind the original arrival rate is charged for the
+// queueing it causes instead of silently slowing the replay down.
+
+struct ReplayPlan {
+  vector<AccessRecord> records;
+  string host;
+  int port;
+  double scale;
+  bool max_rate;
+  uint64_t start_us;
+  std::atomic<size_t> next;
+  std::atomic<int> errors;
+  vector<int64_t> latencies_us; // -1 for failed requests
+};
+
+static int ReadResponse(TCPConnection* conn) {
+  string header;
+  if (conn->ReadUntilDoubleCRLF(&header) <= 0) {
+    return -1;
+  }
+  Utils::LowerCase(header);
+  size_t pos = header.find("content-length:");
+  if (pos == string::npos) {
+    return 0;
+  }
+  size_t len = strtoul(header.c_str() + pos + 15, nullptr, 10);
+  string body;
+  conn->ReadSize(len, &body);
+  return body.length() == len ? 0 : -1;
+}
+
+static void* ReplayLoop(void* arg) {
+  ReplayPlan* plan = static_cast<ReplayPlan*>(arg);
+  std::unique_ptr<TCPConnection> conn;
+  while (true) {
+    size_t i = plan->next++;
+    if (i >= plan->records.size()) {
+      break;
+    }
+    const AccessRecord& record = plan->records[i];
+    uint64_t scheduled = plan->start_us;
+    if (!plan->max_rate) {
+      scheduled += (record.arrival_us - plan->records[0].arrival_us) / plan->scale;
+    }
+    uint64_t now = NowMicros();
+    if (now < scheduled) {
+      usleep(scheduled - now);
+    } else if (plan->max_rate) {
+      scheduled = now;
+    }
+    if (conn == nullptr) {
+      conn = std::make_unique<TCPConnection>();
+      if (conn->Connect(plan->host, plan->port) == -1) {
+        conn.reset();
+        plan->errors++;
+        plan->latencies_us[i] = -1;
+        continue;
+      }
+    }
+    string method = record.method;
+    for (size_t j = 0; j < method.length(); j++) {
+      method[j] = toupper(method[j]);
+    }
+    string request = method + " " + record.uri + " HTTP/1.1\r\nHost: " + plan->host + "\r\n";
+    if (method != "GET") {
+      request += "Content-Length: 0\r\n";
+    }
+    request += "\r\n";
+    if (conn->Send(request) != static_cast<int>(request.length()) || ReadResponse(conn.get()) != 0) {
+      conn->Close();
+      conn.reset();
+      plan->errors++;
+      plan->latencies_us[i] = -1;
+      continue;
+    }
+    plan->latencies_us[i] = NowMicros() - scheduled;
+  }
+  if (conn != nullptr) {
+    conn->Close();
+  }
+  return nullptr;
+}
+
+static double Percentile(const vector<int64_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = static_cast<size_t>(p * (sorted.size() - 1));
+  return sorted[idx] / 1000.0;
+}
+
+static void PrintDistribution(const string& label, const vector<int64_t>& sorted) {
+  std::cout << label
+            << "p50 " << Percentile(sorted, 0.5) << " ms, "
+            << "p90 " << Percentile(sorted, 0.9) << " ms, "
+            << "p99 " << Percentile(sorted, 0.99) << " ms, "
+            << "p99.9 " << Percentile(sorted, 0.999) << " ms, "
+            << "max " << Percentile(sorted, 1.0) << " ms" << std::endl;
+}
+
+static int LoadLatencies(const string& path, vector<int64_t>* latencies) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    return -1;
+  }
+  int64_t latency;
+  while (in >> latency) {
+    latencies->push_back(latency);
+  }
+  std::sort(latencies->begin(), latencies->end());
+  return latencies->size();
+}
+
+// Prints two saved latency files side by side, e.g. a baseline build
+// against a candidate build replayed with the same trace.
+static int Compare(const string& base_path, const string& new_path) {
+  vector<int64_t> base;
+  vector<int64_t> candidate;
+  if (LoadLatencies(base_path, &base) <= 0 || LoadLatencies(new_path, &candidate) <= 0) {
+    std::cout << "Failed to read latency files" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const double points[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+  const char* names[] = {"p50", "p90", "p99", "p99.9", "max"};
+  for (int i = 0; i < 5; i++) {
+    double b = Percentile(base, points[i]);
+    double c = Percentile(candidate, points[i]);
+    std::cout << names[i] << ": " << b << " ms -> " << c << " ms";
+    if (b > 0) {
+      std::cout << " (" << (c - b) / b * 100 << "%)";
+    }
+    std::cout << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+  string host = "127.0.0.1";
+  int port = 80;
+  double scale = 1.0;
+  bool max_rate = false;
+  int num_threads = 16;
+  string out_path;
+  int c;
+  while ((c = getopt(argc, argv, "h:p:s:mn:o:C")) != -1) {
+    switch(c) {
+      case 'h':
+        host = optarg;
+        break;
+      case 'p':
+        if (!Utils::IsNumber(string(optarg))) {
+          std::cout << "-p argument must be a number that specifies a port" << std::endl;
+          return EXIT_FAILURE;
+        }
+        port = atoi(optarg);
+        break;
+      case 's':
+        scale = atof(optarg);
+        if (scale <= 0) {
+          std::cout << "-s argument must be a positive rate multiplier" << std::endl;
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'm':
+        max_rate = true;
+        break;
+      case 'n':
+        num_threads = atoi(optarg);
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      case 'C':
+        if (optind + 1 >= argc) {
+          std::cout << "./replay -C <baseline latencies> <candidate latencies>" << std::endl;
+          return EXIT_FAILURE;
+        }
+        return Compare(argv[optind], argv[optind + 1]);
+      case '?':
+        std::cout << optopt << " is not an accepted argument." << std::endl;
+        return 1;
+      default:
+        abort();
+    }
+  }
+  if (optind >= argc) {
+    std::cout << "./replay [-h host] [-p port] [-s scale | -m] [-n threads] [-o latencies] <run.log | capture.bin>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  ReplayPlan plan;
+  if (ReadAccessRecords(argv[optind], &plan.records) <= 0) {
+    std::cout << "No requests found in " << argv[optind] << std::endl;
+    return EXIT_FAILURE;
+  }
+  plan.host = host;
+  plan.port = port;
+  plan.scale = scale;
+  plan.max_rate = max_rate;
+  plan.next = 0;
+  plan.errors = 0;
+  plan.latencies_us = vector<int64_t>(plan.records.size(), -1);
+  plan.start_us = NowMicros();
+
+  vector<pthread_t> threads(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    pthread_create(&threads[i], nullptr, &ReplayLoop, static_cast<void*>(&plan));
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], nullptr);
+  }
+  double elapsed = (NowMicros() - plan.start_us) / 1000000.0;
+
+  vector<int64_t> sorted;
+  for (int64_t latency : plan.latencies_us) {
+    if (latency >= 0) {
+      sorted.push_back(latency);
+    }
+  }
+  std::sort(sorted.begin(), sorted.end());
+  std::cout << "Replayed " << plan.records.size() << " requests in " << elapsed << " s ("
+            << plan.records.size() / elapsed << " req/s), " << plan.errors << " errors" << std::endl;
+  PrintDistribution("Latency: ", sorted);
+  if (!out_path.empty()) {
+    std::ofstream out(out_path);
+    for (int64_t latency : sorted) {
+      out << latency << "\n";
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 
 #include "server.h"
@@ -9,22 +10,28 @@ namespace Cerver {
 
 Server::Server() {};
 Server::~Server() {};
-int Server::CreateListenSocket(int port, int queue_capacity) {
+int Server::CreateListenSocket(int port, int queue_capacity, bool reuse_port) {
   int listen_fd = socket(PF_INET, SOCK_STREAM, 0);
   if (listen_fd == -1) {
     return listen_fd;
   }
   int opt = 1;
-  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR|SO_REUSEPORT, &opt, sizeof(opt));
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+    close(listen_fd);
+    return -1;
+  }
   struct sockaddr_in servaddr;
   memset(&servaddr, 0, sizeof(sockaddr_in));
   servaddr.sin_family = AF_INET;
   servaddr.sin_addr.s_addr = htons(INADDR_ANY);
   servaddr.sin_port = htons(port);
   if (bind(listen_fd, (struct sockaddr*)&servaddr, sizeof(servaddr)) == -1){
+    close(listen_fd);
     return -1;
   }
   if (listen(listen_fd, queue_capacity) == -1) {
+    close(listen_fd);
     return -1;
   }
   return listen_fd;
@@ -11,7 +11,9 @@ class Server {
     Server();
     virtual ~Server();
     virtual void Run() = 0;
-    int CreateListenSocket(int port, int queue_capacity);
+    // With [reuse_port], other sockets may bind the same port and the kernel
+    // spreads connections across them.
+    int CreateListenSocket(int port, int queue_capacity, bool reuse_port = false);
     int AcceptConnection(int listen_fd, std::string* addr, int* port);
     void PrepareToHandleSignal(int signal, void (*SignalHandler)(int));
 };
@@ -0,0 +1,130 @@
+#include <fstream>
+#include <stdlib.h>
+#include "serverconfig.h"
+#include "utils.h"
+
+using std::string;
+using std::vector;
+
+namespace Cerver {
+
+static string Strip(const string& str) {
+  size_t begin = str.find_first_not_of(" \t\r");
+  if (begin == string::npos) {
+    return "";
+  }
+  return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+static bool IsPositive(const string& str) {
+  return !str.empty() && Utils::IsNumber(str) && atoi(str.c_str()) > 0;
+}
+
+ServerConfig::ServerConfig() : port(80), backlog(100), threads(32), workers(0), reuseport(false) { }
+
+int ServerConfig::LoadFile(const string& path, string* error) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    *error = "cannot open " + path;
+    return -1;
+  }
+  string line;
+  int line_num = 0;
+  while (std::getline(file, line)) {
+    line_num++;
+    size_t comment = line.find('#');
+    if (comment != string::npos) {
+      line = line.substr(0, comment);
+    }
+    line = Strip(line);
+    if (line.empty()) {
+      continue;
+    }
+    size_t eq = line.find('=');
+    if (eq == string::npos) {
+      *error = path + ":" + std::to_string(line_num) + ": expected key = value";
+      return -1;
+    }
+    string key = Strip(line.substr(0, eq));
+    string value = Strip(line.substr(eq + 1));
+    if (Set(key, value, error) == -1) {
+      *error = path + ":" + std::to_string(line_num) + ": " + *error;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int ServerConfig::Set(const string& key, const string& value, string* error) {
+  if (key == "port" || key == "backlog" || key == "threads") {
+    if (!IsPositive(value)) {
+      *error = key + " must be a positive number";
+      return -1;
+    }
+    int n = atoi(value.c_str());
+    if (key == "port") {
+      port = n;
+    } else if (key == "backlog") {
+      backlog = n;
+    } else {
+      threads = n;
+    }
+    return 0;
+  }
+  if (key == "workers") {
+    if (value != "0" && !IsPositive(value)) {
+      *error = "workers must be 0 or a positive number";
+      return -1;
+    }
+    workers = atoi(value.c_str());
+    return 0;
+  }
+  if (key == "reuseport") {
+    if (value != "on" && value != "off") {
+      *error = "reuseport must be on or off";
+      return -1;
+    }
+    reuseport = value == "on";
+    return 0;
+  }
+  if (key == "acceptor_cpus" || key == "worker_cpus") {
+    // An empty list leaves the threads unpinned.
+    vector<int> cpus;
+    if (!value.empty() && ParseCpuList(value, &cpus) == -1) {
+      *error = key + " must be a list of CPUs such as 0-7,16";
+      return -1;
+    }
+    (key == "acceptor_cpus" ? acceptor_cpus : worker_cpus) = cpus;
+    return 0;
+  }
+  *error = "unknown key " + key;
+  return -1;
+}
+
+int ServerConfig::ParseCpuList(const string& list, vector<int>* cpus) {
+  vector<string> ranges;
+  Utils::Split(list, ",", &ranges);
+  if (ranges.empty()) {
+    return -1;
+  }
+  for (const string& item : ranges) {
+    string range = Strip(item);
+    size_t dash = range.find('-');
+    string first = range.substr(0, dash);
+    string last = dash == string::npos ? first : range.substr(dash + 1);
+    if (first.empty() || last.empty() || !Utils::IsNumber(first) || !Utils::IsNumber(last)) {
+      return -1;
+    }
+    int lo = atoi(first.c_str());
+    int hi = atoi(last.c_str());
+    if (lo > hi) {
+      return -1;
+    }
+    for (int cpu = lo; cpu <= hi; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  return 0;
+}
+
+} // namespace Cerver
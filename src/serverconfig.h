@@ -0,0 +1,50 @@
+#ifndef SERVER_CONFIG_H_
+#define SERVER_CONFIG_H_
+
+#include <string>
+#include <vector>
+
+namespace Cerver {
+
+// Runtime topology of an HttpServer: how many workers, where its threads
+// run, and how it listens. Read from a config file of "key = value" lines
+// ('#' starts a comment) and/or set key by key from the command line:
+//
+//   port = 80
+//   backlog = 1024
+//   threads = 32
+//   acceptor_cpus = 0
+//   worker_cpus = 1-15,32-47
+//   workers = 4
+//   reuseport = on
+//
+// CPU lists are comma-separated CPU numbers and ranges. Worker i is pinned
+// to the i-th CPU of worker_cpus (wrapping around), so listing the CPUs of
+// one socket keeps every worker and its buffers on that NUMA node. The
+// acceptor thread may run on any CPU of acceptor_cpus. Empty lists leave
+// threads unpinned. Pinning is only supported on Linux.
+//
+// With workers > 0 the server runs as a pre-fork master and that many worker
+// processes, each with its own thread pool, CPU lists applying within each
+// worker. reuseport = on gives every worker its own SO_REUSEPORT socket
+// instead of one shared listen socket.
+class ServerConfig {
+  public:
+    ServerConfig();
+    // Returns 0 on success, -1 with [error] set otherwise.
+    int LoadFile(const std::string& path, std::string* error);
+    int Set(const std::string& key, const std::string& value, std::string* error);
+    static int ParseCpuList(const std::string& list, std::vector<int>* cpus);
+
+    int port;
+    int backlog;
+    int threads;
+    std::vector<int> acceptor_cpus;
+    std::vector<int> worker_cpus;
+    int workers;    // Worker processes; 0 serves from this process
+    bool reuseport;
+};
+
+} // namespace Cerver
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SHARED_BUFFER_H_
+#define SHARED_BUFFER_H_
+
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace Utils {
+
+// Immutable bytes shared by reference count. Copies are cheap and point at
+// the same memory; whatever backs the bytes (a string, an mmapped region)
+// stays alive until the last copy is gone.
+class SharedBuffer {
+  public:
+    SharedBuffer() : data_(nullptr), size_(0) { }
+    explicit SharedBuffer(std::string str) {
+      std::shared_ptr<const std::string> owned = std::make_shared<const std::string>(std::move(str));
+      data_ = owned->data();
+      size_ = owned->size();
+      owner_ = owned;
+    }
+    // [owner] keeps [data] valid.
+    SharedBuffer(std::shared_ptr<const void> owner, const char* data, size_t size)
+      : owner_(std::move(owner)), data_(data), size_(size) { }
+
+    // Maps the file at [path] read-only. The mapping is released when the
+    // last copy or slice is gone. Returns an empty buffer on failure.
+    static SharedBuffer MapFile(const std::string& path) {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd == -1) {
+        return SharedBuffer();
+      }
+      struct stat st;
+      if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return SharedBuffer();
+      }
+      size_t size = st.st_size;
+      void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (addr == MAP_FAILED) {
+        return SharedBuffer();
+      }
+      std::shared_ptr<const void> mapping(addr, [size](const void* p) {
+        munmap(const_cast<void*>(p), size);
+      });
+      return SharedBuffer(std::move(mapping), static_cast<const char*>(addr), size);
+    }
+
+    const char* Data() const {
+      return data_;
+    }
+    size_t Size() const {
+      return size_;
+    }
+    bool Empty() const {
+      return size_ == 0;
+    }
+    std::string ToString() const {
+      return std::string(data_, size_);
+    }
+    // A view of part of this buffer that shares its owner.
+    SharedBuffer Slice(size_t offset, size_t size) const {
+      return SharedBuffer(owner_, data_ + offset, size);
+    }
+
+  private:
+    std::shared_ptr<const void> owner_;
+    const char* data_;
+    size_t size_;
+};
+
+} // namespace Utils
+
+#endif
@@ -0,0 +1,112 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sharedstats.h"
+
+namespace Cerver {
+
+SharedStats::SharedStats() : inode_(0), base_(nullptr), size_(0), slots_(nullptr), num_slots_(0) { }
+
+SharedStats::~SharedStats() {
+  if (base_ != nullptr) {
+    munmap(base_, size_);
+  }
+}
+
+size_t SharedStats::MappingSize(int num_slots) {
+  // The header takes a whole line so the slots stay line aligned.
+  return sizeof(Slot) + num_slots * sizeof(Slot);
+}
+
+int SharedStats::Create(const std::string& path, int num_slots) {
+  unlink(path.c_str());
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  size_t size = MappingSize(num_slots);
+  if (ftruncate(fd, size) == -1) {
+    close(fd);
+    return -1;
+  }
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+  // ftruncate zero-fills, and zero is a valid state for every counter.
+  Header* header = static_cast<Header*>(base);
+  header->num_slots = num_slots;
+  header->magic = SHARED_STATS_MAGIC;
+  path_ = path;
+  inode_ = st.st_ino;
+  base_ = base;
+  size_ = size;
+  slots_ = reinterpret_cast<Slot*>(static_cast<char*>(base) + sizeof(Slot));
+  num_slots_ = num_slots;
+  return 0;
+}
+
+void SharedStats::Remove() {
+  struct stat st;
+  if (!path_.empty() && stat(path_.c_str(), &st) == 0 && st.st_ino == inode_) {
+    unlink(path_.c_str());
+  }
+}
+
+int SharedStats::Open(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < MappingSize(0)) {
+    close(fd);
+    return -1;
+  }
+  void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+  const Header* header = static_cast<const Header*>(base);
+  if (header->magic != SHARED_STATS_MAGIC ||
+      MappingSize(header->num_slots) > static_cast<size_t>(st.st_size)) {
+    munmap(base, st.st_size);
+    return -1;
+  }
+  base_ = base;
+  size_ = st.st_size;
+  slots_ = reinterpret_cast<Slot*>(static_cast<char*>(base) + sizeof(Slot));
+  num_slots_ = header->num_slots;
+  return 0;
+}
+
+int SharedStats::NumSlots() const {
+  return num_slots_;
+}
+
+SharedStats::Slot* SharedStats::GetSlot(int i) {
+  return &slots_[i];
+}
+
+void SharedStats::Sum(Totals* totals) const {
+  memset(totals, 0, sizeof(Totals));
+  for (int i = 0; i < num_slots_; i++) {
+    const Slot& slot = slots_[i];
+    if (slot.pid.load(std::memory_order_relaxed) != 0) {
+      totals->workers++;
+    }
+    totals->restarts += slot.restarts.load(std::memory_order_relaxed);
+    totals->connections += slot.connections.load(std::memory_order_relaxed);
+    totals->requests += slot.requests.load(std::memory_order_relaxed);
+    totals->shed += slot.shed.load(std::memory_order_relaxed);
+    totals->rate_limited += slot.rate_limited.load(std::memory_order_relaxed);
+  }
+}
+
+} // namespace Cerver
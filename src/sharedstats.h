@@ -0,0 +1,74 @@
+#ifndef SHARED_STATS_H_
+#define SHARED_STATS_H_
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHARED_STATS_MAGIC 0x43565354 // "CVST"
+
+namespace Cerver {
+
+// Per-worker counters in a file-backed shared mapping. The pre-fork master
+// creates it before forking, so every worker inherits the mapping and bumps
+// its own slot with plain atomics, and `webserver stats` can map the same
+// file read-only to add the slots up without asking any process.
+//
+// Each slot sits on its own cache line so workers never write to the same
+// line. Counters are lifetime totals of the slot, across restarts of the
+// worker that owns it.
+class SharedStats {
+  public:
+    struct alignas(64) Slot {
+      std::atomic<pid_t> pid;           // 0 if no worker owns the slot
+      std::atomic<uint32_t> restarts;
+      std::atomic<uint32_t> serving;    // Set while the worker accepts
+      std::atomic<int64_t> connections; // Currently open
+      std::atomic<uint64_t> requests;
+      std::atomic<uint64_t> shed;
+      std::atomic<uint64_t> rate_limited;
+    };
+    struct Totals {
+      int workers;                      // Slots with a live worker
+      uint64_t restarts;
+      int64_t connections;
+      uint64_t requests;
+      uint64_t shed;
+      uint64_t rate_limited;
+    };
+
+    SharedStats();
+    ~SharedStats();
+    // Creates [path] with [num_slots] zeroed slots and maps it shared and
+    // writable. A file already there is unlinked first, so a process still
+    // mapping it keeps its own copy. Returns 0 on success, -1 otherwise.
+    int Create(const std::string& path, int num_slots);
+    // Maps an existing file read-only. Returns -1 if it is missing or not a
+    // stats file.
+    int Open(const std::string& path);
+    // Removes the file created by Create, unless another process has since
+    // replaced it with its own.
+    void Remove();
+    int NumSlots() const;
+    Slot* GetSlot(int i);
+    void Sum(Totals* totals) const;
+
+  private:
+    struct Header {
+      uint32_t magic;
+      uint32_t num_slots;
+    };
+    static size_t MappingSize(int num_slots);
+
+    std::string path_;
+    ino_t inode_;
+    void* base_;
+    size_t size_;
+    Slot* slots_;
+    int num_slots_;
+};
+
+} // namespace Cerver
+
+#endif
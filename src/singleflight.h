@@ -0,0 +1,81 @@
+#ifndef SINGLE_FLIGHT_H_
+#define SINGLE_FLIGHT_H_
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <pthread.h>
+
+// Collapses concurrent calls for the same key into one. The first caller
+// for a key runs the function; callers that arrive while it is running
+// wait for it and receive a copy of its result instead of running it again.
+template <typename K, typename V>
+class SingleFlight {
+  public:
+    typedef std::function<int(V*)> Function;
+
+    SingleFlight() {
+      pthread_mutex_init(&lock_, nullptr);
+      pthread_cond_init(&cond_, nullptr);
+    }
+    virtual ~SingleFlight() {
+      pthread_cond_destroy(&cond_);
+      pthread_mutex_destroy(&lock_);
+    }
+
+    // Returns fn's result. [shared] is set to true if the result came from
+    // another caller's call.
+    int Do(const K& key, V* val, const Function& fn, bool* shared = nullptr) {
+      pthread_mutex_lock(&lock_);
+      auto it = calls_.find(key);
+      if (it != calls_.end()) {
+        std::shared_ptr<Call> call = it->second;
+        while (!call->done) {
+          pthread_cond_wait(&cond_, &lock_);
+        }
+        pthread_mutex_unlock(&lock_);
+        *val = call->val;
+        if (shared != nullptr) {
+          *shared = true;
+        }
+        return call->ret;
+      }
+      std::shared_ptr<Call> call = std::make_shared<Call>();
+      calls_.insert({key, call});
+      pthread_mutex_unlock(&lock_);
+
+      call->ret = fn(&call->val);
+
+      pthread_mutex_lock(&lock_);
+      call->done = true;
+      calls_.erase(key);
+      pthread_cond_broadcast(&cond_);
+      pthread_mutex_unlock(&lock_);
+      *val = call->val;
+      if (shared != nullptr) {
+        *shared = false;
+      }
+      return call->ret;
+    }
+
+    // Number of keys with a call in flight.
+    int InFlight() {
+      pthread_mutex_lock(&lock_);
+      int in_flight = calls_.size();
+      pthread_mutex_unlock(&lock_);
+      return in_flight;
+    }
+
+  private:
+    struct Call {
+      Call() : done(false), ret(0) { }
+      bool done;
+      int ret;
+      V val;
+    };
+    std::unordered_map<K, std::shared_ptr<Call> > calls_;
+    pthread_mutex_t lock_;
+    pthread_cond_t cond_;
+};
+
+#endif
@@ -0,0 +1,311 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "staticfilehandler.h"
+#include "mimetypes.h"
+#include "utils.h"
+
+using std::string;
+using std::shared_ptr;
+using std::vector;
+
+namespace Cerver {
+
+shared_ptr<const StaticResponse> MakeStaticResponse(
+  const Utils::SharedBuffer& body,
+  const string& content_type,
+  const string& etag,
+  int max_age
+) {
+  shared_ptr<StaticResponse> res = std::make_shared<StaticResponse>();
+  res->etag = etag;
+  string cache_headers = "ETag: " + etag + "\r\n" +
+                         "Cache-Control: public, max-age=" + std::to_string(max_age) + "\r\n";
+  res->header = Utils::SharedBuffer("HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: " + content_type + "\r\n" +
+                                    "Content-Length: " + std::to_string(body.Size()) + "\r\n" +
+                                    cache_headers + "\r\n");
+  res->not_modified = Utils::SharedBuffer("HTTP/1.1 304 Not Modified\r\n" + cache_headers + "\r\n");
+  res->body = body;
+  return res;
+}
+
+string MakeETag(const Utils::SharedBuffer& body) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < body.Size(); i++) {
+    hash ^= static_cast<unsigned char>(body.Data()[i]);
+    hash *= 1099511628211ULL;
+  }
+  char etag[20];
+  snprintf(etag, sizeof(etag), "\"%016llx\"", static_cast<unsigned long long>(hash));
+  return string(etag);
+}
+
+StaticFileHandler::StaticFileHandler(const string& dir, size_t cache_bytes, int max_age)
+  : dir_(dir),
+    max_age_(max_age),
+    cache_(cache_bytes),
+    large_files_(cache_bytes),
+    generation_(0),
+    inotify_fd_(-1),
+    watching_(false) {
+  // Until Watch is called, bound how long an edited file stays stale.
+  cache_.SetDefaultTTL(1000);
+}
+
+StaticFileHandler::~StaticFileHandler() {
+  if (watching_) {
+    watching_ = false;
+    pthread_join(watcher_, nullptr);
+  }
+  if (inotify_fd_ != -1) {
+    close(inotify_fd_);
+  }
+}
+
+void StaticFileHandler::Exclude(const string& name) {
+  excluded_.push_back(name);
+}
+
+void StaticFileHandler::Watch() {
+#ifdef __linux__
+  if (watching_) {
+    return;
+  }
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ == -1) {
+    return;
+  }
+  AddWatch("");
+  watching_ = true;
+  // Entries cached before this point may already be stale.
+  cache_.Clear();
+  cache_.SetDefaultTTL(0);
+  pthread_create(&watcher_, nullptr, &StaticFileHandler::WatchLoop, static_cast<void*>(this));
+#endif
+}
+
+shared_ptr<const StaticResponse> StaticFileHandler::Lookup(const string& path) {
+  // Cache keys have no leading or trailing slash; "" is the root.
+  size_t begin = path.find_first_not_of('/');
+  size_t end = path.find_last_not_of('/');
+  string key = begin == string::npos ? "" : path.substr(begin, end - begin + 1);
+  if (!Allowed(key)) {
+    return nullptr;
+  }
+  shared_ptr<const StaticResponse> res;
+  if (cache_.Get(key, &res) == 0) {
+    return res;
+  }
+  bool shared = false;
+  uint64_t generation = generation_;
+  int ret = flights_.Do(key, &res, [this, &key](shared_ptr<const StaticResponse>* loaded) {
+    return Load(key, loaded);
+  }, &shared);
+  if (ret == -1) {
+    return nullptr;
+  }
+  if (ret == 0 && !shared) {
+    cache_.Put(key, res);
+    // The file changed while it was being read; the copy may be stale.
+    if (generation_ != generation) {
+      cache_.Erase(key);
+    }
+  }
+  return res;
+}
+
+void StaticFileHandler::GetStats(CacheStats* stats) {
+  cache_.GetStats(stats);
+}
+
+void StaticFileHandler::HotKeys(vector<string>* paths) {
+  vector<string> keys;
+  cache_.Keys(&keys);
+  paths->insert(paths->end(), keys.rbegin(), keys.rend());
+}
+
+bool StaticFileHandler::Allowed(const string& path) {
+  if (path.find('\0') != string::npos) {
+    return false;
+  }
+  vector<string> segments;
+  Utils::Split(path, "/", &segments);
+  for (const string& segment : segments) {
+    // Also rejects "." and "..", so a path can never leave the directory.
+    if (segment.empty() || segment[0] == '.') {
+      return false;
+    }
+    if (std::find(excluded_.begin(), excluded_.end(), segment) != excluded_.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads the first [size] bytes of [path] into [body]. The file is copied
+// rather than mapped, since a mapping faults if the file is truncated while
+// it is being sent.
+static bool ReadFile(const string& path, off_t size, Utils::SharedBuffer* body) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  string content(size, '\0');
+  off_t offset = 0;
+  while (offset < size) {
+    ssize_t bytes_read = pread(fd, &content[offset], size - offset, offset);
+    if (bytes_read <= 0) {
+      break;
+    }
+    offset += bytes_read;
+  }
+  close(fd);
+  content.resize(offset);
+  *body = Utils::SharedBuffer(std::move(content));
+  return true;
+}
+
+// Returns 0 for a response that may be cached, 1 for one that is too large
+// to cache, and -1 if there is no such file.
+int StaticFileHandler::Load(const string& path, shared_ptr<const StaticResponse>* res) {
+  string file_path = path.empty() ? dir_ : dir_ + "/" + path;
+  struct stat st;
+  if (stat(file_path.c_str(), &st) == -1) {
+    return -1;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    file_path += "/index.html";
+    if (stat(file_path.c_str(), &st) == -1) {
+      return -1;
+    }
+  }
+  if (!S_ISREG(st.st_mode)) {
+    return -1;
+  }
+  bool cacheable = static_cast<size_t>(st.st_size) <= cache_.Capacity() / 8;
+  char version[80];
+  snprintf(version, sizeof(version), "%llx:%llx:%llx:%llx",
+           static_cast<unsigned long long>(st.st_dev),
+           static_cast<unsigned long long>(st.st_ino),
+           static_cast<unsigned long long>(st.st_mtime),
+           static_cast<unsigned long long>(st.st_size));
+  if (!cacheable && large_files_.Get(version, res) == 0) {
+    return 1;
+  }
+  Utils::SharedBuffer body;
+  if (!ReadFile(file_path, st.st_size, &body)) {
+    return -1;
+  }
+  // Size and modification time identify a version without hashing the file.
+  char etag[40];
+  snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+           static_cast<unsigned long long>(body.Size()),
+           static_cast<unsigned long long>(st.st_mtime));
+  *res = MakeStaticResponse(body, string(MimeTypeFor(file_path)), etag, max_age_);
+  if (!cacheable) {
+    large_files_.Put(version, *res);
+  }
+  return cacheable ? 0 : 1;
+}
+
+void StaticFileHandler::Invalidate(const string& path) {
+  generation_++;
+  cache_.Erase(path);
+  // The directory itself is served from its index.html.
+  size_t slash = path.rfind('/');
+  string name = slash == string::npos ? path : path.substr(slash + 1);
+  if (name == "index.html") {
+    cache_.Erase(slash == string::npos ? "" : path.substr(0, slash));
+  }
+}
+
+void StaticFileHandler::AddWatch(const string& rel) {
+#ifdef __linux__
+  string path = rel.empty() ? dir_ : dir_ + "/" + rel;
+  int wd = inotify_add_watch(inotify_fd_, path.c_str(),
+                             IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE |
+                             IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+  if (wd == -1) {
+    return;
+  }
+  watches_[wd] = rel;
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    string name = entry->d_name;
+    if (name[0] == '.' || std::find(excluded_.begin(), excluded_.end(), name) != excluded_.end()) {
+      continue;
+    }
+    string child = rel.empty() ? name : rel + "/" + name;
+    struct stat st;
+    if (stat((dir_ + "/" + child).c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      AddWatch(child);
+    }
+  }
+  closedir(dir);
+#endif
+}
+
+void* StaticFileHandler::WatchLoop(void* arg) {
+#ifdef __linux__
+  StaticFileHandler* handler = static_cast<StaticFileHandler*>(arg);
+  char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (handler->watching_) {
+    struct pollfd pfd = {handler->inotify_fd_, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0) {
+      continue;
+    }
+    ssize_t len = read(handler->inotify_fd_, buf, sizeof(buf));
+    for (ssize_t offset = 0; offset < len;) {
+      const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buf + offset);
+      offset += sizeof(struct inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost, so any entry may be stale.
+        handler->generation_++;
+        handler->cache_.Clear();
+        continue;
+      }
+      auto it = handler->watches_.find(event->wd);
+      if (it == handler->watches_.end()) {
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        handler->watches_.erase(it);
+        continue;
+      }
+      if (event->len == 0) {
+        continue;
+      }
+      string rel = it->second.empty() ? string(event->name) : it->second + "/" + event->name;
+      if (!handler->Allowed(rel)) {
+        continue;
+      }
+      if (event->mask & IN_ISDIR) {
+        // A directory appeared or went away: watch the new one and drop
+        // everything, since any number of cached paths may now resolve
+        // differently.
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          handler->AddWatch(rel);
+        }
+        handler->generation_++;
+        handler->cache_.Clear();
+        continue;
+      }
+      handler->Invalidate(rel);
+    }
+  }
+#endif
+  return nullptr;
+}
+
+} // namespace Cerver
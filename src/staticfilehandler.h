@@ -0,0 +1,93 @@
+#ifndef STATIC_FILE_HANDLER_H_
+#define STATIC_FILE_HANDLER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "lrucache.h"
+#include "singleflight.h"
+#include "sharedbuffer.h"
+
+namespace Cerver {
+
+// A response for an immutable resource, serialized once so that every hit
+// writes the same buffers to the socket.
+struct StaticResponse {
+  Utils::SharedBuffer header;
+  Utils::SharedBuffer not_modified;
+  Utils::SharedBuffer body;
+  std::string etag;
+};
+
+std::shared_ptr<const StaticResponse> MakeStaticResponse(
+  const Utils::SharedBuffer& body,
+  const std::string& content_type,
+  const std::string& etag,
+  int max_age
+);
+
+// FNV-1a of the body, which is cheap and stable across restarts.
+std::string MakeETag(const Utils::SharedBuffer& body);
+
+// Serves the files under a directory. Responses are built on first request
+// and kept in a cache bounded by bytes. Files too large for it go in a
+// second cache of the same size, keyed by inode and modification time, so
+// they are read once per version rather than per request. Once Watch is
+// called the tree is watched with inotify (Linux only) and changed files are
+// dropped from the cache, so edits go live immediately. Otherwise cached
+// responses expire after a second.
+class StaticFileHandler {
+  public:
+    StaticFileHandler(const std::string& dir, size_t cache_bytes, int max_age);
+    ~StaticFileHandler();
+    // Paths with a segment of this name are never served, e.g. "tabula-data".
+    void Exclude(const std::string& name);
+    // Starts invalidating on change notifications. Call after Exclude.
+    void Watch();
+    // Response for [path], relative to the directory. A path naming a
+    // directory serves its index.html. Returns nullptr if there is no such
+    // file or the path is not allowed.
+    std::shared_ptr<const StaticResponse> Lookup(const std::string& path);
+    void GetStats(CacheStats* stats);
+    // Appends the cached paths, most recently used first.
+    void HotKeys(std::vector<std::string>* paths);
+
+  private:
+    struct ResponseWeigher {
+      size_t operator()(const std::string& path, const std::shared_ptr<const StaticResponse>& res) const {
+        return HeapSize<std::string>::Of(path) + sizeof(StaticResponse) +
+               res->header.Size() + res->not_modified.Size() + res->body.Size();
+      }
+    };
+    typedef LRUCache<std::string, std::shared_ptr<const StaticResponse>,
+                     LRUPolicy<std::string>, ResponseWeigher> ResponseCache;
+
+    bool Allowed(const std::string& path);
+    int Load(const std::string& path, std::shared_ptr<const StaticResponse>* res);
+    void Invalidate(const std::string& path);
+    static void* WatchLoop(void* arg);
+    void AddWatch(const std::string& rel);
+
+    std::string dir_;
+    int max_age_;
+    std::vector<std::string> excluded_;
+    ResponseCache cache_;
+    // Responses for files over an eighth of cache_, keyed by device, inode,
+    // modification time and size. An edited file gets a new key, and its
+    // old entry ages out.
+    ResponseCache large_files_;
+    SingleFlight<std::string, std::shared_ptr<const StaticResponse> > flights_;
+    // Bumped by every invalidation, so a load that raced with one is dropped.
+    std::atomic<uint64_t> generation_;
+    int inotify_fd_;
+    // inotify watch descriptor -> directory relative to dir_
+    std::unordered_map<int, std::string> watches_;
+    pthread_t watcher_;
+    volatile bool watching_;
+};
+
+} // namespace Cerver
+
+#endif
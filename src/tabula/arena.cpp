@@ -0,0 +1,81 @@
+#include <new>
+#include "arena.h"
+
+namespace KVStore {
+
+static const size_t kAlign = alignof(max_align_t);
+
+static size_t AlignUp(size_t n) {
+  return (n + kAlign - 1) & ~(kAlign - 1);
+}
+
+Arena::Arena() : large_(nullptr), memory_usage_(0) {
+  pthread_mutex_init(&lock_, nullptr);
+  current_ = NewBlock(ARENA_BLOCK_SIZE);
+}
+
+Arena::~Arena() {
+  Block* lists[] = {current_.load(), large_};
+  for (Block* block : lists) {
+    while (block != nullptr) {
+      Block* prev = block->prev;
+      block->~Block();
+      ::operator delete(block);
+      block = prev;
+    }
+  }
+  pthread_mutex_destroy(&lock_);
+}
+
+Arena::Block* Arena::NewBlock(size_t size) {
+  void* mem = ::operator new(AlignUp(sizeof(Block)) + size);
+  Block* block = new (mem) Block();
+  block->prev = nullptr;
+  block->size = size;
+  block->used = 0;
+  memory_usage_ += AlignUp(sizeof(Block)) + size;
+  return block;
+}
+
+char* Arena::Memory(Block* block) {
+  return reinterpret_cast<char*>(block) + AlignUp(sizeof(Block));
+}
+
+char* Arena::Allocate(size_t bytes) {
+  bytes = AlignUp(bytes == 0 ? 1 : bytes);
+  if (bytes > ARENA_BLOCK_SIZE / 4) {
+    // Would waste too much of a shared block.
+    Block* block = NewBlock(bytes);
+    block->used = bytes;
+    pthread_mutex_lock(&lock_);
+    block->prev = large_;
+    large_ = block;
+    pthread_mutex_unlock(&lock_);
+    return Memory(block);
+  }
+  while (true) {
+    Block* block = current_.load(std::memory_order_acquire);
+    size_t offset = block->used.fetch_add(bytes, std::memory_order_relaxed);
+    if (offset + bytes <= block->size) {
+      return Memory(block) + offset;
+    }
+    // Full. Whoever gets the lock first chains a new block; the others
+    // find it installed and retry.
+    pthread_mutex_lock(&lock_);
+    if (current_.load(std::memory_order_relaxed) == block) {
+      Block* next = NewBlock(ARENA_BLOCK_SIZE);
+      next->prev = block;
+      current_.store(next, std::memory_order_release);
+    }
+    pthread_mutex_unlock(&lock_);
+  }
+}
+
+size_t Arena::MemoryUsage() const {
+  Block* block = current_.load(std::memory_order_acquire);
+  size_t used = block->used.load(std::memory_order_relaxed);
+  size_t unused = used < block->size ? block->size - used : 0;
+  return memory_usage_.load(std::memory_order_relaxed) - unused;
+}
+
+} // namespace KVStore
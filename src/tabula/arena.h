@@ -0,0 +1,48 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#define ARENA_BLOCK_SIZE 4096 * 16 // 64 KB
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace KVStore {
+
+// Bump-pointer allocator. Memory is handed out from large blocks and never
+// freed individually; everything goes at once when the arena is destroyed.
+//
+// Allocate is safe to call from many threads: the common case is one
+// fetch_add on the current block, and only the thread that runs a block out
+// takes a lock to chain a new one.
+class Arena {
+  public:
+    Arena();
+    ~Arena();
+    // Returns [bytes] of memory aligned for any scalar type.
+    char* Allocate(size_t bytes);
+    // Bytes of all blocks, less what the current one has yet to hand out.
+    // Tails left in earlier blocks count.
+    size_t MemoryUsage() const;
+
+  private:
+    struct Block {
+      Block* prev;
+      size_t size;
+      std::atomic<size_t> used;
+      // Followed by the block's memory
+    };
+    Block* NewBlock(size_t size);
+    static char* Memory(Block* block);
+
+    std::atomic<Block*> current_;
+    // Allocations too large for a block each get their own, kept here.
+    Block* large_;
+    pthread_mutex_t lock_;
+    std::atomic<size_t> memory_usage_;
+};
+
+} // namespace KVStore
+
+#endif
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <string.h>
+#include "block.h"
+
+using std::string;
+
+namespace KVStore {
+
+static void PutVarint32(string* out, uint32_t n) {
+  while (n >= 0x80) {
+    out->push_back(static_cast<char>(n | 0x80));
+    n >>= 7;
+  }
+  out->push_back(static_cast<char>(n));
+}
+
+// Decodes a varint from [p], not reading at or past [limit]. Returns the
+// byte after it, or nullptr if it runs over.
+static const char* GetVarint32(const char* p, const char* limit, uint32_t* n) {
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift <= 28 && p < limit; shift += 7) {
+    uint32_t byte = static_cast<unsigned char>(*p++);
+    result |= (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *n = result;
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+BlockBuilder::BlockBuilder(uint32_t restartInterval)
+  : restartInterval_(restartInterval < 1 ? 1 : restartInterval), counter_(0) {
+  restarts_.push_back(0);
+}
+
+void BlockBuilder::Add(const string& key, const string& val) {
+  size_t shared = 0;
+  if (counter_ < restartInterval_) {
+    size_t limit = std::min(lastKey_.length(), key.length());
+    while (shared < limit && lastKey_[shared] == key[shared]) {
+      shared++;
+    }
+  } else {
+    restarts_.push_back(buffer_.length());
+    counter_ = 0;
+  }
+  PutVarint32(&buffer_, shared);
+  PutVarint32(&buffer_, key.length() - shared);
+  PutVarint32(&buffer_, val.length());
+  buffer_.append(key, shared, string::npos);
+  buffer_ += val;
+  lastKey_ = key;
+  counter_++;
+}
+
+const string& BlockBuilder::Finish() {
+  for (uint32_t restart : restarts_) {
+    buffer_.append(reinterpret_cast<const char*>(&restart), sizeof(restart));
+  }
+  uint32_t numRestarts = restarts_.size();
+  buffer_.append(reinterpret_cast<const char*>(&numRestarts), sizeof(numRestarts));
+  return buffer_;
+}
+
+void BlockBuilder::Reset() {
+  buffer_.clear();
+  restarts_.clear();
+  restarts_.push_back(0);
+  counter_ = 0;
+  lastKey_.clear();
+}
+
+size_t BlockBuilder::CurrentSize() const {
+  return buffer_.length() + (restarts_.size() + 1) * sizeof(uint32_t);
+}
+
+bool BlockBuilder::Empty() const {
+  return buffer_.empty();
+}
+
+const string& BlockBuilder::LastKey() const {
+  return lastKey_;
+}
+
+Block::Block(const Utils::SharedBuffer& contents)
+  : contents_(contents), restartsOffset_(0), numRestarts_(0) {
+  size_t size = contents.Size();
+  if (size < sizeof(uint32_t)) {
+    return;
+  }
+  uint32_t numRestarts;
+  memcpy(&numRestarts, contents.Data() + size - sizeof(uint32_t), sizeof(numRestarts));
+  if (numRestarts == 0 || numRestarts > (size - sizeof(uint32_t)) / sizeof(uint32_t)) {
+    return;
+  }
+  numRestarts_ = numRestarts;
+  restartsOffset_ = size - (numRestarts + 1) * sizeof(uint32_t);
+}
+
+size_t Block::Size() const {
+  return contents_.Size();
+}
+
+uint32_t Block::RestartPoint(uint32_t restart) const {
+  uint32_t offset;
+  memcpy(&offset, contents_.Data() + restartsOffset_ + restart * sizeof(uint32_t), sizeof(offset));
+  return offset;
+}
+
+Block::Iterator::Iterator(const Block* block)
+  : block_(block), next_(0), valOffset_(0), valLen_(0), valid_(false) {}
+
+bool Block::Iterator::Valid() const {
+  return valid_;
+}
+
+bool Block::Iterator::ParseEntry(uint32_t offset) {
+  valid_ = false;
+  const char* data = block_->contents_.Data();
+  const char* limit = data + block_->restartsOffset_;
+  const char* p = data + offset;
+  if (offset >= block_->restartsOffset_) {
+    return false;
+  }
+  uint32_t shared, unshared, valLen;
+  if ((p = GetVarint32(p, limit, &shared)) == nullptr ||
+      (p = GetVarint32(p, limit, &unshared)) == nullptr ||
+      (p = GetVarint32(p, limit, &valLen)) == nullptr) {
+    return false;
+  }
+  if (shared > key_.length() || static_cast<uint64_t>(unshared) + valLen > static_cast<uint64_t>(limit - p)) {
+    return false;
+  }
+  key_.resize(shared);
+  key_.append(p, unshared);
+  valOffset_ = p + unshared - data;
+  valLen_ = valLen;
+  next_ = valOffset_ + valLen;
+  valid_ = true;
+  return true;
+}
+
+void Block::Iterator::SeekToRestart(uint32_t restart) {
+  key_.clear();
+  ParseEntry(block_->RestartPoint(restart));
+}
+
+void Block::Iterator::SeekToFirst() {
+  if (block_->numRestarts_ == 0) {
+    valid_ = false;
+    return;
+  }
+  SeekToRestart(0);
+}
+
+int Block::Iterator::CompareRestartKey(uint32_t restart, const string& target, bool* ok) const {
+  const char* data = block_->contents_.Data();
+  const char* limit = data + block_->restartsOffset_;
+  uint32_t offset = block_->RestartPoint(restart);
+  const char* p = data + offset;
+  uint32_t shared, unshared, valLen;
+  if (offset >= block_->restartsOffset_ ||
+      (p = GetVarint32(p, limit, &shared)) == nullptr ||
+      (p = GetVarint32(p, limit, &unshared)) == nullptr ||
+      (p = GetVarint32(p, limit, &valLen)) == nullptr ||
+      shared != 0 || unshared > static_cast<uint32_t>(limit - p)) {
+    *ok = false;
+    return 0;
+  }
+  int cmp = memcmp(p, target.data(), std::min<size_t>(unshared, target.length()));
+  if (cmp == 0) {
+    cmp = unshared < target.length() ? -1 : unshared > target.length() ? 1 : 0;
+  }
+  return cmp;
+}
+
+void Block::Iterator::Seek(const string& target) {
+  if (block_->numRestarts_ == 0) {
+    valid_ = false;
+    return;
+  }
+  uint32_t left = 0;
+  uint32_t right = block_->numRestarts_ - 1;
+  while (left < right) {
+    uint32_t mid = (left + right + 1) / 2;
+    bool ok = true;
+    int cmp = CompareRestartKey(mid, target, &ok);
+    if (!ok) {
+      valid_ = false;
+      return;
+    }
+    if (cmp <= 0) {
+      left = mid;
+    } else {
+      right = mid - 1;
+    }
+  }
+  SeekToRestart(left);
+  while (valid_ && key_.compare(target) < 0) {
+    Next();
+  }
+}
+
+void Block::Iterator::Next() {
+  ParseEntry(next_);
+}
+
+const string& Block::Iterator::Key() const {
+  return key_;
+}
+
+Utils::SharedBuffer Block::Iterator::Value() const {
+  return block_->contents_.Slice(valOffset_, valLen_);
+}
+
+} // namespace KVStore
@@ -0,0 +1,102 @@
+#ifndef BLOCK_H_
+#define BLOCK_H_
+// Entries between restart points, which store their whole key
+#define BLOCK_DEFAULT_RESTART_INTERVAL 16
+
+#include <string>
+#include <vector>
+#include "../sharedbuffer.h"
+
+namespace KVStore {
+
+/*
+ A block holds entries sorted by key. Each entry stores only the part of its
+ key that differs from the key before it:
+
+ shared key length   (varint)
+ unshared key length (varint)
+ value length        (varint)
+ unshared key bytes
+ value
+
+ Every restartInterval-th entry is a restart point and shares nothing, so a
+ lookup can binary search the restart points and decode from there. The
+ entries are followed by:
+
+ restart offsets (4 bytes each)
+ restart count   (4 bytes)
+ */
+
+class BlockBuilder {
+public:
+  explicit BlockBuilder(uint32_t restartInterval);
+  // Keys must be added in increasing order.
+  void Add(const std::string& key, const std::string& val);
+  // Appends the restart points and returns the block, which stays valid
+  // until Reset.
+  const std::string& Finish();
+  void Reset();
+  // Size of the block if it were finished now.
+  size_t CurrentSize() const;
+  bool Empty() const;
+  const std::string& LastKey() const;
+
+private:
+  uint32_t restartInterval_;
+  std::string buffer_;
+  std::vector<uint32_t> restarts_;
+  uint32_t counter_;
+  std::string lastKey_;
+};
+
+class Block {
+public:
+  // [contents] is the block as BlockBuilder made it. A malformed block
+  // reads as empty.
+  explicit Block(const Utils::SharedBuffer& contents);
+  size_t Size() const;
+
+  class Iterator {
+  public:
+    explicit Iterator(const Block* block);
+    bool Valid() const;
+    void SeekToFirst();
+    // Moves to the first entry whose key is at or after [target]: a binary
+    // search for the last restart point at or before it, then a scan of at
+    // most one restart interval.
+    void Seek(const std::string& target);
+    void Next();
+    const std::string& Key() const;
+    // Shares the block's bytes.
+    Utils::SharedBuffer Value() const;
+
+  private:
+    // Decodes the entry at [offset] on top of key_; false past the end or
+    // on a corrupt entry.
+    bool ParseEntry(uint32_t offset);
+    void SeekToRestart(uint32_t restart);
+    // Compares the key at [restart], which is stored whole, with [target]
+    // in place. Sets [ok] to false on a corrupt entry.
+    int CompareRestartKey(uint32_t restart, const std::string& target, bool* ok) const;
+
+    const Block* block_;
+    // The entry after the current one
+    uint32_t next_;
+    std::string key_;
+    uint32_t valOffset_;
+    uint32_t valLen_;
+    bool valid_;
+  };
+
+private:
+  uint32_t RestartPoint(uint32_t restart) const;
+
+  Utils::SharedBuffer contents_;
+  // Entries end where the restart offsets begin.
+  uint32_t restartsOffset_;
+  uint32_t numRestarts_;
+};
+
+} // namespace KVStore
+
+#endif
@@ -0,0 +1,91 @@
+#include <math.h>
+#include <algorithm>
+#include "bloomfilter.h"
+
+using std::string;
+
+namespace KVStore {
+
+static uint32_t NumProbes(uint32_t bitsPerKey) {
+  // bitsPerKey * ln(2) minimizes the false positive rate.
+  uint32_t probes = static_cast<uint32_t>(bitsPerKey * 0.69 + 0.5);
+  return std::min(std::max(probes, 1u), 30u);
+}
+
+uint64_t BloomFilter::Hash(const string& key) {
+  // FNV-1a, then a finalizer so both halves are well mixed.
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (unsigned char c : key) {
+    h = (h ^ c) * 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+void BloomFilter::Build(const std::vector<uint64_t>& hashes, uint32_t bitsPerKey, string* out) {
+  // Tiny filters have a high false positive rate; give them a floor.
+  uint64_t bits = std::max<uint64_t>(hashes.size() * bitsPerKey, 64);
+  uint64_t bytes = (bits + 7) / 8;
+  bits = bytes * 8;
+  uint32_t probes = NumProbes(bitsPerKey);
+  size_t start = out->length();
+  out->resize(start + bytes, '\0');
+  char* array = &(*out)[start];
+  for (uint64_t hash : hashes) {
+    uint32_t h = static_cast<uint32_t>(hash);
+    uint32_t delta = static_cast<uint32_t>(hash >> 32) | 1;
+    for (uint32_t i = 0; i < probes; i++) {
+      uint64_t bit = h % bits;
+      array[bit / 8] |= 1 << (bit % 8);
+      h += delta;
+    }
+  }
+  out->push_back(static_cast<char>(probes));
+}
+
+bool BloomFilter::MayMatch(const string& key, const char* filter, size_t len) {
+  if (len < 2) {
+    return true;
+  }
+  uint64_t bits = (len - 1) * 8;
+  uint32_t probes = static_cast<unsigned char>(filter[len - 1]);
+  if (probes == 0 || probes > 30) {
+    // Not a filter this code wrote; don't rule anything out.
+    return true;
+  }
+  uint64_t hash = Hash(key);
+  uint32_t h = static_cast<uint32_t>(hash);
+  uint32_t delta = static_cast<uint32_t>(hash >> 32) | 1;
+  for (uint32_t i = 0; i < probes; i++) {
+    uint64_t bit = h % bits;
+    if ((filter[bit / 8] & (1 << (bit % 8))) == 0) {
+      return false;
+    }
+    h += delta;
+  }
+  return true;
+}
+
+double BloomFilter::FalsePositiveRate(uint32_t bitsPerKey) {
+  if (bitsPerKey == 0) {
+    return 1;
+  }
+  double probes = NumProbes(bitsPerKey);
+  return pow(1 - exp(-probes / bitsPerKey), probes);
+}
+
+uint32_t BloomFilter::BitsPerKey(double rate) {
+  if (rate >= 1) {
+    return 0;
+  }
+  if (rate <= 0) {
+    rate = 1e-9;
+  }
+  return static_cast<uint32_t>(ceil(-log(rate) / (M_LN2 * M_LN2)));
+}
+
+} // namespace KVStore
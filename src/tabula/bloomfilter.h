@@ -0,0 +1,29 @@
+#ifndef BLOOM_FILTER_H_
+#define BLOOM_FILTER_H_
+// About a 1% false positive rate
+#define BLOOM_FILTER_DEFAULT_BITS_PER_KEY 10
+
+#include <string>
+#include <vector>
+
+namespace KVStore {
+
+// A Bloom filter over a set of keys: the bit array, then one byte holding
+// the number of probes. A key is probed with double hashing of one 64-bit
+// hash, so builders only have to keep the hashes.
+class BloomFilter {
+public:
+  static uint64_t Hash(const std::string& key);
+  // Appends the filter for [hashes] to [out].
+  static void Build(const std::vector<uint64_t>& hashes, uint32_t bitsPerKey, std::string* out);
+  // False means [key] is certainly not in the set.
+  static bool MayMatch(const std::string& key, const char* filter, size_t len);
+  // The false positive rate to expect with [bitsPerKey], and the bits per key
+  // that get [rate].
+  static double FalsePositiveRate(uint32_t bitsPerKey);
+  static uint32_t BitsPerKey(double rate);
+};
+
+} // namespace KVStore
+
+#endif
@@ -1,117 +1,684 @@
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
 #include <iostream>
 #include <string.h>
 #include <vector>
+#include <algorithm>
+#include <atomic>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include "commitlog.h"
+#include "crc32c.h"
+#include "../sharedbuffer.h"
 
 using std::string;
 using std::vector;
 
 namespace KVStore {
 
+static const size_t kSegmentHeaderLength = 16;
+static const size_t kRecordHeaderLength = 28;
+
+struct CommitLog::Segment {
+  struct Record {
+    uint32_t operation;
+    const char* row;
+    uint32_t rowLen;
+    uint32_t colLen;
+    uint32_t valLen;
+  };
+  uint32_t number;
+  std::string path;
+  Utils::SharedBuffer file;
+  bool valid;
+  uint64_t firstSeq;
+  // The intact records, up to the first bad one
+  std::vector<Record> records;
+};
+
+struct CommitLog::DecodeWork {
+  std::vector<Segment>* segments;
+  std::atomic<size_t> next;
+};
+
+static uint32_t ReadU32(const char* p) {
+  uint32_t n;
+  memcpy(&n, p, sizeof(n));
+  return n;
+}
+
+static uint64_t ReadU64(const char* p) {
+  uint64_t n;
+  memcpy(&n, p, sizeof(n));
+  return n;
+}
+
+// Records are checksummed together with their segment's number, so a record
+// left behind in a reused file never passes for a current one.
+static uint32_t SegmentSeed(uint32_t segment) {
+  return Crc32c(reinterpret_cast<const char*>(&segment), sizeof(segment));
+}
+
+static int64_t ElapsedMs(const struct timespec& from, const struct timespec& to) {
+  return (to.tv_sec - from.tv_sec) * 1000 + (to.tv_nsec - from.tv_nsec) / 1000000;
+}
+
+static void AddMs(struct timespec* ts, int64_t ms) {
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (ms % 1000) * 1000000;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
 CommitLog::CommitLog(
-  const std::string& tableName, 
+  const std::string& tableName,
   const std::string& storeDir
-) : storeDir_(storeDir) {
+) : tableName_(tableName),
+    storeDir_(storeDir),
+    logfd_(-1),
+    segment_(0),
+    offset_(0),
+    nextSegment_(1),
+    replayed_(false),
+    durability_(COMMIT_LOG_SYNC_NONE),
+    syncIntervalMs_(COMMIT_LOG_DEFAULT_SYNC_INTERVAL_MS),
+    syncing_(false),
+    groupBytes_(0),
+    groupFirstSeq_(1),
+    nextSeq_(1),
+    nextGroup_(1),
+    writtenGroup_(0),
+    writing_(false),
+    failed_(false),
+    unsynced_(false),
+    stats_({0, 0, 0, 0, 0}) {
+  pthread_mutex_init(&lock_, nullptr);
+  pthread_cond_init(&written_, nullptr);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&syncCond_, &attr);
+  pthread_condattr_destroy(&attr);
+  clock_gettime(CLOCK_MONOTONIC, &lastSync_);
   mkdir(storeDir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-  string path = storeDir + "/" + tableName + COMMMIT_LOG_FILE_EXT;
-  logfd_ = open(path.c_str(), O_RDWR | O_CREAT, S_IRWXO | S_IRWXG | S_IRWXU);
+  // Find the segments and free files left by an earlier run.
+  string prefix = tableName + "-";
+  DIR* dir = opendir(storeDir.c_str());
+  struct dirent* entry;
+  while (dir != nullptr && (entry = readdir(dir)) != nullptr) {
+    string name = entry->d_name;
+    if (name.compare(0, prefix.length(), prefix) != 0) {
+      continue;
+    }
+    size_t dot = name.find('.', prefix.length());
+    if (dot == string::npos || dot == prefix.length()) {
+      continue;
+    }
+    string number = name.substr(prefix.length(), dot - prefix.length());
+    if (number.find_first_not_of("0123456789") != string::npos) {
+      continue;
+    }
+    string ext = name.substr(dot);
+    if (ext == COMMMIT_LOG_FILE_EXT) {
+      segments_.push_back(strtoul(number.c_str(), nullptr, 10));
+    } else if (ext == string(COMMMIT_LOG_FILE_EXT) + COMMIT_LOG_FREE_FILE_EXT) {
+      free_.push_back(storeDir + "/" + name);
+    }
+  }
+  if (dir != nullptr) {
+    closedir(dir);
+  }
+  std::sort(segments_.begin(), segments_.end());
+  if (!segments_.empty()) {
+    nextSegment_ = segments_.back() + 1;
+  }
+  replayed_ = segments_.empty();
 }
 
-CommitLog::CommitLog(
-  const char* dir,
-  char* logName
-) {
-  string path = string(dir) + "/" + string(logName);
-  logfd_ = open(path.c_str(), O_RDWR | O_APPEND);
+CommitLog::~CommitLog() {
+  pthread_mutex_lock(&lock_);
+  bool syncing = syncing_;
+  syncing_ = false;
+  pthread_cond_broadcast(&syncCond_);
+  pthread_mutex_unlock(&lock_);
+  if (syncing) {
+    pthread_join(syncer_, nullptr);
+  }
+  if (unsynced_) {
+    // Whatever the interval left behind.
+    fdatasync(logfd_);
+  }
+  if (logfd_ != -1) {
+    close(logfd_);
+  }
+  pthread_cond_destroy(&syncCond_);
+  pthread_cond_destroy(&written_);
+  pthread_mutex_destroy(&lock_);
 }
 
-CommitLog::~CommitLog() {
-  close(logfd_);
+void CommitLog::SetDurability(int mode, uint32_t intervalMs) {
+  pthread_mutex_lock(&lock_);
+  durability_ = mode;
+  syncIntervalMs_ = intervalMs;
+  // Once running, the syncer stays; it has nothing to do in other modes.
+  if (mode == COMMIT_LOG_SYNC_INTERVAL && !syncing_) {
+    syncing_ = pthread_create(&syncer_, nullptr, &CommitLog::SyncLoop, this) == 0;
+  }
+  pthread_cond_broadcast(&syncCond_);
+  pthread_mutex_unlock(&lock_);
+}
+
+void* CommitLog::SyncLoop(void* arg) {
+  CommitLog* log = static_cast<CommitLog*>(arg);
+  pthread_mutex_lock(&log->lock_);
+  while (log->syncing_) {
+    // Wake when the interval since the last sync runs out, or a full
+    // interval from now if it already has.
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    int64_t elapsedMs = ElapsedMs(log->lastSync_, deadline);
+    AddMs(&deadline, elapsedMs < log->syncIntervalMs_ ? log->syncIntervalMs_ - elapsedMs : log->syncIntervalMs_);
+    pthread_cond_timedwait(&log->syncCond_, &log->lock_, &deadline);
+    // A leader in flight syncs its own group if the interval is up.
+    if (!log->syncing_ || !log->unsynced_ || log->writing_ || !log->SyncDue()) {
+      continue;
+    }
+    // Hold off group writes like a leader would, so the segment stays put.
+    log->writing_ = true;
+    log->unsynced_ = false;
+    int fd = log->logfd_;
+    pthread_mutex_unlock(&log->lock_);
+    int ret = fdatasync(fd);
+    pthread_mutex_lock(&log->lock_);
+    if (ret == 0) {
+      clock_gettime(CLOCK_MONOTONIC, &log->lastSync_);
+      log->stats_.syncs++;
+    } else {
+      log->failed_ = true;
+    }
+    log->writing_ = false;
+    pthread_cond_broadcast(&log->written_);
+  }
+  pthread_mutex_unlock(&log->lock_);
+  return nullptr;
 }
 
 int CommitLog::LogPut(
-  const std::string& row, 
-  const std::string& col, 
+  const std::string& row,
+  const std::string& col,
   const std::string& val
 ) {
-	CommitMetaData metadata;
-	metadata.rowLen = row.length();
-	metadata.colLen = col.length();
-	metadata.operation = PUT;
-	metadata.valLen = val.length();
-  string content = row + col + val;
-	write(logfd_, &metadata, sizeof(metadata));
-	write(logfd_, content.c_str(), content.length());
-	return SUCCESS;
+  return Commit(AppendPut(row, col, val));
+}
+
+int CommitLog::LogPutBatch(const std::vector<Mutation>& batch) {
+  return Commit(AppendPutBatch(batch));
 }
 
 int CommitLog::LogDelete(
   const std::string &row,
   const std::string &col
 ) {
-	CommitMetaData metadata;
-	metadata.rowLen = row.length();
-	metadata.colLen = col.length();
-	metadata.operation = DELETE;
-	metadata.valLen = 6;
-	string content = row + col + "DELETE";
-	write(logfd_, &metadata, sizeof(metadata));
-  write(logfd_, content.c_str(), content.length());
-	return SUCCESS;
-}
-
-int CommitLog::ReadNextCommit(
-  string* row,
-  string* col, 
-  string* val
+  return Commit(AppendDelete(row, col));
+}
+
+uint64_t CommitLog::AppendPut(
+  const std::string& row,
+  const std::string& col,
+  const std::string& val
 ) {
-  CommitMetaData metadata;                            
-  ssize_t bytesRead = read(logfd_, &metadata, sizeof(metadata));
-	if (bytesRead < sizeof(metadata) || bytesRead <= 0) {
-		return -1;
-	}
-  vector<char> buf = vector<char>(metadata.rowLen);
-  bytesRead = read(logfd_, buf.data(), metadata.rowLen);
-  if (bytesRead < metadata.rowLen) {
-		return -1;
-	}
-  *row = string(buf.data(), metadata.rowLen);
-  buf = vector<char>(metadata.colLen);
-  bytesRead = read(logfd_, buf.data(), metadata.colLen);
-  if (bytesRead < metadata.colLen) {
-		return -1;
-	}
-  *col = string(buf.data(), metadata.colLen);
-  buf = vector<char>(metadata.valLen);
-  bytesRead = read(logfd_, buf.data(), metadata.valLen);
-  if (bytesRead < metadata.valLen) {
-	  return -1;
-  }
-  *val = string(buf.data(), metadata.valLen);
-  return metadata.operation;
+  pthread_mutex_lock(&lock_);
+  AppendRecord(PUT, row, col, val.data(), val.length());
+  uint64_t ticket = nextGroup_;
+  pthread_mutex_unlock(&lock_);
+  return ticket;
 }
 
-void CommitLog::Replay(MemTable* memtable) {
-  while (true) {
-    string row;
-    string col;
-    string val;
-    int op = ReadNextCommit(&row, &col, &val);
-    if (op == PUT) {
-      memtable->Put(row, col, val);
-    } else if (op == DELETE) {
-      memtable->Delete(row, col);
-    } else {
+uint64_t CommitLog::AppendPutBatch(const std::vector<Mutation>& batch) {
+  pthread_mutex_lock(&lock_);
+  for (const Mutation& mutation : batch) {
+    AppendRecord(PUT, mutation.row, mutation.col, mutation.val.data(), mutation.val.length());
+  }
+  uint64_t ticket = nextGroup_;
+  pthread_mutex_unlock(&lock_);
+  return ticket;
+}
+
+uint64_t CommitLog::AppendDelete(
+  const std::string& row,
+  const std::string& col
+) {
+  pthread_mutex_lock(&lock_);
+  AppendRecord(DELETE, row, col, "", 0);
+  uint64_t ticket = nextGroup_;
+  pthread_mutex_unlock(&lock_);
+  return ticket;
+}
+
+void CommitLog::AppendBytes(const char* data, size_t len) {
+  if (!pieces_.empty() && pieces_.back().data == nullptr) {
+    // Extend the buffered piece rather than starting another.
+    pieces_.back().len += len;
+  } else {
+    pieces_.push_back({nullptr, buffer_.length(), len});
+  }
+  buffer_.append(data, len);
+}
+
+void CommitLog::AppendRecord(
+  uint32_t operation,
+  const std::string& row,
+  const std::string& col,
+  const char* val,
+  size_t valLen
+) {
+  EnsureSegment();
+  if (records_.empty()) {
+    groupFirstSeq_ = nextSeq_;
+  }
+  uint64_t seq = nextSeq_++;
+  uint32_t rowLen = row.length();
+  uint32_t colLen = col.length();
+  uint32_t valLen32 = valLen;
+  // The checksum is filled in by the leader, once the segment is known.
+  char header[kRecordHeaderLength] = {0};
+  memcpy(header + 4, &operation, 4);
+  memcpy(header + 8, &seq, 8);
+  memcpy(header + 16, &rowLen, 4);
+  memcpy(header + 20, &colLen, 4);
+  memcpy(header + 24, &valLen32, 4);
+  PendingRecord record = {buffer_.length(), rowLen + colLen, nullptr, valLen};
+  AppendBytes(header, kRecordHeaderLength);
+  AppendBytes(row.data(), row.length());
+  AppendBytes(col.data(), col.length());
+  if (valLen >= COMMIT_LOG_COPY_LIMIT) {
+    pieces_.push_back({val, 0, valLen});
+    record.val = val;
+  } else {
+    AppendBytes(val, valLen);
+    record.inlineLen += valLen;
+  }
+  records_.push_back(record);
+  groupBytes_ += kRecordHeaderLength + rowLen + colLen + valLen;
+  stats_.records++;
+}
+
+int CommitLog::Commit(uint64_t ticket) {
+  pthread_mutex_lock(&lock_);
+  while (writtenGroup_ < ticket) {
+    if (writing_) {
+      pthread_cond_wait(&written_, &lock_);
+      continue;
+    }
+    // Lead: take the pending group and write it without the lock, so the
+    // next group can fill up meanwhile.
+    writing_ = true;
+    uint64_t group = nextGroup_++;
+    string buffer;
+    vector<Piece> pieces;
+    vector<PendingRecord> records;
+    buffer.swap(buffer_);
+    pieces.swap(pieces_);
+    records.swap(records_);
+    uint64_t bytes = groupBytes_;
+    groupBytes_ = 0;
+    int ret = 0;
+    if (offset_ > kSegmentHeaderLength && offset_ + bytes > COMMIT_LOG_SEGMENT_SIZE) {
+      ret = NewSegment(groupFirstSeq_);
+    }
+    int fd = logfd_;
+    uint32_t segment = segment_;
+    uint64_t offset = offset_;
+    if (ret == 0) {
+      // A group that never went out leaves the segment where it was.
+      offset_ += bytes;
+    }
+    pthread_mutex_unlock(&lock_);
+    bool sync = false;
+    if (ret == 0) {
+      SealRecords(&buffer, records, segment);
+      ret = WriteGroup(fd, offset, buffer, pieces);
+    }
+    if (ret == 0) {
+      pthread_mutex_lock(&lock_);
+      sync = SyncDue();
+      pthread_mutex_unlock(&lock_);
+      if (sync && fdatasync(fd) == -1) {
+        ret = -1;
+      }
+    }
+    pthread_mutex_lock(&lock_);
+    if (sync) {
+      clock_gettime(CLOCK_MONOTONIC, &lastSync_);
+      stats_.syncs++;
+    }
+    unsynced_ = !sync && durability_ != COMMIT_LOG_SYNC_NONE;
+    failed_ = failed_ || ret == -1;
+    stats_.groups++;
+    writtenGroup_ = group;
+    writing_ = false;
+    pthread_cond_broadcast(&written_);
+  }
+  int ret = failed_ ? -1 : SUCCESS;
+  pthread_mutex_unlock(&lock_);
+  return ret;
+}
+
+void CommitLog::SealRecords(string* buffer, const vector<PendingRecord>& records, uint32_t segment) {
+  uint32_t seed = SegmentSeed(segment);
+  char* data = &(*buffer)[0];
+  for (const PendingRecord& record : records) {
+    char* header = data + record.header;
+    uint32_t crc = Crc32cExtend(seed, header + 4, kRecordHeaderLength - 4 + record.inlineLen);
+    if (record.val != nullptr) {
+      crc = Crc32cExtend(crc, record.val, record.valLen);
+    }
+    memcpy(header, &crc, sizeof(crc));
+  }
+}
+
+int CommitLog::WriteGroup(int fd, uint64_t offset, const string& buffer, const vector<Piece>& pieces) {
+  vector<struct iovec> iov;
+  iov.reserve(pieces.size());
+  for (const Piece& piece : pieces) {
+    const char* data = piece.data == nullptr ? buffer.data() + piece.offset : piece.data;
+    iov.push_back({const_cast<char*>(data), piece.len});
+  }
+  size_t next = 0;
+  while (next < iov.size()) {
+    int count = static_cast<int>(std::min(iov.size() - next, static_cast<size_t>(IOV_MAX)));
+    ssize_t written = pwritev(fd, &iov[next], count, offset);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    offset += written;
+    // Skip what went out; a short write leaves the rest of a piece.
+    while (next < iov.size() && static_cast<size_t>(written) >= iov[next].iov_len) {
+      written -= iov[next].iov_len;
+      next++;
+    }
+    if (written > 0) {
+      iov[next].iov_base = static_cast<char*>(iov[next].iov_base) + written;
+      iov[next].iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+bool CommitLog::SyncDue() {
+  if (durability_ == COMMIT_LOG_SYNC_BATCH) {
+    return true;
+  }
+  if (durability_ != COMMIT_LOG_SYNC_INTERVAL) {
+    return false;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ElapsedMs(lastSync_, now) >= syncIntervalMs_;
+}
+
+string CommitLog::SegmentPath(uint32_t segment) {
+  char number[16];
+  snprintf(number, sizeof(number), "%010u", segment);
+  return storeDir_ + "/" + tableName_ + "-" + number + COMMMIT_LOG_FILE_EXT;
+}
+
+int CommitLog::NewSegment(uint64_t firstSeq) {
+  uint32_t number = nextSegment_++;
+  string path = SegmentPath(number);
+  int fd = -1;
+  while (fd == -1 && !free_.empty()) {
+    // Reusing a file skips allocating its blocks again. Its old records
+    // fail their checksums under the new number.
+    string freePath = free_.back();
+    free_.pop_back();
+    if (rename(freePath.c_str(), path.c_str()) == 0) {
+      fd = open(path.c_str(), O_WRONLY);
+      stats_.recycled++;
+    }
+  }
+  if (fd == -1) {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXO | S_IRWXG | S_IRWXU);
+  }
+  if (fd == -1) {
+    return -1;
+  }
+  char header[kSegmentHeaderLength];
+  uint32_t magic = COMMIT_LOG_MAGIC;
+  uint32_t version = COMMIT_LOG_VERSION;
+  memcpy(header, &magic, 4);
+  memcpy(header + 4, &version, 4);
+  memcpy(header + 8, &firstSeq, 8);
+  if (pwrite(fd, header, kSegmentHeaderLength, 0) != static_cast<ssize_t>(kSegmentHeaderLength)) {
+    close(fd);
+    unlink(path.c_str());
+    return -1;
+  }
+  if (logfd_ != -1) {
+    if (unsynced_) {
+      fdatasync(logfd_);
+      unsynced_ = false;
+    }
+    close(logfd_);
+  }
+  logfd_ = fd;
+  segment_ = number;
+  offset_ = kSegmentHeaderLength;
+  segments_.push_back(number);
+  stats_.segments++;
+  return 0;
+}
+
+void CommitLog::EnsureSegment() {
+  if (logfd_ != -1) {
+    return;
+  }
+  if (!replayed_) {
+    // Nobody wanted the old records.
+    ReleaseLocked(nextSegment_);
+    replayed_ = true;
+  }
+  NewSegment(nextSeq_);
+}
+
+uint32_t CommitLog::Roll() {
+  pthread_mutex_lock(&lock_);
+  uint64_t ticket = nextGroup_;
+  bool pending = !records_.empty();
+  pthread_mutex_unlock(&lock_);
+  if (pending) {
+    Commit(ticket);
+  }
+  pthread_mutex_lock(&lock_);
+  while (writing_) {
+    pthread_cond_wait(&written_, &lock_);
+  }
+  EnsureSegment();
+  if (offset_ > kSegmentHeaderLength) {
+    NewSegment(nextSeq_);
+  }
+  uint32_t segment = segment_;
+  pthread_mutex_unlock(&lock_);
+  return segment;
+}
+
+void CommitLog::Release(uint32_t segment) {
+  pthread_mutex_lock(&lock_);
+  ReleaseLocked(segment);
+  pthread_mutex_unlock(&lock_);
+}
+
+void CommitLog::ReleaseLocked(uint32_t segment) {
+  while (!segments_.empty() && segments_.front() < segment &&
+         (logfd_ == -1 || segments_.front() != segment_)) {
+    string path = SegmentPath(segments_.front());
+    segments_.pop_front();
+    if (free_.size() < COMMIT_LOG_RECYCLE_SEGMENTS) {
+      string freePath = path + COMMIT_LOG_FREE_FILE_EXT;
+      if (rename(path.c_str(), freePath.c_str()) == 0) {
+        free_.push_back(freePath);
+        continue;
+      }
+    }
+    unlink(path.c_str());
+  }
+}
+
+void CommitLog::Remove() {
+  pthread_mutex_lock(&lock_);
+  for (uint32_t segment : segments_) {
+    unlink(SegmentPath(segment).c_str());
+  }
+  for (const string& path : free_) {
+    unlink(path.c_str());
+  }
+  segments_.clear();
+  free_.clear();
+  if (logfd_ != -1) {
+    close(logfd_);
+    logfd_ = -1;
+  }
+  unsynced_ = false;
+  pthread_mutex_unlock(&lock_);
+}
+
+void CommitLog::GetStats(Stats* stats) {
+  pthread_mutex_lock(&lock_);
+  *stats = stats_;
+  pthread_mutex_unlock(&lock_);
+}
+
+void CommitLog::Decode(Segment* segment) {
+  segment->valid = false;
+  segment->file = Utils::SharedBuffer::MapFile(segment->path);
+  const char* data = segment->file.Data();
+  size_t size = segment->file.Size();
+  if (size < kSegmentHeaderLength || ReadU32(data) != COMMIT_LOG_MAGIC ||
+      ReadU32(data + 4) != COMMIT_LOG_VERSION) {
+    return;
+  }
+  segment->valid = true;
+  segment->firstSeq = ReadU64(data + 8);
+  uint32_t seed = SegmentSeed(segment->number);
+  uint64_t expected = segment->firstSeq;
+  size_t pos = kSegmentHeaderLength;
+  while (pos + kRecordHeaderLength <= size) {
+    const char* header = data + pos;
+    uint32_t operation = ReadU32(header + 4);
+    uint64_t seq = ReadU64(header + 8);
+    uint32_t rowLen = ReadU32(header + 16);
+    uint32_t colLen = ReadU32(header + 20);
+    uint32_t valLen = ReadU32(header + 24);
+    uint64_t len = static_cast<uint64_t>(rowLen) + colLen + valLen;
+    if (seq != expected || operation > DELETE || len > size - pos - kRecordHeaderLength) {
+      break;
+    }
+    if (Crc32cExtend(seed, header + 4, kRecordHeaderLength - 4 + len) != ReadU32(header)) {
       break;
     }
+    segment->records.push_back({operation, header + kRecordHeaderLength, rowLen, colLen, valLen});
+    expected++;
+    pos += kRecordHeaderLength + len;
   }
 }
 
-void CommitLog::Clear() {
-	ftruncate(logfd_, 0);
+void* CommitLog::DecodeThread(void* arg) {
+  DecodeWork* work = static_cast<DecodeWork*>(arg);
+  size_t i;
+  while ((i = work->next.fetch_add(1)) < work->segments->size()) {
+    Decode(&(*work->segments)[i]);
+  }
+  return nullptr;
+}
+
+uint64_t CommitLog::Replay(const ReplayCallback& callback) {
+  pthread_mutex_lock(&lock_);
+  if (replayed_) {
+    pthread_mutex_unlock(&lock_);
+    return 0;
+  }
+  vector<Segment> segments(segments_.size());
+  for (size_t i = 0; i < segments_.size(); i++) {
+    segments[i].number = segments_[i];
+    segments[i].path = SegmentPath(segments_[i]);
+  }
+  pthread_mutex_unlock(&lock_);
+
+  // Map and check the segments in parallel; applying them stays in order.
+  DecodeWork work;
+  work.segments = &segments;
+  work.next = 0;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t numThreads = std::min(segments.size(), static_cast<size_t>(cpus > 1 ? cpus : 1));
+  vector<pthread_t> threads;
+  for (size_t t = 1; t < numThreads; t++) {
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, &DecodeThread, &work) == 0) {
+      threads.push_back(thread);
+    }
+  }
+  DecodeThread(&work);
+  for (pthread_t thread : threads) {
+    pthread_join(thread, nullptr);
+  }
+
+  uint64_t count = 0;
+  uint64_t expected = 0;
+  size_t applied = 0;
+  for (; applied < segments.size(); applied++) {
+    const Segment& segment = segments[applied];
+    if (!segment.valid || (expected != 0 && segment.firstSeq != expected)) {
+      // The run broke in an earlier segment.
+      break;
+    }
+    for (const Segment::Record& record : segment.records) {
+      callback(
+        record.operation,
+        string(record.row, record.rowLen),
+        string(record.row + record.rowLen, record.colLen),
+        string(record.row + record.rowLen + record.colLen, record.valLen),
+        segment.number
+      );
+    }
+    count += segment.records.size();
+    expected = segment.firstSeq + segment.records.size();
+  }
+
+  pthread_mutex_lock(&lock_);
+  // Later segments were never applied; keeping them would break the run
+  // the next replay follows.
+  for (size_t i = applied; i < segments.size(); i++) {
+    unlink(segments[i].path.c_str());
+  }
+  // Release may have retired some of the applied ones meanwhile.
+  while (applied < segments.size() && !segments_.empty() &&
+         segments_.back() >= segments[applied].number) {
+    segments_.pop_back();
+  }
+  if (expected != 0) {
+    nextSeq_ = expected;
+  }
+  replayed_ = true;
+  pthread_mutex_unlock(&lock_);
+  return count;
+}
+
+void CommitLog::Replay(MemTable* memtable) {
+  Replay([memtable](int operation, const string& row, const string& col, const string& val, uint32_t segment) {
+    if (operation == PUT) {
+      memtable->Put(row, col, val);
+    } else {
+      memtable->Delete(row, col);
+    }
+  });
 }
 
-} // namespace Tabula
+} // namespace KVStore
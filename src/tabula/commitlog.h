@@ -3,65 +3,225 @@
 #define PUT 0
 #define DELETE 1
 #define COMMMIT_LOG_FILE_EXT ".cl"
+// Extension of released segments waiting to be reused
+#define COMMIT_LOG_FREE_FILE_EXT ".free"
+#define COMMIT_LOG_MAGIC 0x4c434254 // "TBCL"
+#define COMMIT_LOG_VERSION 1
+// A group write that would take a segment past this starts a new one.
+#define COMMIT_LOG_SEGMENT_SIZE 1024 * 1024 * 16 // 16 MB
+// Released segments kept for reuse instead of being deleted
+#define COMMIT_LOG_RECYCLE_SEGMENTS 4
+// Durability modes
+#define COMMIT_LOG_SYNC_NONE 0     // Written to the page cache only
+#define COMMIT_LOG_SYNC_BATCH 1    // fdatasync after every group write
+#define COMMIT_LOG_SYNC_INTERVAL 2 // fdatasync at most once per interval
+#define COMMIT_LOG_DEFAULT_SYNC_INTERVAL_MS 100
+// Values at least this long are written from the caller's memory instead of
+// being copied into the group buffer.
+#define COMMIT_LOG_COPY_LIMIT 4096
 
+#include <deque>
+#include <functional>
 #include <string>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
 #include "memtable.h"
 #include "tabulaenums.h"
 
 namespace KVStore {
 
 /*
- CommitLog file format:
+ A table's log is a run of segment files, <table>-<segment>.cl, numbered in
+ order. Each segment starts with a header:
 
- row length    (4 bytes)
- column length (4 bytes)
- operation     (4 bytes)
- value length  (4 bytes)
+ magic          (4 bytes)
+ version        (4 bytes)
+ first sequence (8 bytes)
+
+ followed by records:
+
+ crc32c         (4 bytes) of everything after it in the record
+ operation      (4 bytes)
+ sequence       (8 bytes)
+ row length     (4 bytes)
+ column length  (4 bytes)
+ value length   (4 bytes)
  row
  column
  value
+
+ Sequence numbers run on across segments without gaps, so replay stops at
+ the first record that fails its checksum or breaks the run, whether that
+ is a torn write or stale bytes in a reused segment.
+
+ Writers commit in groups. Each one appends its record to the pending
+ group and waits; whichever waiter finds no write in progress becomes the
+ leader and writes everything pending with one writev, followed by an
+ fdatasync if the durability mode calls for one. Records reach the file in
+ the order they were appended.
  */
 
 class CommitLog {
 public:
+	// Picks up the segments [tableName] left in [storeDir]. Appending before
+	// calling Replay discards them.
 	CommitLog(
     const std::string& tableName,
     const std::string& storeDir
-  );
-	CommitLog(
-    const char* dir,
-    char* logName
   );
 	~CommitLog();
+	// [mode] is one of the COMMIT_LOG_SYNC_ modes; [intervalMs] only matters
+	// for COMMIT_LOG_SYNC_INTERVAL, which starts a thread that syncs writes
+	// no group write has synced within the interval.
+	void SetDurability(int mode, uint32_t intervalMs);
+	// Each Log call appends and commits, returning once the record is
+	// written and, depending on the mode, synced.
 	int LogPut(
     const std::string& row,
     const std::string& col,
     const std::string& val
   );
+	// Logs every put in [batch] with a single write.
+	int LogPutBatch(const std::vector<Mutation>& batch);
 	int LogDelete(
     const std::string& row,
     const std::string& col
   );
-	struct CommitMetaData {
-		uint32_t rowLen;
-		uint32_t colLen;
-		uint32_t operation;
-		uint32_t valLen;
+	// The Append calls only queue the record, so a caller can fix its order
+	// under its own lock, and return a ticket for Commit. The strings must
+	// stay untouched until Commit returns.
+	uint64_t AppendPut(
+    const std::string& row,
+    const std::string& col,
+    const std::string& val
+  );
+	uint64_t AppendPutBatch(const std::vector<Mutation>& batch);
+	uint64_t AppendDelete(
+    const std::string& row,
+    const std::string& col
+  );
+	// Waits until the record behind [ticket] is written, leading the group
+	// write if nobody else is. Returns SUCCESS, or -1 if the write failed.
+	int Commit(uint64_t ticket);
+	// Writes out everything appended so far and starts a new segment, whose
+	// number is returned. Callers must not append meanwhile.
+	uint32_t Roll();
+	// Retires the segments numbered below [segment], once their records are
+	// safe elsewhere. Some are kept for reuse, the rest deleted.
+	void Release(uint32_t segment);
+	// Deletes every file of the log.
+	void Remove();
+	struct Stats {
+		uint64_t records;
+		uint64_t groups;
+		uint64_t syncs;
+		uint64_t segments;
+		uint64_t recycled;
 	};
-	void Clear();
+	void GetStats(Stats* stats);
+
+	// [segment] is the segment the record came from.
+	typedef std::function<void(
+    int operation,
+    const std::string& row,
+    const std::string& col,
+    const std::string& val,
+    uint32_t segment
+  )> ReplayCallback;
+	// Hands every intact record of the segments found at startup to
+	// [callback], in order. Segments are mapped and decoded in parallel.
+	// Returns the number of records.
+	uint64_t Replay(const ReplayCallback& callback);
 	void Replay(MemTable* memtable);
+
 private:
-	// Read the next commit from the log file.
-	// Returns 0 if commit is properly logged and is a PUT.
-	// Returns 1 if commit is properly logged and is a DELETE. In this case, val is undefined.
-	// Returns -1 if the end of log is reached.
-	int ReadNextCommit(
-    std::string* row,
-    std::string* col, 
-    std::string* val
+  // A stretch of the pending group: bytes in buffer_ if data is nullptr,
+  // otherwise the caller's memory.
+  struct Piece {
+    const char* data;
+    size_t offset;
+    size_t len;
+  };
+  // A pending record: its header sits at [header] in buffer_, followed by
+  // the row, column and, unless [val] is set, the value.
+  struct PendingRecord {
+    size_t header;
+    size_t inlineLen;
+    const char* val;
+    size_t valLen;
+  };
+  struct Segment;
+  struct DecodeWork;
+  void AppendBytes(const char* data, size_t len);
+  void AppendRecord(
+    uint32_t operation,
+    const std::string& row,
+    const std::string& col,
+    const char* val,
+    size_t valLen
   );
+  // Fills in the checksums of [records], which are going to [segment].
+  static void SealRecords(std::string* buffer, const std::vector<PendingRecord>& records, uint32_t segment);
+  // Writes [pieces] of [buffer] to [fd] at [offset]; called by the leader
+  // without lock_.
+  static int WriteGroup(
+    int fd,
+    uint64_t offset,
+    const std::string& buffer,
+    const std::vector<Piece>& pieces
+  );
+  bool SyncDue();
+  std::string SegmentPath(uint32_t segment);
+  // Opens segment nextSegment_, starting at sequence [firstSeq], reusing a
+  // released file if there is one. Caller holds lock_ and no write is in
+  // flight.
+  int NewSegment(uint64_t firstSeq);
+  // Makes sure there is a segment to write to. Caller holds lock_.
+  void EnsureSegment();
+  // Release, with lock_ held.
+  void ReleaseLocked(uint32_t segment);
+  // Body of the interval syncer
+  static void* SyncLoop(void* arg);
+  static void* DecodeThread(void* arg);
+  static void Decode(Segment* segment);
+
+  std::string tableName_;
   std::string storeDir_;
+  // Current segment; -1 until the first write
   int logfd_;
+  uint32_t segment_;
+  uint64_t offset_;
+  uint32_t nextSegment_;
+  // Segments still holding records, oldest first, including the current one
+  std::deque<uint32_t> segments_;
+  // Released files ready for reuse
+  std::vector<std::string> free_;
+  bool replayed_;
+  int durability_;
+  uint32_t syncIntervalMs_;
+  struct timespec lastSync_;
+  pthread_mutex_t lock_;
+  pthread_cond_t written_;
+  // Wakes the syncer, which times its waits on CLOCK_MONOTONIC.
+  pthread_cond_t syncCond_;
+  pthread_t syncer_;
+  bool syncing_;
+  // The group being filled; it goes out as group nextGroup_.
+  std::string buffer_;
+  std::vector<Piece> pieces_;
+  std::vector<PendingRecord> records_;
+  uint64_t groupBytes_;
+  uint64_t groupFirstSeq_;
+  uint64_t nextSeq_;
+  uint64_t nextGroup_;
+  // Every group up to this one has been written.
+  uint64_t writtenGroup_;
+  bool writing_;
+  // Set if any write failed; later commits report it too.
+  bool failed_;
+  bool unsynced_;
+  Stats stats_;
 };
 }
 // namespace KVStore
@@ -0,0 +1,161 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "commitlog.h"
+
+using std::string;
+using std::vector;
+using namespace KVStore;
+
+// Measures commits per second for each durability mode as concurrent
+// writers are added, along with how many records each group write carried,
+// then how fast a large log replays.
+
+struct Writer {
+  CommitLog* log;
+  int thread;
+  int ops;
+  string value;
+};
+
+static void* RunWriter(void* arg) {
+  Writer* writer = static_cast<Writer*>(arg);
+  char row[32];
+  for (int i = 0; i < writer->ops; i++) {
+    snprintf(row, sizeof(row), "row%03d%08d", writer->thread, i);
+    writer->log->LogPut(row, "col", writer->value);
+  }
+  return nullptr;
+}
+
+static double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns commits per second; sets [perGroup] to records per group write.
+static double Run(const string& dir, int mode, uint32_t intervalMs, int threads, int ops, int valueSize, double* perGroup) {
+  string name = "bench" + std::to_string(getpid());
+  double elapsed;
+  CommitLog::Stats stats;
+  {
+    CommitLog log(name, dir);
+    log.SetDurability(mode, intervalMs);
+    vector<Writer> writers(threads);
+    vector<pthread_t> tids(threads);
+    double start = NowSeconds();
+    for (int t = 0; t < threads; t++) {
+      writers[t] = {&log, t, ops, string(valueSize, 'v')};
+      pthread_create(&tids[t], nullptr, &RunWriter, &writers[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+      pthread_join(tids[t], nullptr);
+    }
+    elapsed = NowSeconds() - start;
+    log.GetStats(&stats);
+    log.Remove();
+  }
+  *perGroup = stats.groups > 0 ? static_cast<double>(stats.records) / stats.groups : 0;
+  return static_cast<double>(threads) * ops / elapsed;
+}
+
+// Returns records replayed per second from a log of [records] records.
+static double RunReplay(const string& dir, int records, int valueSize) {
+  string name = "bench" + std::to_string(getpid());
+  {
+    CommitLog log(name, dir);
+    vector<Mutation> batch;
+    string value(valueSize, 'v');
+    char row[32];
+    for (int i = 0; i < records; i++) {
+      snprintf(row, sizeof(row), "row%010d", i);
+      batch.push_back({row, "col", value});
+      if (batch.size() == 1000 || i == records - 1) {
+        log.LogPutBatch(batch);
+        batch.clear();
+      }
+    }
+  }
+  CommitLog log(name, dir);
+  uint64_t bytes = 0;
+  double start = NowSeconds();
+  uint64_t count = log.Replay([&bytes](int operation, const string& row, const string& col, const string& val, uint32_t segment) {
+    bytes += val.length();
+  });
+  double elapsed = NowSeconds() - start;
+  log.Remove();
+  return count / elapsed;
+}
+
+int main(int argc, char** argv) {
+  int ops = 2000;
+  int valueSize = 100;
+  int maxThreads = 16;
+  int replayRecords = 1000000;
+  uint32_t intervalMs = COMMIT_LOG_DEFAULT_SYNC_INTERVAL_MS;
+  string dir = ".";
+  int c;
+  while ((c = getopt(argc, argv, "o:v:t:i:d:r:")) != -1) {
+    switch(c) {
+      case 'o':
+        ops = atoi(optarg);
+        break;
+      case 'v':
+        valueSize = atoi(optarg);
+        break;
+      case 't':
+        maxThreads = atoi(optarg);
+        break;
+      case 'i':
+        intervalMs = atoi(optarg);
+        break;
+      case 'd':
+        dir = optarg;
+        break;
+      case 'r':
+        replayRecords = atoi(optarg);
+        break;
+      case '?':
+        std::cout << optopt << " is not an accepted argument." << std::endl;
+        return 1;
+      default:
+        abort();
+    }
+  }
+  struct Mode {
+    const char* name;
+    int mode;
+  };
+  const Mode modes[] = {
+    {"none", COMMIT_LOG_SYNC_NONE},
+    {"batch", COMMIT_LOG_SYNC_BATCH},
+    {"interval", COMMIT_LOG_SYNC_INTERVAL},
+  };
+  std::cout << ops << " commits per thread, " << valueSize << " byte values, "
+            << intervalMs << " ms sync interval, log in " << dir << std::endl;
+  for (const Mode& mode : modes) {
+    std::cout << mode.name << std::endl;
+    std::cout << std::left << std::setw(10) << "threads"
+              << std::setw(16) << "commits/s" << "records/group" << std::endl;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+      double perGroup;
+      double rate = Run(dir, mode.mode, intervalMs, threads, ops, valueSize, &perGroup);
+      std::cout << std::setw(10) << threads
+                << std::setw(16) << static_cast<uint64_t>(rate)
+                << std::fixed << std::setprecision(1) << perGroup
+                << std::defaultfloat << std::endl;
+    }
+  }
+  if (replayRecords > 0) {
+    std::cout << "replay of " << replayRecords << " records: "
+              << static_cast<uint64_t>(RunReplay(dir, replayRecords, valueSize))
+              << " records/s" << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
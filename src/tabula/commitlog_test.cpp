@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "commitlog.h"
+
+namespace KVStore {
+
+struct LogWriter {
+  CommitLog* log;
+  int thread;
+};
+
+static std::string Value(int thread, int i) {
+  // Every tenth value is long enough to be written from the caller's memory.
+  return std::string(i % 10 == 0 ? COMMIT_LOG_COPY_LIMIT + i : i, 'a' + thread);
+}
+
+static void* WriteRecords(void* arg) {
+  LogWriter* writer = static_cast<LogWriter*>(arg);
+  for (int i = 0; i < 500; i++) {
+    std::string row = "row" + std::to_string(writer->thread) + "-" + std::to_string(i);
+    EXPECT_EQ(SUCCESS, writer->log->LogPut(row, "col", Value(writer->thread, i)));
+  }
+  return nullptr;
+}
+
+TEST(CommitLogTest, TestGroupCommitReplay) {
+  char dirTemplate[] = "/tmp/commitlog_testXXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dirTemplate));
+  std::string dir = dirTemplate;
+  {
+    CommitLog log("table", dir);
+    log.SetDurability(COMMIT_LOG_SYNC_BATCH, 0);
+    pthread_t threads[4];
+    LogWriter writers[4];
+    for (int t = 0; t < 4; t++) {
+      writers[t] = {&log, t};
+      pthread_create(&threads[t], nullptr, &WriteRecords, &writers[t]);
+    }
+    for (int t = 0; t < 4; t++) {
+      pthread_join(threads[t], nullptr);
+    }
+    log.LogDelete("row0-1", "col");
+    CommitLog::Stats stats;
+    log.GetStats(&stats);
+    ASSERT_EQ(2001u, stats.records);
+    ASSERT_EQ(stats.groups, stats.syncs);
+  }
+  CommitLog log("table", dir);
+  MemTable memtable("table");
+  log.Replay(&memtable);
+  std::string val;
+  for (int t = 0; t < 4; t++) {
+    for (int i = 0; i < 500; i++) {
+      std::string row = "row" + std::to_string(t) + "-" + std::to_string(i);
+      if (t == 0 && i == 1) {
+        ASSERT_EQ(DELETED, memtable.Get(row, "col", &val));
+        continue;
+      }
+      ASSERT_EQ(SUCCESS, memtable.Get(row, "col", &val));
+      ASSERT_EQ(Value(t, i), val);
+    }
+  }
+  log.Remove();
+  rmdir(dir.c_str());
+}
+
+static void WriteRows(CommitLog* log, int first, int count) {
+  char row[16];
+  for (int i = first; i < first + count; i++) {
+    snprintf(row, sizeof(row), "row%03d", i);
+    ASSERT_EQ(SUCCESS, log->LogPut(row, "col", "0123456789"));
+  }
+}
+
+static uint64_t CountRecords(CommitLog* log) {
+  return log->Replay([](int operation, const std::string& row, const std::string& col, const std::string& val, uint32_t segment) {});
+}
+
+TEST(CommitLogTest, TestCorruptRecordEndsReplay) {
+  char dirTemplate[] = "/tmp/commitlog_testXXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dirTemplate));
+  std::string dir = dirTemplate;
+  {
+    CommitLog log("table", dir);
+    WriteRows(&log, 0, 100);
+    ASSERT_EQ(2u, log.Roll());
+    WriteRows(&log, 100, 100);
+  }
+  // Each record is a 28 byte header plus 6 + 3 + 10 bytes, after the 16 byte
+  // segment header. Damage the row of record 50.
+  int fd = open((dir + "/table-0000000001.cl").c_str(), O_WRONLY);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(1, pwrite(fd, "x", 1, 16 + 50 * 47 + 30));
+  close(fd);
+  {
+    CommitLog log("table", dir);
+    // The second segment no longer follows on and is dropped too.
+    ASSERT_EQ(50u, CountRecords(&log));
+    ASSERT_EQ(-1, access((dir + "/table-0000000002.cl").c_str(), F_OK));
+    WriteRows(&log, 200, 1);
+  }
+  CommitLog log("table", dir);
+  MemTable memtable("table");
+  log.Replay(&memtable);
+  std::string val;
+  ASSERT_EQ(SUCCESS, memtable.Get("row049", "col", &val));
+  ASSERT_EQ(NOT_FOUND, memtable.Get("row050", "col", &val));
+  ASSERT_EQ(NOT_FOUND, memtable.Get("row150", "col", &val));
+  ASSERT_EQ(SUCCESS, memtable.Get("row200", "col", &val));
+  log.Remove();
+  rmdir(dir.c_str());
+}
+
+TEST(CommitLogTest, TestRollReleaseRecycle) {
+  char dirTemplate[] = "/tmp/commitlog_testXXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dirTemplate));
+  std::string dir = dirTemplate;
+  {
+    CommitLog log("table", dir);
+    WriteRows(&log, 0, 10);
+    ASSERT_EQ(2u, log.Roll());
+    WriteRows(&log, 10, 10);
+    log.Release(2);
+    ASSERT_EQ(0, access((dir + "/table-0000000001.cl.free").c_str(), F_OK));
+    ASSERT_EQ(3u, log.Roll());
+    WriteRows(&log, 20, 10);
+    CommitLog::Stats stats;
+    log.GetStats(&stats);
+    ASSERT_EQ(3u, stats.segments);
+    ASSERT_EQ(1u, stats.recycled);
+  }
+  CommitLog log("table", dir);
+  // The reused file's old records fail their checksums under its new number.
+  ASSERT_EQ(20u, CountRecords(&log));
+  log.Remove();
+  rmdir(dir.c_str());
+}
+
+TEST(CommitLogTest, TestIntervalSync) {
+  char dirTemplate[] = "/tmp/commitlog_testXXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dirTemplate));
+  std::string dir = dirTemplate;
+  CommitLog log("table", dir);
+  log.SetDurability(COMMIT_LOG_SYNC_INTERVAL, 100);
+  // Too soon for the write to sync itself; with no writes after it, the
+  // syncer has to.
+  ASSERT_EQ(SUCCESS, log.LogPut("row", "col", "val"));
+  CommitLog::Stats stats;
+  log.GetStats(&stats);
+  ASSERT_EQ(0u, stats.syncs);
+  for (int wait = 0; wait < 200 && stats.syncs == 0; wait++) {
+    usleep(10000);
+    log.GetStats(&stats);
+  }
+  ASSERT_EQ(1u, stats.syncs);
+  log.Remove();
+  rmdir(dir.c_str());
+}
+
+} // namespace KVStore
@@ -0,0 +1,70 @@
+#include <string.h>
+#include "crc32c.h"
+
+namespace KVStore {
+
+static const uint32_t kPoly = 0x82f63b78; // Reflected Castagnoli polynomial
+
+struct Crc32cTable {
+  uint32_t entries[256];
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (crc & 1 ? kPoly : 0);
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+static uint32_t ExtendPortable(uint32_t crc, const char* data, size_t len) {
+  static const Crc32cTable table;
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < len; i++) {
+    crc = table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t ExtendHardware(uint32_t crc, const char* data, size_t len) {
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    data += 8;
+    len -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+  while (len > 0) {
+    crc = __builtin_ia32_crc32qi(crc, *data);
+    data++;
+    len--;
+  }
+  return crc;
+}
+
+static bool HasHardware() {
+  static const bool hardware = __builtin_cpu_supports("sse4.2");
+  return hardware;
+}
+#endif
+
+uint32_t Crc32cExtend(uint32_t crc, const char* data, size_t len) {
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (HasHardware()) {
+    return ~ExtendHardware(crc, data, len);
+  }
+#endif
+  return ~ExtendPortable(crc, data, len);
+}
+
+uint32_t Crc32c(const char* data, size_t len) {
+  return Crc32cExtend(0, data, len);
+}
+
+} // namespace KVStore
@@ -0,0 +1,17 @@
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace KVStore {
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+// it and a lookup table otherwise.
+uint32_t Crc32c(const char* data, size_t len);
+// Continues [crc], as returned by Crc32c, over [len] more bytes.
+uint32_t Crc32cExtend(uint32_t crc, const char* data, size_t len);
+
+} // namespace KVStore
+
+#endif
@@ -1,5 +1,6 @@
 #include <fcntl.h>
 #include <unistd.h>
+#include <algorithm>
 #include "memtable.h"
 
 using std::string;
@@ -11,8 +12,14 @@ MemTable::MemTable(const string& name) : MemTable(name, MEMTABLE_DEFAULT_CAPACIT
 MemTable::MemTable(
   const string& name, 
   const uint64_t capacity
+) : MemTable(name, capacity, MEMTABLE_MAP) { }
+MemTable::MemTable(
+  const string& name,
+  const uint64_t capacity,
+  int type
 ) : name_(name),
-    size_(0), 
+    skiplist_(type == MEMTABLE_SKIPLIST ? std::make_unique<SkipList>() : nullptr),
+    size_(0),
     capacity_(capacity) {
   pthread_mutex_init(&lock_, nullptr);
 }
@@ -24,14 +31,50 @@ int MemTable::Put(
   const std::string& col, 
   const std::string& val
 ) {
+  if (skiplist_ != nullptr) {
+    return skiplist_->Put(row, col, val);
+  }
   pthread_mutex_lock(&lock_);
+  int res = PutLocked(row, col, val);
+  pthread_mutex_unlock(&lock_);
+  return res;
+}
+
+int MemTable::PutLocked(
+  const std::string& row,
+  const std::string& col,
+  const std::string& val
+) {
   auto rowIt = rows_.find(row);
   if (rowIt == rows_.end()) {
     rowIt = rows_.emplace(row, std::make_unique<Row>(row)).first;
+    size_ += row.length() + MEMTABLE_ROW_OVERHEAD;
+  }
+  Utils::SharedBuffer old;
+  int state = rowIt->second->GetRef(col, &old);
+  if (state == SUCCESS) {
+    size_ -= old.Size();
+  } else if (state == NOT_FOUND) {
+    // A tombstone's entry is reused.
+    size_ += col.length() + MEMTABLE_COLUMN_OVERHEAD;
+  }
+  size_ += val.length();
+  return rowIt->second->Put(col, val);
+}
+
+int MemTable::PutBatch(const std::vector<Mutation>& batch) {
+  if (skiplist_ != nullptr) {
+    for (const Mutation& mutation : batch) {
+      skiplist_->Put(mutation.row, mutation.col, mutation.val);
+    }
+    return SUCCESS;
+  }
+  pthread_mutex_lock(&lock_);
+  for (const Mutation& mutation : batch) {
+    PutLocked(mutation.row, mutation.col, mutation.val);
   }
-  int res = rowIt->second->Put(col, val);
   pthread_mutex_unlock(&lock_);
-  return res;
+  return SUCCESS;
 }
 
 int MemTable::Get(
@@ -39,6 +82,14 @@ int MemTable::Get(
   const std::string& col,
   std::string* val
 ) {
+  if (skiplist_ != nullptr) {
+    Utils::SharedBuffer ref;
+    int res = skiplist_->GetRef(row, col, &ref);
+    if (res == SUCCESS) {
+      *val = ref.ToString();
+    }
+    return res;
+  }
   pthread_mutex_lock(&lock_);
   auto rowIt = rows_.find(row);
   if (rowIt == rows_.end()) {
@@ -50,25 +101,67 @@ int MemTable::Get(
   return res;
 }
 
-int MemTable::Delete(
+int MemTable::GetRef(
   const std::string& row,
-  const std::string& col
+  const std::string& col,
+  Utils::SharedBuffer* val
 ) {
+  if (skiplist_ != nullptr) {
+    return skiplist_->GetRef(row, col, val);
+  }
   pthread_mutex_lock(&lock_);
   auto rowIt = rows_.find(row);
   if (rowIt == rows_.end()) {
     pthread_mutex_unlock(&lock_);
     return NOT_FOUND;
   }
-  int res = rowIt->second->Delete(col);
+  int res = rowIt->second->GetRef(col, val);
+  pthread_mutex_unlock(&lock_);
+  return res;
+}
+
+int MemTable::Delete(
+  const std::string& row,
+  const std::string& col
+) {
+  if (skiplist_ != nullptr) {
+    return skiplist_->Delete(row, col);
+  }
+  pthread_mutex_lock(&lock_);
+  auto rowIt = rows_.find(row);
+  if (rowIt == rows_.end()) {
+    rowIt = rows_.emplace(row, std::make_unique<Row>(row)).first;
+    size_ += row.length() + MEMTABLE_ROW_OVERHEAD;
+  }
+  Utils::SharedBuffer old;
+  int state = rowIt->second->GetRef(col, &old);
+  if (state == SUCCESS) {
+    size_ -= old.Size();
+  } else if (state == NOT_FOUND) {
+    size_ += col.length() + MEMTABLE_COLUMN_OVERHEAD;
+  }
+  int res = rowIt->second->PutTombstone(col);
   pthread_mutex_unlock(&lock_);
   return res;
 }
 
 uint64_t MemTable::Size() {
+  if (skiplist_ != nullptr) {
+    return skiplist_->MemoryUsage();
+  }
   return size_;
 }
 
+bool MemTable::Empty() {
+  if (skiplist_ != nullptr) {
+    return skiplist_->Empty();
+  }
+  pthread_mutex_lock(&lock_);
+  bool empty = rows_.empty();
+  pthread_mutex_unlock(&lock_);
+  return empty;
+}
+
 uint64_t MemTable::Capacity() {
   return capacity_;
 }
@@ -77,26 +170,49 @@ const string& MemTable::Name () {
   return name_;
 }
 
-void MemTable::Flush(
-  const string& dir, 
-  const string& uniqueFileName,
-  uint32_t indexFreq, 
-  SSIndex* ssIndex
-) {
-  string ssTablePath = dir + "/" + uniqueFileName + ".sst";
-  int ssTableFd = open(ssTablePath.c_str(), O_RDWR | O_CREAT, S_IRWXO | S_IRWXG | S_IRWXU);
-  uint64_t offset = 0;
-  uint32_t shouldAddIndexCounter = 0;
+void MemTable::Flush(SSTableBuilder* builder) {
+  if (skiplist_ != nullptr) {
+    FlushSkipList(builder);
+    return;
+  }
+  pthread_mutex_lock(&lock_);
+  string columns;
   for (auto it = rows_.begin(); it != rows_.end(); it++) {
-    string serializedRow = it->second->Serialize();
-    write(ssTableFd, serializedRow.c_str(), serializedRow.length());
-    if (shouldAddIndexCounter++ % indexFreq == 0) {
-      ssIndex->AddIndex(it->first, offset);
+    columns.clear();
+    it->second->SerializeColumns(&columns);
+    builder->Add(it->first, columns);
+  }
+  pthread_mutex_unlock(&lock_);
+}
+
+void MemTable::FlushSkipList(SSTableBuilder* builder) {
+  SkipList::Iterator it(skiplist_.get());
+  while (it.Valid()) {
+    // Entries are sorted by row, then column, so a row's columns are adjacent.
+    string rowName = it.Row();
+    std::vector<std::pair<string, Utils::SharedBuffer> > columns;
+    std::vector<string> tombstones;
+    time_t lastUpdated = 0;
+    for (; it.Valid() && it.Row() == rowName; it.Next()) {
+      const SkipList::Value* value = it.GetValue();
+      if (value == nullptr) {
+        tombstones.push_back(it.Col());
+        continue;
+      }
+      columns.emplace_back(it.Col(), it.Ref(value));
+      lastUpdated = std::max(lastUpdated, value->updated);
+    }
+    Row row(rowName, lastUpdated);
+    for (const auto& column : columns) {
+      row.PutWithoutUpdateTime(column.first, column.second);
+    }
+    for (const string& col : tombstones) {
+      row.PutTombstoneWithoutUpdateTime(col);
     }
-    offset += serializedRow.length();
+    string serialized;
+    row.SerializeColumns(&serialized);
+    builder->Add(rowName, serialized);
   }
-  close(ssTableFd);
-  rows_.clear();
 }
 
 } // namespace KVStore
\ No newline at end of file
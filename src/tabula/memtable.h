@@ -2,51 +2,89 @@
 #define MEMTABLE_H_
 
 #define MEMTABLE_DEFAULT_CAPACITY 1024 * 1024 * 10 // 10 MB
+// Memtable implementations
+#define MEMTABLE_MAP 0      // std::map of rows behind one mutex
+#define MEMTABLE_SKIPLIST 1 // Lock-free reads, CAS inserts, arena memory
+// Bookkeeping the map memtable charges on top of key and value bytes
+#define MEMTABLE_ROW_OVERHEAD 160   // Map node, Row and its column table
+#define MEMTABLE_COLUMN_OVERHEAD 96 // Hash node, column name and SharedBuffer
 
+#include <atomic>
 #include <map>
 #include <pthread.h>
 #include <string>
 #include <memory>
+#include <vector>
 #include "row.h"
-#include "ssindex.h"
+#include "sstable.h"
+#include "skiplist.h"
 #include "tabulaenums.h"
 
 namespace KVStore {
 
+struct Mutation {
+  std::string row;
+  std::string col;
+  std::string val;
+};
+
 class MemTable {
 public:
   MemTable(const std::string& name);
   MemTable(const std::string& name, const uint64_t capacity);
+  // [type] is MEMTABLE_MAP or MEMTABLE_SKIPLIST.
+  MemTable(const std::string& name, const uint64_t capacity, int type);
   ~MemTable();
   int Put(
     const std::string& row, 
     const std::string& col, 
     const std::string& val
   );
+  // Applies all puts under one lock acquisition.
+  int PutBatch(const std::vector<Mutation>& batch);
   int Get(
     const std::string& row,
     const std::string& col,
     std::string* val
   );
+  int GetRef(
+    const std::string& row,
+    const std::string& col,
+    Utils::SharedBuffer* val
+  );
+  // Leaves a tombstone, which Get and GetRef report as DELETED and Flush
+  // writes out. Returns SUCCESS if a value was replaced, NOT_FOUND otherwise.
   int Delete(
     const std::string& row, 
     const std::string& col
   );
+  // Bytes held: keys, values and per-entry overhead for the map; arena
+  // blocks for the skiplist. Deletes give value memory back only for the
+  // map.
   uint64_t Size();
+  bool Empty();
   uint64_t Capacity();
   const std::string& Name();
-  void Flush(
-    const std::string& dir,
-    const std::string& uniqueFileName,
-    uint32_t indexFreq,
-    SSIndex* ssIndex
-  );
+  // Adds the rows, tombstones included, to [builder] in order; the caller
+  // finishes it. The memtable is left as it was, so it can keep serving
+  // reads until the caller drops it.
+  void Flush(SSTableBuilder* builder);
 
 private:
+  // Caller holds lock_.
+  int PutLocked(
+    const std::string& row,
+    const std::string& col,
+    const std::string& val
+  );
+  void FlushSkipList(SSTableBuilder* builder);
+
   std::string name_;
   pthread_mutex_t lock_;
   std::map<std::string, std::unique_ptr<Row> > rows_;
-  uint64_t size_;
+  // Set instead of rows_ for MEMTABLE_SKIPLIST, which needs no lock_.
+  std::unique_ptr<SkipList> skiplist_;
+  std::atomic<uint64_t> size_;
   uint64_t capacity_;
 };
 
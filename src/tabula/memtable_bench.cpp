@@ -0,0 +1,143 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "memtable.h"
+
+using std::string;
+using std::vector;
+using namespace KVStore;
+
+// Compares the map and skiplist memtables under concurrent load: threads
+// writing disjoint keys, threads reading a preloaded table, and a mix of
+// 90% reads and 10% overwrites. Prints operations per second for each
+// implementation and thread count.
+
+struct Workload {
+  MemTable* memtable;
+  int thread;
+  int ops;
+  int num_keys;    // Preloaded keys that reads and overwrites pick from
+  int write_pct;   // Share of operations that are writes
+  bool fresh_keys; // Writes insert new keys instead of overwriting
+  string value;
+};
+
+static string RowKey(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "row%08d", i);
+  return buf;
+}
+
+static void* RunWorkload(void* arg) {
+  Workload* work = static_cast<Workload*>(arg);
+  uint32_t state = 2654435761u * (work->thread + 1);
+  Utils::SharedBuffer val;
+  for (int i = 0; i < work->ops; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    bool write = static_cast<int>(state % 100) < work->write_pct;
+    if (write && work->fresh_keys) {
+      work->memtable->Put(RowKey(work->thread * work->ops + i), "col", work->value);
+    } else if (write) {
+      work->memtable->Put(RowKey(state % work->num_keys), "col", work->value);
+    } else {
+      work->memtable->GetRef(RowKey(state % work->num_keys), "col", &val);
+    }
+  }
+  return nullptr;
+}
+
+static double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns operations per second.
+static double Run(int type, int threads, int ops, int num_keys, int write_pct, bool fresh_keys, int value_size) {
+  MemTable memtable("bench", MEMTABLE_DEFAULT_CAPACITY, type);
+  string value(value_size, 'v');
+  for (int i = 0; i < num_keys; i++) {
+    memtable.Put(RowKey(i), "col", value);
+  }
+  vector<Workload> work(threads);
+  vector<pthread_t> tids(threads);
+  double start = NowSeconds();
+  for (int t = 0; t < threads; t++) {
+    // Fresh keys start past the preloaded ones.
+    work[t] = {&memtable, t + (fresh_keys ? num_keys : 0), ops, num_keys, write_pct, fresh_keys, value};
+    pthread_create(&tids[t], nullptr, &RunWorkload, &work[t]);
+  }
+  for (int t = 0; t < threads; t++) {
+    pthread_join(tids[t], nullptr);
+  }
+  return static_cast<double>(threads) * ops / (NowSeconds() - start);
+}
+
+static string Format(double ops_per_sec) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.2f M/s", ops_per_sec / 1e6);
+  return buf;
+}
+
+int main(int argc, char** argv) {
+  int ops = 200000;
+  int num_keys = 100000;
+  int value_size = 100;
+  int max_threads = 8;
+  int c;
+  while ((c = getopt(argc, argv, "o:k:v:t:")) != -1) {
+    switch(c) {
+      case 'o':
+        ops = atoi(optarg);
+        break;
+      case 'k':
+        num_keys = atoi(optarg);
+        break;
+      case 'v':
+        value_size = atoi(optarg);
+        break;
+      case 't':
+        max_threads = atoi(optarg);
+        break;
+      case '?':
+        std::cout << optopt << " is not an accepted argument." << std::endl;
+        return 1;
+      default:
+        abort();
+    }
+  }
+  struct Scenario {
+    const char* name;
+    int preload;
+    int write_pct;
+    bool fresh_keys;
+  };
+  const Scenario scenarios[] = {
+    {"insert", 0, 100, true},
+    {"read", num_keys, 0, false},
+    {"90/10 read/overwrite", num_keys, 10, false},
+  };
+  std::cout << ops << " operations per thread, " << num_keys << " keys, "
+            << value_size << " byte values" << std::endl;
+  for (const Scenario& scenario : scenarios) {
+    std::cout << scenario.name << std::endl;
+    std::cout << std::left << std::setw(10) << "threads"
+              << std::setw(14) << "map" << std::setw(14) << "skiplist" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+      // Inserts pick no preloaded keys, but num_keys must not be 0.
+      int keys = scenario.preload > 0 ? scenario.preload : 1;
+      std::cout << std::setw(10) << threads
+                << std::setw(14) << Format(Run(MEMTABLE_MAP, threads, ops, keys, scenario.write_pct, scenario.fresh_keys, value_size))
+                << std::setw(14) << Format(Run(MEMTABLE_SKIPLIST, threads, ops, keys, scenario.write_pct, scenario.fresh_keys, value_size))
+                << std::endl;
+    }
+  }
+  return EXIT_SUCCESS;
+}
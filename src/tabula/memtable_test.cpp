@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "memtable.h"
+
+namespace KVStore {
+
+class MemTableTest : public ::testing::TestWithParam<int> { };
+
+TEST_P(MemTableTest, TestPutGetDelete) {
+  MemTable memtable("table", MEMTABLE_DEFAULT_CAPACITY, GetParam());
+  std::string val;
+  ASSERT_EQ(NOT_FOUND, memtable.Get("row", "col", &val));
+  ASSERT_EQ(SUCCESS, memtable.Put("row", "col", "a"));
+  ASSERT_EQ(SUCCESS, memtable.Put("row", "col2", "b"));
+  ASSERT_EQ(SUCCESS, memtable.Put("ro", "wcol", "c"));
+  ASSERT_EQ(OVERWRITE, memtable.Put("row", "col", "d"));
+  ASSERT_EQ(SUCCESS, memtable.Get("row", "col", &val));
+  ASSERT_EQ("d", val);
+  ASSERT_EQ(SUCCESS, memtable.Get("ro", "wcol", &val));
+  ASSERT_EQ("c", val);
+  ASSERT_EQ(SUCCESS, memtable.Delete("row", "col"));
+  ASSERT_EQ(DELETED, memtable.Get("row", "col", &val));
+  ASSERT_EQ(NOT_FOUND, memtable.Delete("row", "col"));
+  // Deleting what the memtable never had still leaves a tombstone.
+  ASSERT_EQ(NOT_FOUND, memtable.Delete("other", "col"));
+  ASSERT_EQ(DELETED, memtable.Get("other", "col", &val));
+  ASSERT_EQ(SUCCESS, memtable.Put("row", "col", "e"));
+  Utils::SharedBuffer ref;
+  ASSERT_EQ(SUCCESS, memtable.GetRef("row", "col2", &ref));
+  ASSERT_EQ("b", ref.ToString());
+}
+
+struct Inserter {
+  MemTable* memtable;
+  int thread;
+};
+
+static void* InsertRows(void* arg) {
+  Inserter* inserter = static_cast<Inserter*>(arg);
+  for (int i = 0; i < 2000; i++) {
+    // Interleave the threads' keys so they race for the same positions.
+    std::string row = "row" + std::to_string(i * 4 + inserter->thread);
+    inserter->memtable->Put(row, "col", row);
+  }
+  return nullptr;
+}
+
+TEST_P(MemTableTest, TestConcurrentPut) {
+  MemTable memtable("table", MEMTABLE_DEFAULT_CAPACITY, GetParam());
+  pthread_t threads[4];
+  Inserter inserters[4];
+  for (int t = 0; t < 4; t++) {
+    inserters[t] = {&memtable, t};
+    pthread_create(&threads[t], nullptr, &InsertRows, &inserters[t]);
+  }
+  for (int t = 0; t < 4; t++) {
+    pthread_join(threads[t], nullptr);
+  }
+  for (int i = 0; i < 8000; i++) {
+    std::string row = "row" + std::to_string(i);
+    std::string val;
+    ASSERT_EQ(SUCCESS, memtable.Get(row, "col", &val));
+    ASSERT_EQ(row, val);
+  }
+}
+
+TEST_P(MemTableTest, TestFlush) {
+  MemTable memtable("table", MEMTABLE_DEFAULT_CAPACITY, GetParam());
+  memtable.Put("b", "x", "1");
+  memtable.Put("a", "y", "2");
+  memtable.Put("a", "x", "3");
+  memtable.Put("c", "x", "4");
+  memtable.Delete("c", "x");
+  {
+    SSTableBuilder builder("./table-flushtest" SS_TABLE_FILE_EXT, SSTableOptions());
+    memtable.Flush(&builder);
+    ASSERT_EQ(SUCCESS, builder.Finish());
+    // Rows whose columns were all deleted still carry their tombstones.
+    ASSERT_EQ(3u, builder.NumRows());
+  }
+  std::unique_ptr<SSTable> ssTable = SSTable::Open("./table-flushtest" SS_TABLE_FILE_EXT);
+  remove("./table-flushtest" SS_TABLE_FILE_EXT);
+  ASSERT_NE(nullptr, ssTable.get());
+  ASSERT_EQ("a", ssTable->StartRow());
+  std::unique_ptr<Row> row;
+  ASSERT_EQ(SUCCESS, ssTable->Get("a", &row));
+  std::string val;
+  ASSERT_EQ(SUCCESS, row->Get("x", &val));
+  ASSERT_EQ("3", val);
+  ASSERT_EQ(SUCCESS, row->Get("y", &val));
+  ASSERT_EQ("2", val);
+  ASSERT_EQ(SUCCESS, ssTable->Get("b", &row));
+  ASSERT_EQ(SUCCESS, row->Get("x", &val));
+  ASSERT_EQ("1", val);
+  ASSERT_EQ(SUCCESS, ssTable->Get("c", &row));
+  ASSERT_EQ(DELETED, row->Get("x", &val));
+  // The memtable keeps serving reads until it is dropped.
+  ASSERT_EQ(SUCCESS, memtable.Get("a", "x", &val));
+  ASSERT_EQ("3", val);
+}
+
+TEST_P(MemTableTest, TestSize) {
+  MemTable memtable("table", MEMTABLE_DEFAULT_CAPACITY, GetParam());
+  ASSERT_TRUE(memtable.Empty());
+  uint64_t empty = memtable.Size();
+  for (int i = 0; i < 1000; i++) {
+    memtable.Put("row" + std::to_string(i), "col", std::string(100, 'v'));
+  }
+  ASSERT_FALSE(memtable.Empty());
+  // At least the keys and values are counted.
+  ASSERT_GE(memtable.Size() - empty, 1000 * 110u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Types, MemTableTest, ::testing::Values(MEMTABLE_MAP, MEMTABLE_SKIPLIST));
+
+} // namespace KVStore
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include "mergingiterator.h"
+
+namespace KVStore {
+
+MergingIterator::MergingIterator(std::vector<std::unique_ptr<SSTable::Iterator> > children)
+  : children_(std::move(children)), valid_(false) {}
+
+bool MergingIterator::Greater(size_t left, size_t right) const {
+  int cmp = children_[left]->Key().compare(children_[right]->Key());
+  return cmp > 0 || (cmp == 0 && left > right);
+}
+
+void MergingIterator::Push(size_t child) {
+  if (!children_[child]->Valid()) {
+    return;
+  }
+  heap_.push_back(child);
+  std::push_heap(heap_.begin(), heap_.end(), [this](size_t left, size_t right) {
+    return Greater(left, right);
+  });
+}
+
+void MergingIterator::SeekToFirst() {
+  heap_.clear();
+  current_.clear();
+  for (size_t i = 0; i < children_.size(); i++) {
+    children_[i]->SeekToFirst();
+    Push(i);
+  }
+  Gather();
+}
+
+void MergingIterator::Gather() {
+  current_.clear();
+  values_.clear();
+  valid_ = !heap_.empty();
+  if (!valid_) {
+    return;
+  }
+  key_ = children_[heap_.front()]->Key();
+  while (!heap_.empty() && children_[heap_.front()]->Key() == key_) {
+    std::pop_heap(heap_.begin(), heap_.end(), [this](size_t left, size_t right) {
+      return Greater(left, right);
+    });
+    size_t child = heap_.back();
+    heap_.pop_back();
+    current_.push_back(child);
+    values_.push_back(children_[child]->Value());
+  }
+}
+
+bool MergingIterator::Valid() const {
+  return valid_;
+}
+
+void MergingIterator::Next() {
+  for (size_t child : current_) {
+    children_[child]->Next();
+    Push(child);
+  }
+  Gather();
+}
+
+const std::string& MergingIterator::Key() const {
+  return key_;
+}
+
+const std::vector<Utils::SharedBuffer>& MergingIterator::Values() const {
+  return values_;
+}
+
+bool MergingIterator::Failed() const {
+  for (const auto& child : children_) {
+    if (child->Failed()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace KVStore
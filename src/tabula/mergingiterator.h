@@ -0,0 +1,45 @@
+#ifndef MERGING_ITERATOR_H_
+#define MERGING_ITERATOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "sstable.h"
+
+namespace KVStore {
+
+// Walks several SSTables as one sorted run, keeping the next row of each in
+// a heap. A row found in more than one comes out once, with the value from
+// each, newest first.
+class MergingIterator {
+public:
+  // [children] are ordered newest first.
+  explicit MergingIterator(std::vector<std::unique_ptr<SSTable::Iterator> > children);
+  void SeekToFirst();
+  bool Valid() const;
+  void Next();
+  const std::string& Key() const;
+  const std::vector<Utils::SharedBuffer>& Values() const;
+  // Set if any child failed; the merged run is then incomplete.
+  bool Failed() const;
+
+private:
+  // Orders the heap by key, then by age, so the newest copy of a row comes
+  // out first.
+  bool Greater(size_t left, size_t right) const;
+  void Push(size_t child);
+  // Pops every child positioned at the smallest key.
+  void Gather();
+
+  std::vector<std::unique_ptr<SSTable::Iterator> > children_;
+  std::vector<size_t> heap_;
+  // Children positioned at key_, to move on at the next Next
+  std::vector<size_t> current_;
+  std::string key_;
+  std::vector<Utils::SharedBuffer> values_;
+  bool valid_;
+};
+
+} // namespace KVStore
+
+#endif
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <sstream>
+#include <cstring>
 #include <unistd.h>
 #include <vector>
 #include <iostream>
@@ -29,9 +31,17 @@ int Row::Put(
 int Row::PutWithoutUpdateTime(
   const std::string& col, 
   const std::string& val
+) {
+  return PutWithoutUpdateTime(col, Utils::SharedBuffer(val));
+}
+
+int Row::PutWithoutUpdateTime(
+  const std::string& col,
+  const Utils::SharedBuffer& val
 ) {
   auto it = columns_.find(col);
   if (it == columns_.end()) {
+    tombstones_.erase(col);
     it = columns_.emplace(col, val).first;
     return SUCCESS;
   }
@@ -45,7 +55,19 @@ int Row::Get(
 ) {
   auto it = columns_.find(col);
   if (it == columns_.end()) {
-    return NOT_FOUND;
+    return tombstones_.count(col) > 0 ? DELETED : NOT_FOUND;
+  }
+  *val = it->second.ToString();
+  return SUCCESS;
+}
+
+int Row::GetRef(
+  const std::string& col,
+  Utils::SharedBuffer* val
+) {
+  auto it = columns_.find(col);
+  if (it == columns_.end()) {
+    return tombstones_.count(col) > 0 ? DELETED : NOT_FOUND;
   }
   *val = it->second;
   return SUCCESS;
@@ -61,6 +83,42 @@ int Row::Delete(const std::string& col) {
   return SUCCESS;
 }
 
+int Row::PutTombstone(const std::string& col) {
+  lastUpdated_ = time(0);
+  return PutTombstoneWithoutUpdateTime(col);
+}
+
+int Row::PutTombstoneWithoutUpdateTime(const std::string& col) {
+  tombstones_.insert(col);
+  return columns_.erase(col) > 0 ? SUCCESS : NOT_FOUND;
+}
+
+void Row::Merge(const Row& older) {
+  for (const auto& column : older.columns_) {
+    if (tombstones_.count(column.first) == 0) {
+      columns_.emplace(column.first, column.second);
+    }
+  }
+  for (const string& col : older.tombstones_) {
+    if (columns_.count(col) == 0) {
+      tombstones_.insert(col);
+    }
+  }
+  lastUpdated_ = std::max(lastUpdated_, older.lastUpdated_);
+}
+
+size_t Row::NumColumns() const {
+  return columns_.size();
+}
+
+size_t Row::NumTombstones() const {
+  return tombstones_.size();
+}
+
+void Row::DropTombstones() {
+  tombstones_.clear();
+}
+
 const std::string &Row::Name() {
   return name_;
 }
@@ -68,7 +126,7 @@ const std::string &Row::Name() {
 std::string Row::Serialize() {
   std::ostringstream ss;
   uint32_t rowNameLen = static_cast<uint32_t>(name_.length());
-  uint32_t colSize = static_cast<uint32_t>(columns_.size());
+  uint32_t colSize = static_cast<uint32_t>(columns_.size() + tombstones_.size());
   uint64_t lastUpdated = static_cast<uint64_t>(lastUpdated_);
   ss.write(reinterpret_cast<char*>(&rowNameLen), sizeof(rowNameLen));
   ss.write(reinterpret_cast<char*>(&colSize), sizeof(colSize));
@@ -76,15 +134,44 @@ std::string Row::Serialize() {
   ss.write(name_.c_str(), name_.length());
   for (auto it = columns_.begin(); it != columns_.end(); it++) {
     uint32_t colNameLen = it->first.length();
-    uint64_t colValLen = it->second.length();
+    uint64_t colValLen = it->second.Size();
     ss.write(reinterpret_cast<char*>(&colNameLen), sizeof(colNameLen));
     ss.write(reinterpret_cast<char*>(&colValLen), sizeof(colValLen));
     ss.write(it->first.c_str(), it->first.length());
-    ss.write(it->second.c_str(), it->second.length());
+    ss.write(it->second.Data(), it->second.Size());
+  }
+  for (const string& col : tombstones_) {
+    uint32_t colNameLen = col.length();
+    uint64_t colValLen = ROW_TOMBSTONE;
+    ss.write(reinterpret_cast<char*>(&colNameLen), sizeof(colNameLen));
+    ss.write(reinterpret_cast<char*>(&colValLen), sizeof(colValLen));
+    ss.write(col.c_str(), col.length());
   }
   return ss.str();
 }
 
+void Row::SerializeColumns(std::string* out) {
+  uint64_t lastUpdated = static_cast<uint64_t>(lastUpdated_);
+  uint32_t colSize = static_cast<uint32_t>(columns_.size() + tombstones_.size());
+  out->append(reinterpret_cast<char*>(&lastUpdated), sizeof(lastUpdated));
+  out->append(reinterpret_cast<char*>(&colSize), sizeof(colSize));
+  for (auto it = columns_.begin(); it != columns_.end(); it++) {
+    uint32_t colNameLen = it->first.length();
+    uint64_t colValLen = it->second.Size();
+    out->append(reinterpret_cast<char*>(&colNameLen), sizeof(colNameLen));
+    out->append(reinterpret_cast<char*>(&colValLen), sizeof(colValLen));
+    out->append(it->first);
+    out->append(it->second.Data(), it->second.Size());
+  }
+  for (const string& col : tombstones_) {
+    uint32_t colNameLen = col.length();
+    uint64_t colValLen = ROW_TOMBSTONE;
+    out->append(reinterpret_cast<char*>(&colNameLen), sizeof(colNameLen));
+    out->append(reinterpret_cast<char*>(&colValLen), sizeof(colValLen));
+    out->append(col);
+  }
+}
+
 std::unique_ptr<Row> Row::Deserialize(int fd, uint64_t offset) {
   lseek(fd, offset, 0);
   RowMetaData metadata;
@@ -112,10 +199,18 @@ std::unique_ptr<Row> Row::Deserialize(int fd, uint64_t offset) {
       return std::unique_ptr<Row>(nullptr);
 	  }
     uint32_t colNameLen = *reinterpret_cast<uint32_t*>(buf.data());
-    uint64_t colValLen = *reinterpret_cast<uint32_t*>(buf.data() + sizeof(colNameLen));
+    uint64_t colValLen = *reinterpret_cast<uint64_t*>(buf.data() + sizeof(colNameLen));
+    if (colValLen == ROW_TOMBSTONE) {
+      buf = vector<char>(colNameLen);
+      if (read(fd, buf.data(), colNameLen) != colNameLen) {
+        return std::unique_ptr<Row>(nullptr);
+      }
+      row->PutTombstoneWithoutUpdateTime(string(buf.data(), colNameLen));
+      continue;
+    }
     buf = vector<char>(colNameLen + colValLen);
     bytesRead = read(fd, buf.data(), colNameLen + colValLen);
-    if (bytesRead != colNameLen + colValLen || bytesRead <= 0) {
+    if (bytesRead <= 0 || static_cast<uint64_t>(bytesRead) != colNameLen + colValLen) {
      return std::unique_ptr<Row>(nullptr);
 	  }
     row->PutWithoutUpdateTime(
@@ -126,6 +221,47 @@ std::unique_ptr<Row> Row::Deserialize(int fd, uint64_t offset) {
   return row;
 }
 
+std::unique_ptr<Row> Row::DeserializeColumns(const std::string& name, const Utils::SharedBuffer& buf) {
+  const char* data = buf.Data();
+  uint64_t size = buf.Size();
+  if (size < sizeof(uint64_t) + sizeof(uint32_t)) {
+    return std::unique_ptr<Row>(nullptr);
+  }
+  uint64_t lastUpdated;
+  uint32_t numCols;
+  memcpy(&lastUpdated, data, sizeof(lastUpdated));
+  memcpy(&numCols, data + sizeof(lastUpdated), sizeof(numCols));
+  uint64_t offset = sizeof(lastUpdated) + sizeof(numCols);
+  std::unique_ptr<Row> row = std::make_unique<Row>(name, lastUpdated);
+  for (uint32_t i = 0; i < numCols; i++) {
+    if (offset + COL_METADATA_BYTES > size) {
+      return std::unique_ptr<Row>(nullptr);
+    }
+    uint32_t colNameLen;
+    uint64_t colValLen;
+    memcpy(&colNameLen, data + offset, sizeof(colNameLen));
+    memcpy(&colValLen, data + offset + sizeof(colNameLen), sizeof(colValLen));
+    offset += COL_METADATA_BYTES;
+    if (colValLen == ROW_TOMBSTONE) {
+      if (colNameLen > size - offset) {
+        return std::unique_ptr<Row>(nullptr);
+      }
+      row->PutTombstoneWithoutUpdateTime(string(data + offset, colNameLen));
+      offset += colNameLen;
+      continue;
+    }
+    if (colNameLen > size - offset || colValLen > size - offset - colNameLen) {
+      return std::unique_ptr<Row>(nullptr);
+    }
+    row->PutWithoutUpdateTime(
+      string(data + offset, colNameLen),
+      buf.Slice(offset + colNameLen, colValLen)
+    );
+    offset += colNameLen + colValLen;
+  }
+  return row;
+}
+
 bool Row::operator == (const Row& right) const {
   if (name_ != right.name_) {
     return false;
@@ -133,7 +269,7 @@ bool Row::operator == (const Row& right) const {
   if (lastUpdated_ != right.lastUpdated_) {
     return false;
   }
-  if (columns_.size() != right.columns_.size()) {
+  if (columns_.size() != right.columns_.size() || tombstones_ != right.tombstones_) {
     return false;
   }
   for (auto leftIt = columns_.begin(); leftIt != columns_.end(); leftIt ++) {
@@ -141,7 +277,8 @@ bool Row::operator == (const Row& right) const {
     if (rightIt == right.columns_.end()) {
       return false;
     }
-    if (leftIt->second != rightIt->second) {
+    if (leftIt->second.Size() != rightIt->second.Size() ||
+        memcmp(leftIt->second.Data(), rightIt->second.Data(), leftIt->second.Size()) != 0) {
       return false;
     }
   }
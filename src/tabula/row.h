@@ -3,9 +3,14 @@
 
 #define ROW_METADATA_BYTES 16
 #define COL_METADATA_BYTES 12
+// Column value length that marks a tombstone, which has no value bytes
+#define ROW_TOMBSTONE UINT64_MAX
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include "tabulaenums.h"
+#include "../sharedbuffer.h"
 
 namespace KVStore {
 
@@ -27,11 +32,33 @@ public:
     const std::string& col, 
     const std::string& val
   );
+  int PutWithoutUpdateTime(
+    const std::string& col,
+    const Utils::SharedBuffer& val
+  );
+  // Return DELETED if [col] has a tombstone.
   int Get(
     const std::string& col, 
     std::string* val
   );
+  // Like Get, but shares the stored bytes instead of copying them.
+  int GetRef(
+    const std::string& col,
+    Utils::SharedBuffer* val
+  );
+  // Drops [col] without leaving a tombstone.
   int Delete(const std::string& col);
+  // Replaces [col] with a tombstone, which hides it in older copies of the
+  // row. Returns SUCCESS if a value was replaced, NOT_FOUND otherwise.
+  int PutTombstone(const std::string& col);
+  int PutTombstoneWithoutUpdateTime(const std::string& col);
+  // Adds the columns and tombstones of [older] this row has neither of,
+  // keeping the later update time.
+  void Merge(const Row& older);
+  size_t NumColumns() const;
+  size_t NumTombstones() const;
+  // For when no older copy of the row is left for tombstones to hide.
+  void DropTombstones();
   bool operator == (const Row& right) const;
   bool operator != (const Row& right) const;
   
@@ -41,17 +68,25 @@ public:
   // n bytes: row name
   // Repeated:
   // 4 bytes: col name length
-  // 8 bytes: col value length
+  // 8 bytes: col value length, or ROW_TOMBSTONE
   // n bytes: col name
   // n bytes: col value
   std::string Serialize();
+  // Appends the row without its name, as an SSTable entry keyed by it:
+  // 8 bytes: last updated time
+  // 4 bytes: number of columns
+  // Repeated columns as above
+  void SerializeColumns(std::string* out);
   const std::string& Name();
   time_t LastUpdateTime();
   static std::unique_ptr<Row> Deserialize(int fd, uint64_t offset);
+  // Reads what SerializeColumns wrote. Column values are slices of [buf].
+  static std::unique_ptr<Row> DeserializeColumns(const std::string& name, const Utils::SharedBuffer& buf);
 private:
   std::string name_;
   time_t lastUpdated_;
-  std::unordered_map<std::string, std::string> columns_;
+  std::unordered_map<std::string, Utils::SharedBuffer> columns_;
+  std::unordered_set<std::string> tombstones_;
 };
 
 } // namespace KVStore
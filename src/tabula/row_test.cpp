@@ -87,4 +87,41 @@ TEST_F(RowTest, TestSerielize) {
   ASSERT_EQ("val15", val);
 }
 
+TEST_F(RowTest, TestTombstones) {
+  row->Put("col1", "val1");
+  row->Put("col2", "val2");
+  ASSERT_EQ(SUCCESS, row->PutTombstone("col1"));
+  ASSERT_EQ(NOT_FOUND, row->PutTombstone("col3"));
+  std::string val;
+  ASSERT_EQ(DELETED, row->Get("col1", &val));
+  ASSERT_EQ(DELETED, row->Get("col3", &val));
+  ASSERT_EQ(1u, row->NumColumns());
+  ASSERT_EQ(2u, row->NumTombstones());
+  std::string columns;
+  row->SerializeColumns(&columns);
+  std::unique_ptr<Row> deserialized = Row::DeserializeColumns(row->Name(), Utils::SharedBuffer(columns));
+  ASSERT_NE(nullptr, deserialized.get());
+  ASSERT_TRUE(*row == *deserialized);
+  // An older copy of the row shows through only where there is neither.
+  Row older(row->Name());
+  older.Put("col1", "old1");
+  older.Put("col2", "old2");
+  older.Put("col4", "old4");
+  older.PutTombstone("col5");
+  deserialized->Merge(older);
+  ASSERT_EQ(DELETED, deserialized->Get("col1", &val));
+  ASSERT_EQ(SUCCESS, deserialized->Get("col2", &val));
+  ASSERT_EQ("val2", val);
+  ASSERT_EQ(SUCCESS, deserialized->Get("col4", &val));
+  ASSERT_EQ("old4", val);
+  ASSERT_EQ(DELETED, deserialized->Get("col5", &val));
+  deserialized->DropTombstones();
+  ASSERT_EQ(NOT_FOUND, deserialized->Get("col1", &val));
+  ASSERT_EQ(0u, deserialized->NumTombstones());
+  // A later put replaces the tombstone.
+  ASSERT_EQ(SUCCESS, row->Put("col1", "val3"));
+  ASSERT_EQ(SUCCESS, row->Get("col1", &val));
+  ASSERT_EQ(1u, row->NumTombstones());
+}
+
 } //namepsace Tabula
\ No newline at end of file
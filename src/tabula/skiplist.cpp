@@ -0,0 +1,212 @@
+#include <string.h>
+#include <new>
+#include "skiplist.h"
+
+using std::string;
+
+namespace KVStore {
+
+struct SkipList::Node {
+  const char* key;  // Row bytes followed by column bytes
+  uint32_t row_len;
+  uint32_t col_len;
+  std::atomic<const Value*> value;  // nullptr once deleted
+  int height;
+  // Followed by height - 1 more links
+  std::atomic<Node*> next[1];
+};
+
+SkipList::SkipList() : arena_(std::make_shared<Arena>()), height_(1) {
+  Key empty = {nullptr, 0, nullptr, 0};
+  head_ = NewNode(empty, SKIP_LIST_MAX_HEIGHT, nullptr);
+}
+
+// Nodes and values are plain data in the arena, which frees them all.
+SkipList::~SkipList() { }
+
+SkipList::Node* SkipList::NewNode(const Key& key, int height, const Value* value) {
+  size_t size = sizeof(Node) + (height - 1) * sizeof(std::atomic<Node*>);
+  char* mem = arena_->Allocate(size + key.row_len + key.col_len);
+  char* key_mem = mem + size;
+  memcpy(key_mem, key.row, key.row_len);
+  memcpy(key_mem + key.row_len, key.col, key.col_len);
+  Node* node = new (mem) Node();
+  node->key = key_mem;
+  node->row_len = key.row_len;
+  node->col_len = key.col_len;
+  node->value.store(value, std::memory_order_relaxed);
+  node->height = height;
+  for (int i = 0; i < height; i++) {
+    new (&node->next[i]) std::atomic<Node*>(nullptr);
+  }
+  return node;
+}
+
+const SkipList::Value* SkipList::NewValue(const string& val) {
+  char* mem = arena_->Allocate(sizeof(Value) + val.length());
+  Value* value = new (mem) Value();
+  value->len = val.length();
+  value->updated = time(0);
+  memcpy(mem + sizeof(Value), val.data(), val.length());
+  return value;
+}
+
+static int CompareBytes(const char* a, size_t a_len, const char* b, size_t b_len) {
+  int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+int SkipList::Compare(const Node* node, const Key& key) {
+  int cmp = CompareBytes(node->key, node->row_len, key.row, key.row_len);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return CompareBytes(node->key + node->row_len, node->col_len, key.col, key.col_len);
+}
+
+void SkipList::FindAtLevel(const Key& key, int level, Node** prev, Node** next) const {
+  Node* x = *prev;
+  while (true) {
+    Node* n = x->next[level].load(std::memory_order_acquire);
+    if (n == nullptr || Compare(n, key) >= 0) {
+      *prev = x;
+      *next = n;
+      return;
+    }
+    x = n;
+  }
+}
+
+void SkipList::FindSplice(const Key& key, Node** prev, Node** next) const {
+  Node* x = head_;
+  for (int level = SKIP_LIST_MAX_HEIGHT - 1; level >= 0; level--) {
+    FindAtLevel(key, level, &x, &next[level]);
+    prev[level] = x;
+  }
+}
+
+int SkipList::RandomHeight() {
+  // Each level holds a quarter of the one below.
+  static thread_local uint32_t state = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&state)) | 1;
+  int height = 1;
+  while (height < SKIP_LIST_MAX_HEIGHT) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    if ((state & 3) != 0) {
+      break;
+    }
+    height++;
+  }
+  return height;
+}
+
+int SkipList::Overwrite(Node* node, const Value* value) {
+  const Value* old = node->value.exchange(value, std::memory_order_acq_rel);
+  return old == nullptr ? SUCCESS : OVERWRITE;
+}
+
+int SkipList::Put(const string& row, const string& col, const string& val) {
+  Key key = {row.data(), row.length(), col.data(), col.length()};
+  return Insert(key, NewValue(val));
+}
+
+int SkipList::Insert(const Key& key, const Value* value) {
+  Node* prev[SKIP_LIST_MAX_HEIGHT];
+  Node* next[SKIP_LIST_MAX_HEIGHT];
+  FindSplice(key, prev, next);
+  if (next[0] != nullptr && Compare(next[0], key) == 0) {
+    return Overwrite(next[0], value);
+  }
+  int height = RandomHeight();
+  int list_height = height_.load(std::memory_order_relaxed);
+  while (height > list_height && !height_.compare_exchange_weak(list_height, height)) { }
+  Node* node = NewNode(key, height, value);
+
+  // Level 0 decides whether the entry exists.
+  while (true) {
+    node->next[0].store(next[0], std::memory_order_relaxed);
+    if (prev[0]->next[0].compare_exchange_strong(next[0], node, std::memory_order_release, std::memory_order_relaxed)) {
+      break;
+    }
+    FindAtLevel(key, 0, &prev[0], &next[0]);
+    if (next[0] != nullptr && Compare(next[0], key) == 0) {
+      // Another writer inserted the same key first; our node stays unlinked.
+      return Overwrite(next[0], value);
+    }
+  }
+  for (int level = 1; level < height; level++) {
+    while (true) {
+      node->next[level].store(next[level], std::memory_order_relaxed);
+      if (prev[level]->next[level].compare_exchange_strong(next[level], node, std::memory_order_release, std::memory_order_relaxed)) {
+        break;
+      }
+      FindAtLevel(key, level, &prev[level], &next[level]);
+    }
+  }
+  return SUCCESS;
+}
+
+int SkipList::GetRef(const string& row, const string& col, Utils::SharedBuffer* val) const {
+  Key key = {row.data(), row.length(), col.data(), col.length()};
+  Node* x = head_;
+  Node* next = nullptr;
+  for (int level = height_.load(std::memory_order_relaxed) - 1; level >= 0; level--) {
+    FindAtLevel(key, level, &x, &next);
+  }
+  if (next == nullptr || Compare(next, key) != 0) {
+    return NOT_FOUND;
+  }
+  const Value* value = next->value.load(std::memory_order_acquire);
+  if (value == nullptr) {
+    return DELETED;
+  }
+  *val = Utils::SharedBuffer(arena_, value->Data(), value->len);
+  return SUCCESS;
+}
+
+int SkipList::Delete(const string& row, const string& col) {
+  Key key = {row.data(), row.length(), col.data(), col.length()};
+  // Overwrite reports OVERWRITE when the old value was live.
+  return Insert(key, nullptr) == OVERWRITE ? SUCCESS : NOT_FOUND;
+}
+
+size_t SkipList::MemoryUsage() const {
+  return arena_->MemoryUsage();
+}
+
+bool SkipList::Empty() const {
+  return head_->next[0].load(std::memory_order_acquire) == nullptr;
+}
+
+SkipList::Iterator::Iterator(const SkipList* list)
+  : list_(list), node_(list->head_->next[0].load(std::memory_order_acquire)) { }
+
+bool SkipList::Iterator::Valid() const {
+  return node_ != nullptr;
+}
+
+void SkipList::Iterator::Next() {
+  node_ = node_->next[0].load(std::memory_order_acquire);
+}
+
+string SkipList::Iterator::Row() const {
+  return string(node_->key, node_->row_len);
+}
+
+string SkipList::Iterator::Col() const {
+  return string(node_->key + node_->row_len, node_->col_len);
+}
+
+const SkipList::Value* SkipList::Iterator::GetValue() const {
+  return node_->value.load(std::memory_order_acquire);
+}
+
+Utils::SharedBuffer SkipList::Iterator::Ref(const Value* value) const {
+  return Utils::SharedBuffer(list_->arena_, value->Data(), value->len);
+}
+
+} // namespace KVStore
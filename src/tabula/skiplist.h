@@ -0,0 +1,99 @@
+#ifndef SKIP_LIST_H_
+#define SKIP_LIST_H_
+
+#define SKIP_LIST_MAX_HEIGHT 12
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <time.h>
+#include "arena.h"
+#include "tabulaenums.h"
+#include "../sharedbuffer.h"
+
+namespace KVStore {
+
+// Sorted (row, col) -> value map for the memtable. Nodes, keys and values
+// all live in an arena, so an insert is a few bump allocations and nothing
+// is freed until the whole list goes away.
+//
+// Readers take no locks: links are only ever published with release stores
+// and followed with acquire loads. Writers insert with compare-and-swap,
+// linking level 0 first (which makes the entry visible) and then the upper
+// levels, retrying from the nearest predecessor when they race. Entries are
+// never unlinked; overwriting swaps the entry's value pointer and deleting
+// swaps in nullptr, a tombstone. Deleting a column the list does not have
+// inserts one, so the delete still hides the column in older tables.
+class SkipList {
+  private:
+    struct Node;
+
+  public:
+    // A value record; the bytes follow it in the arena.
+    struct Value {
+      uint64_t len;
+      time_t updated;
+      const char* Data() const {
+        return reinterpret_cast<const char*>(this + 1);
+      }
+    };
+
+    SkipList();
+    ~SkipList();
+    // Returns SUCCESS for a new column and OVERWRITE for an existing one.
+    int Put(const std::string& row, const std::string& col, const std::string& val);
+    // [val] shares the arena, which lives as long as any such reference.
+    // Returns DELETED for a tombstone.
+    int GetRef(const std::string& row, const std::string& col, Utils::SharedBuffer* val) const;
+    // Returns SUCCESS if a value was replaced, NOT_FOUND otherwise.
+    int Delete(const std::string& row, const std::string& col);
+    // Bytes allocated from the arena so far.
+    size_t MemoryUsage() const;
+    // True until the first insert; deleted entries still count.
+    bool Empty() const;
+
+    // Walks the entries in order, including tombstones (value nullptr).
+    // Entries inserted during the walk may or may not be seen.
+    class Iterator {
+      public:
+        explicit Iterator(const SkipList* list);
+        bool Valid() const;
+        void Next();
+        std::string Row() const;
+        std::string Col() const;
+        const Value* GetValue() const;
+        // The bytes of [value], as returned by GetValue, sharing the arena.
+        Utils::SharedBuffer Ref(const Value* value) const;
+      private:
+        const SkipList* list_;
+        const Node* node_;
+    };
+
+  private:
+    struct Key {
+      const char* row;
+      size_t row_len;
+      const char* col;
+      size_t col_len;
+    };
+    Node* NewNode(const Key& key, int height, const Value* value);
+    const Value* NewValue(const std::string& val);
+    // Links a node for [key], or overwrites the one there is; [value] is
+    // nullptr for a tombstone.
+    int Insert(const Key& key, const Value* value);
+    static int Overwrite(Node* node, const Value* value);
+    static int Compare(const Node* node, const Key& key);
+    // Finds the nodes around [key] at every level.
+    void FindSplice(const Key& key, Node** prev, Node** next) const;
+    // Moves [prev] forward at [level] until its successor is >= [key].
+    void FindAtLevel(const Key& key, int level, Node** prev, Node** next) const;
+    int RandomHeight();
+
+    std::shared_ptr<Arena> arena_;
+    Node* head_;
+    std::atomic<int> height_;
+};
+
+} // namespace KVStore
+
+#endif
@@ -0,0 +1,432 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <atomic>
+#include "sstable.h"
+#include "crc32c.h"
+
+using std::string;
+
+namespace KVStore {
+
+static void EncodeHandle(const BlockHandle& handle, string* out) {
+  out->append(reinterpret_cast<const char*>(&handle.offset), sizeof(handle.offset));
+  out->append(reinterpret_cast<const char*>(&handle.size), sizeof(handle.size));
+}
+
+static bool DecodeHandle(const char* data, size_t len, BlockHandle* handle) {
+  if (len != sizeof(handle->offset) + sizeof(handle->size)) {
+    return false;
+  }
+  memcpy(&handle->offset, data, sizeof(handle->offset));
+  memcpy(&handle->size, data + sizeof(handle->offset), sizeof(handle->size));
+  return true;
+}
+
+SSTableOptions::SSTableOptions()
+  : blockSize(SS_TABLE_DEFAULT_BLOCK_SIZE),
+    restartInterval(BLOCK_DEFAULT_RESTART_INTERVAL),
+    bloomBitsPerKey(BLOOM_FILTER_DEFAULT_BITS_PER_KEY),
+    level(0) {}
+
+static bool HandleInFile(const BlockHandle& handle, uint64_t fileSize) {
+  return handle.offset + SS_TABLE_BLOCK_TRAILER_LENGTH <= fileSize &&
+         handle.size <= fileSize - handle.offset - SS_TABLE_BLOCK_TRAILER_LENGTH;
+}
+
+SSTableBuilder::SSTableBuilder(
+  const string& path,
+  const SSTableOptions& options
+) : options_(options),
+    dataBlock_(options.restartInterval),
+    // Index lookups binary search every entry.
+    indexBlock_(1),
+    offset_(0),
+    numRows_(0),
+    failed_(false) {
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXO | S_IRWXG | S_IRWXU);
+  failed_ = fd_ == -1;
+}
+
+SSTableBuilder::~SSTableBuilder() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+void SSTableBuilder::Add(const string& row, const string& columns) {
+  dataBlock_.Add(row, columns);
+  numRows_++;
+  if (options_.bloomBitsPerKey > 0) {
+    hashes_.push_back(BloomFilter::Hash(row));
+  }
+  if (dataBlock_.CurrentSize() >= options_.blockSize) {
+    FlushDataBlock();
+  }
+}
+
+void SSTableBuilder::FlushDataBlock() {
+  if (dataBlock_.Empty()) {
+    return;
+  }
+  BlockHandle handle;
+  WriteBlock(dataBlock_.Finish(), &handle);
+  string encoded;
+  EncodeHandle(handle, &encoded);
+  indexBlock_.Add(dataBlock_.LastKey(), encoded);
+  dataBlock_.Reset();
+}
+
+void SSTableBuilder::WriteBlock(const string& contents, BlockHandle* handle) {
+  handle->offset = offset_;
+  handle->size = contents.length();
+  uint32_t crc = Crc32c(contents.data(), contents.length());
+  struct iovec iov[2] = {
+    {const_cast<char*>(contents.data()), contents.length()},
+    {&crc, sizeof(crc)},
+  };
+  ssize_t len = contents.length() + sizeof(crc);
+  if (fd_ == -1 || writev(fd_, iov, 2) != len) {
+    failed_ = true;
+  }
+  offset_ += len;
+}
+
+int SSTableBuilder::Finish() {
+  FlushDataBlock();
+  BlockBuilder metaIndexBlock(1);
+  if (options_.bloomBitsPerKey > 0) {
+    string filter;
+    BloomFilter::Build(hashes_, options_.bloomBitsPerKey, &filter);
+    BlockHandle filterHandle;
+    WriteBlock(filter, &filterHandle);
+    string encoded;
+    EncodeHandle(filterHandle, &encoded);
+    metaIndexBlock.Add(SS_TABLE_BLOOM_FILTER_BLOCK, encoded);
+  }
+  // Keys go in sorted order.
+  metaIndexBlock.Add(
+    SS_TABLE_LEVEL_PROPERTY,
+    string(reinterpret_cast<const char*>(&options_.level), sizeof(options_.level))
+  );
+  BlockHandle metaIndexHandle;
+  WriteBlock(metaIndexBlock.Finish(), &metaIndexHandle);
+  BlockHandle indexHandle;
+  WriteBlock(indexBlock_.Finish(), &indexHandle);
+  string footer;
+  EncodeHandle(metaIndexHandle, &footer);
+  EncodeHandle(indexHandle, &footer);
+  uint32_t version = SS_TABLE_VERSION;
+  uint32_t magic = SS_TABLE_MAGIC;
+  footer.append(reinterpret_cast<const char*>(&version), sizeof(version));
+  footer.append(reinterpret_cast<const char*>(&magic), sizeof(magic));
+  if (fd_ == -1 || write(fd_, footer.data(), footer.length()) != static_cast<ssize_t>(footer.length())) {
+    failed_ = true;
+  }
+  offset_ += footer.length();
+  // The commit log is released once this returns.
+  if (fd_ != -1 && fdatasync(fd_) == -1) {
+    failed_ = true;
+  }
+  return failed_ ? -1 : SUCCESS;
+}
+
+uint64_t SSTableBuilder::NumRows() const {
+  return numRows_;
+}
+
+uint64_t SSTableBuilder::FileSize() const {
+  return offset_;
+}
+
+static std::atomic<uint64_t> nextTableId(0);
+
+static string CacheKey(uint64_t id, uint64_t offset) {
+  string key(reinterpret_cast<const char*>(&id), sizeof(id));
+  key.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+  return key;
+}
+
+SSTable::SSTable(int fd, std::shared_ptr<BlockCache> cache)
+  : fd_(fd),
+    id_(nextTableId++),
+    cache_(std::move(cache)),
+    indexHandle_({0, 0}),
+    filterHandle_({0, 0}),
+    numBlocks_(0),
+    fileSize_(0),
+    level_(0) {}
+
+SSTable::~SSTable() {
+  close(fd_);
+}
+
+std::unique_ptr<SSTable> SSTable::Open(
+  const string& path,
+  std::shared_ptr<BlockCache> cache,
+  bool pinIndexAndFilter
+) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return std::unique_ptr<SSTable>(nullptr);
+  }
+  struct stat st;
+  char footer[SS_TABLE_FOOTER_LENGTH];
+  uint32_t version;
+  uint32_t magic;
+  BlockHandle indexHandle;
+  if (fstat(fd, &st) == -1 || st.st_size < SS_TABLE_FOOTER_LENGTH ||
+      pread(fd, footer, sizeof(footer), st.st_size - SS_TABLE_FOOTER_LENGTH) != SS_TABLE_FOOTER_LENGTH) {
+    close(fd);
+    return std::unique_ptr<SSTable>(nullptr);
+  }
+  memcpy(&version, footer + 32, sizeof(version));
+  memcpy(&magic, footer + 36, sizeof(magic));
+  BlockHandle metaIndexHandle;
+  DecodeHandle(footer, 16, &metaIndexHandle);
+  DecodeHandle(footer + 16, 16, &indexHandle);
+  Utils::SharedBuffer indexContents;
+  Utils::SharedBuffer metaIndexContents;
+  if (magic != SS_TABLE_MAGIC || version != SS_TABLE_VERSION ||
+      !HandleInFile(indexHandle, st.st_size) || !HandleInFile(metaIndexHandle, st.st_size) ||
+      ReadBlock(fd, indexHandle, &indexContents) != SUCCESS ||
+      ReadBlock(fd, metaIndexHandle, &metaIndexContents) != SUCCESS) {
+    close(fd);
+    return std::unique_ptr<SSTable>(nullptr);
+  }
+  bool pinned = pinIndexAndFilter || cache == nullptr;
+  std::unique_ptr<SSTable> table(new SSTable(fd, cache));
+  std::shared_ptr<Block> index = std::make_shared<Block>(indexContents);
+  table->indexHandle_ = indexHandle;
+  if (pinned) {
+    table->index_ = index;
+  } else {
+    cache->Put(CacheKey(table->id_, indexHandle.offset), indexContents);
+  }
+  // Without a readable filter every lookup in range reads a block.
+  Block metaIndex(metaIndexContents);
+  Block::Iterator metaIt(&metaIndex);
+  metaIt.Seek(SS_TABLE_BLOOM_FILTER_BLOCK);
+  BlockHandle filterHandle;
+  if (metaIt.Valid() && metaIt.Key() == SS_TABLE_BLOOM_FILTER_BLOCK &&
+      DecodeHandle(metaIt.Value().Data(), metaIt.Value().Size(), &filterHandle) &&
+      HandleInFile(filterHandle, st.st_size)) {
+    Utils::SharedBuffer filter;
+    if (ReadBlock(fd, filterHandle, &filter) == SUCCESS) {
+      table->filterHandle_ = filterHandle;
+      if (pinned) {
+        table->filter_ = filter;
+      } else {
+        cache->Put(CacheKey(table->id_, filterHandle.offset), filter);
+      }
+    }
+  }
+  metaIt.Seek(SS_TABLE_LEVEL_PROPERTY);
+  if (metaIt.Valid() && metaIt.Key() == SS_TABLE_LEVEL_PROPERTY &&
+      metaIt.Value().Size() == sizeof(table->level_)) {
+    memcpy(&table->level_, metaIt.Value().Data(), sizeof(table->level_));
+  }
+  table->fileSize_ = st.st_size;
+  // The range comes from the first data block and the last index entry.
+  Block::Iterator it(index.get());
+  for (it.SeekToFirst(); it.Valid(); it.Next()) {
+    BlockHandle handle;
+    Utils::SharedBuffer contents;
+    if (table->numBlocks_++ == 0 &&
+        DecodeHandle(it.Value().Data(), it.Value().Size(), &handle) &&
+        ReadBlock(fd, handle, &contents) == SUCCESS) {
+      Block first(contents);
+      Block::Iterator firstIt(&first);
+      firstIt.SeekToFirst();
+      if (firstIt.Valid()) {
+        table->startRow_ = firstIt.Key();
+      }
+    }
+    table->endRow_ = it.Key();
+  }
+  return table;
+}
+
+bool SSTable::InRange(const string& row) const {
+  return numBlocks_ > 0 && row.compare(startRow_) >= 0 && row.compare(endRow_) <= 0;
+}
+
+bool SSTable::FilterMayMatch(const string& row) const {
+  if (filterHandle_.size == 0) {
+    return true;
+  }
+  if (index_ != nullptr) {
+    return BloomFilter::MayMatch(row, filter_.Data(), filter_.Size());
+  }
+  Utils::SharedBuffer filter;
+  if (ReadCachedBlock(filterHandle_, &filter, nullptr) != SUCCESS) {
+    return true;
+  }
+  return BloomFilter::MayMatch(row, filter.Data(), filter.Size());
+}
+
+int SSTable::ReadBlock(int fd, const BlockHandle& handle, Utils::SharedBuffer* contents) {
+  size_t len = handle.size + SS_TABLE_BLOCK_TRAILER_LENGTH;
+  string buf(len, '\0');
+  if (pread(fd, &buf[0], len, handle.offset) != static_cast<ssize_t>(len)) {
+    return READ_FAILED;
+  }
+  uint32_t crc;
+  memcpy(&crc, buf.data() + handle.size, sizeof(crc));
+  if (Crc32c(buf.data(), handle.size) != crc) {
+    return READ_FAILED;
+  }
+  *contents = Utils::SharedBuffer(std::move(buf)).Slice(0, handle.size);
+  return SUCCESS;
+}
+
+int SSTable::ReadCachedBlock(const BlockHandle& handle, Utils::SharedBuffer* contents, bool* cacheHit) const {
+  bool hit = cache_ != nullptr && cache_->Get(CacheKey(id_, handle.offset), contents) == 0;
+  if (cacheHit != nullptr) {
+    *cacheHit = hit;
+  }
+  if (hit) {
+    return SUCCESS;
+  }
+  int ret = ReadBlock(fd_, handle, contents);
+  if (ret != SUCCESS) {
+    return ret;
+  }
+  if (cache_ != nullptr) {
+    cache_->Put(CacheKey(id_, handle.offset), *contents);
+  }
+  return SUCCESS;
+}
+
+std::shared_ptr<Block> SSTable::IndexBlock(bool* failed) const {
+  if (index_ != nullptr) {
+    return index_;
+  }
+  Utils::SharedBuffer contents;
+  if (ReadCachedBlock(indexHandle_, &contents, nullptr) != SUCCESS) {
+    *failed = true;
+  }
+  return std::make_shared<Block>(contents);
+}
+
+int SSTable::Get(const string& row, std::unique_ptr<Row>* result, bool* cacheHit) {
+  if (cacheHit != nullptr) {
+    *cacheHit = false;
+  }
+  if (!InRange(row) || !FilterMayMatch(row)) {
+    return NOT_FOUND;
+  }
+  // The first block whose last row is at or after [row]
+  bool failed = false;
+  std::shared_ptr<Block> index = IndexBlock(&failed);
+  Block::Iterator indexIt(index.get());
+  indexIt.Seek(row);
+  BlockHandle handle;
+  Utils::SharedBuffer contents;
+  // The row is in range, so the index has a block for it unless it is
+  // damaged.
+  if (failed || !indexIt.Valid() ||
+      !DecodeHandle(indexIt.Value().Data(), indexIt.Value().Size(), &handle) ||
+      ReadCachedBlock(handle, &contents, cacheHit) != SUCCESS) {
+    return READ_FAILED;
+  }
+  Block block(contents);
+  Block::Iterator it(&block);
+  it.Seek(row);
+  if (!it.Valid() || it.Key() != row) {
+    return NOT_FOUND;
+  }
+  *result = Row::DeserializeColumns(row, it.Value());
+  return *result == nullptr ? READ_FAILED : SUCCESS;
+}
+
+const string& SSTable::StartRow() const {
+  return startRow_;
+}
+
+const string& SSTable::EndRow() const {
+  return endRow_;
+}
+
+uint64_t SSTable::NumBlocks() const {
+  return numBlocks_;
+}
+
+uint64_t SSTable::FileSize() const {
+  return fileSize_;
+}
+
+uint32_t SSTable::Level() const {
+  return level_;
+}
+
+SSTable::Iterator::Iterator(const SSTable* table)
+  : table_(table),
+    failed_(false),
+    index_(table->IndexBlock(&failed_)),
+    indexIt_(index_.get()) {}
+
+void SSTable::Iterator::SeekToFirst() {
+  indexIt_.SeekToFirst();
+  ReadDataBlock();
+}
+
+void SSTable::Iterator::ReadDataBlock() {
+  blockIt_.reset();
+  for (; indexIt_.Valid(); indexIt_.Next()) {
+    BlockHandle handle;
+    Utils::SharedBuffer contents;
+    if (!DecodeHandle(indexIt_.Value().Data(), indexIt_.Value().Size(), &handle) ||
+        ReadBlock(table_->fd_, handle, &contents) != SUCCESS) {
+      failed_ = true;
+      return;
+    }
+    block_ = std::make_unique<Block>(contents);
+    blockIt_ = std::make_unique<Block::Iterator>(block_.get());
+    blockIt_->SeekToFirst();
+    if (blockIt_->Valid()) {
+      return;
+    }
+  }
+  blockIt_.reset();
+}
+
+bool SSTable::Iterator::Valid() const {
+  return blockIt_ != nullptr && blockIt_->Valid();
+}
+
+void SSTable::Iterator::Next() {
+  blockIt_->Next();
+  if (!blockIt_->Valid()) {
+    indexIt_.Next();
+    ReadDataBlock();
+  }
+}
+
+const string& SSTable::Iterator::Key() const {
+  return blockIt_->Key();
+}
+
+Utils::SharedBuffer SSTable::Iterator::Value() const {
+  return blockIt_->Value();
+}
+
+bool SSTable::Iterator::Failed() const {
+  return failed_;
+}
+
+size_t SSTable::IndexSize() const {
+  return indexHandle_.size;
+}
+
+size_t SSTable::FilterSize() const {
+  return filterHandle_.size;
+}
+
+bool SSTable::Pinned() const {
+  return index_ != nullptr;
+}
+
+} // namespace KVStore
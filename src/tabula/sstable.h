@@ -0,0 +1,189 @@
+#ifndef SS_TABLE_H_
+#define SS_TABLE_H_
+#define SS_TABLE_FILE_EXT ".sst"
+#define SS_TABLE_MAGIC 0x54534254 // "TBST"
+#define SS_TABLE_VERSION 2
+#define SS_TABLE_FOOTER_LENGTH 40
+// CRC32C after every block
+#define SS_TABLE_BLOCK_TRAILER_LENGTH 4
+// A data block is cut once it reaches this many bytes.
+#define SS_TABLE_DEFAULT_BLOCK_SIZE 4096
+// Meta index name of the Bloom filter over the table's rows
+#define SS_TABLE_BLOOM_FILTER_BLOCK "filter.bloom"
+// Meta index name of the level the file was written for, kept inline
+#define SS_TABLE_LEVEL_PROPERTY "tabula.level"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "block.h"
+#include "bloomfilter.h"
+#include "row.h"
+#include "tabulaenums.h"
+#include "../lrucache.h"
+#include "../sharedbuffer.h"
+
+namespace KVStore {
+
+/*
+ An SSTable file:
+
+ data blocks
+ meta index block
+ index block
+ footer
+
+ Data blocks map row names to Row::SerializeColumns. The index block maps
+ the last row of each data block to the block's handle, and the meta index
+ block maps names to the handles of optional blocks, such as the Bloom
+ filter, or to small values, such as the level. A handle is an offset
+ (8 bytes) and a size (8 bytes), not counting the trailer. The footer is:
+
+ meta index handle (16 bytes)
+ index handle      (16 bytes)
+ version           (4 bytes)
+ magic             (4 bytes)
+ */
+
+struct BlockHandle {
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Charges a cached block its bytes and its key.
+struct BlockWeigher {
+  size_t operator()(const std::string& key, const Utils::SharedBuffer& block) const {
+    return key.length() + block.Size();
+  }
+};
+// Blocks of any number of SSTables, keyed by table id and block offset
+typedef ShardedLRUCache<std::string, Utils::SharedBuffer, LRUPolicy<std::string>, BlockWeigher> BlockCache;
+
+struct SSTableOptions {
+  SSTableOptions();
+  // The in-memory index holds one entry per data block.
+  uint32_t blockSize;
+  // Rows between the samples a lookup binary searches within a block
+  uint32_t restartInterval;
+  // 0 writes no filter.
+  uint32_t bloomBitsPerKey;
+  // Recorded in the file, so Recover can put it back in its level.
+  uint32_t level;
+};
+
+class SSTableBuilder {
+public:
+  SSTableBuilder(const std::string& path, const SSTableOptions& options);
+  ~SSTableBuilder();
+  // Rows must be added in increasing order.
+  void Add(const std::string& row, const std::string& columns);
+  // Writes the index blocks and the footer, then syncs the file. Returns
+  // SUCCESS, or -1 if any write failed.
+  int Finish();
+  uint64_t NumRows() const;
+  uint64_t FileSize() const;
+
+private:
+  void FlushDataBlock();
+  void WriteBlock(const std::string& contents, BlockHandle* handle);
+
+  int fd_;
+  SSTableOptions options_;
+  BlockBuilder dataBlock_;
+  BlockBuilder indexBlock_;
+  uint64_t offset_;
+  uint64_t numRows_;
+  bool failed_;
+  // Of every row, for the filter
+  std::vector<uint64_t> hashes_;
+};
+
+class SSTable {
+public:
+  // Returns nullptr unless [path] is an SSTable of this version. Data blocks
+  // are read through [cache], which many tables may share, if it is set.
+  // Unless [pinIndexAndFilter], the index and filter blocks go through it
+  // too rather than staying in memory for the life of the table.
+  static std::unique_ptr<SSTable> Open(
+    const std::string& path,
+    std::shared_ptr<BlockCache> cache = nullptr,
+    bool pinIndexAndFilter = true
+  );
+  ~SSTable();
+  // Get finds nothing if either of these is false. Neither reads from disk.
+  bool InRange(const std::string& row) const;
+  // True if the table has no filter.
+  bool FilterMayMatch(const std::string& row) const;
+  // Reads the one data block that can hold [row]. Column values in
+  // [result] share the block's memory. [cacheHit], if set, tells whether
+  // the block came from the cache. Returns NOT_FOUND only if the row is out
+  // of range, filtered out, or missing from the block read for it, and
+  // READ_FAILED if a block needed could not be read or was damaged.
+  int Get(const std::string& row, std::unique_ptr<Row>* result, bool* cacheHit = nullptr);
+  const std::string& StartRow() const;
+  const std::string& EndRow() const;
+  uint64_t NumBlocks() const;
+  uint64_t FileSize() const;
+  uint32_t Level() const;
+  // Bytes of the index and of the filter, which are in memory if pinned;
+  // the filter's is 0 if the table has none.
+  size_t IndexSize() const;
+  size_t FilterSize() const;
+  bool Pinned() const;
+
+  // Walks every row in order, reading one block at a time. Data blocks
+  // bypass the cache, so a scan does not push out what lookups use.
+  class Iterator {
+  public:
+    explicit Iterator(const SSTable* table);
+    void SeekToFirst();
+    bool Valid() const;
+    void Next();
+    const std::string& Key() const;
+    Utils::SharedBuffer Value() const;
+    // Set if a block failed to read or check; the iterator stops there.
+    bool Failed() const;
+
+  private:
+    // Reads the block indexIt_ points at, moving past empty ones.
+    void ReadDataBlock();
+
+    const SSTable* table_;
+    bool failed_;
+    std::shared_ptr<Block> index_;
+    Block::Iterator indexIt_;
+    std::unique_ptr<Block> block_;
+    std::unique_ptr<Block::Iterator> blockIt_;
+  };
+
+private:
+  SSTable(int fd, std::shared_ptr<BlockCache> cache);
+  // Reads the block at [handle] and checks it against its trailer. Returns
+  // READ_FAILED on a short read or a checksum mismatch.
+  static int ReadBlock(int fd, const BlockHandle& handle, Utils::SharedBuffer* contents);
+  // ReadBlock through the cache, if there is one.
+  int ReadCachedBlock(const BlockHandle& handle, Utils::SharedBuffer* contents, bool* cacheHit) const;
+  // The pinned index, or one read through the cache. If that fails, sets
+  // [failed] and returns an empty block.
+  std::shared_ptr<Block> IndexBlock(bool* failed) const;
+
+  int fd_;
+  // Tells this table's blocks apart from other tables' in the cache
+  uint64_t id_;
+  std::shared_ptr<BlockCache> cache_;
+  // Set if pinned
+  std::shared_ptr<Block> index_;
+  Utils::SharedBuffer filter_;
+  BlockHandle indexHandle_;
+  // Size 0 if there is no filter
+  BlockHandle filterHandle_;
+  std::string startRow_;
+  std::string endRow_;
+  uint64_t numBlocks_;
+  uint64_t fileSize_;
+  uint32_t level_;
+};
+
+} // namespace KVStore
+
+#endif
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "sstable.h"
+
+using std::string;
+using std::vector;
+using namespace KVStore;
+
+// Measures SSTable lookups per second against the memory the index takes,
+// for a range of block sizes and restart intervals.
+
+static double NowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static string RowName(int i) {
+  char row[32];
+  snprintf(row, sizeof(row), "user%012d", i);
+  return row;
+}
+
+int main(int argc, char** argv) {
+  int rows = 200000;
+  int valueSize = 100;
+  int lookups = 200000;
+  string dir = ".";
+  int c;
+  while ((c = getopt(argc, argv, "r:v:l:d:")) != -1) {
+    switch(c) {
+      case 'r':
+        rows = atoi(optarg);
+        break;
+      case 'v':
+        valueSize = atoi(optarg);
+        break;
+      case 'l':
+        lookups = atoi(optarg);
+        break;
+      case 'd':
+        dir = optarg;
+        break;
+      case '?':
+        std::cout << optopt << " is not an accepted argument." << std::endl;
+        return 1;
+      default:
+        abort();
+    }
+  }
+  string path = dir + "/bench" + std::to_string(getpid()) + SS_TABLE_FILE_EXT;
+  vector<string> columns(rows);
+  for (int i = 0; i < rows; i++) {
+    Row row(RowName(i), i);
+    row.PutWithoutUpdateTime("col", string(valueSize, 'v'));
+    row.SerializeColumns(&columns[i]);
+  }
+  vector<int> keys(lookups);
+  srand(1);
+  for (int& key : keys) {
+    key = rand() % rows;
+  }
+  std::cout << rows << " rows, " << valueSize << " byte values, "
+            << lookups << " random lookups" << std::endl;
+  std::cout << std::left << std::setw(12) << "block size" << std::setw(10) << "interval"
+            << std::setw(14) << "index bytes" << std::setw(14) << "file bytes"
+            << "lookups/s" << std::endl;
+  const uint32_t blockSizes[] = {1024, 4096, 16384};
+  const uint32_t intervals[] = {1, 4, 16, 64};
+  for (uint32_t blockSize : blockSizes) {
+    for (uint32_t interval : intervals) {
+      SSTableOptions options;
+      options.blockSize = blockSize;
+      options.restartInterval = interval;
+      uint64_t fileSize;
+      {
+        SSTableBuilder builder(path, options);
+        for (int i = 0; i < rows; i++) {
+          builder.Add(RowName(i), columns[i]);
+        }
+        builder.Finish();
+        fileSize = builder.FileSize();
+      }
+      std::unique_ptr<SSTable> ssTable = SSTable::Open(path);
+      if (ssTable == nullptr) {
+        std::cout << "Failed to open " << path << std::endl;
+        return EXIT_FAILURE;
+      }
+      std::unique_ptr<Row> row;
+      double start = NowSeconds();
+      for (int key : keys) {
+        ssTable->Get(RowName(key), &row);
+      }
+      double elapsed = NowSeconds() - start;
+      std::cout << std::setw(12) << blockSize << std::setw(10) << interval
+                << std::setw(14) << ssTable->IndexSize() << std::setw(14) << fileSize
+                << static_cast<uint64_t>(lookups / elapsed) << std::endl;
+    }
+  }
+  remove(path.c_str());
+  return EXIT_SUCCESS;
+}
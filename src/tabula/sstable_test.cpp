@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mergingiterator.h"
+#include "sstable.h"
+
+namespace KVStore {
+
+class SSTableTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+      path_ = "./sstable_test" SS_TABLE_FILE_EXT;
+      Build(BLOOM_FILTER_DEFAULT_BITS_PER_KEY);
+    }
+    // Writes the even rows up to 1000.
+    void Build(uint32_t bloomBitsPerKey, uint32_t restartInterval = 4) {
+      // Enough rows for many blocks; the shared prefixes get compressed.
+      SSTableOptions options;
+      options.blockSize = 512;
+      options.restartInterval = restartInterval;
+      options.bloomBitsPerKey = bloomBitsPerKey;
+      SSTableBuilder builder(path_, options);
+      for (int i = 0; i < 1000; i += 2) {
+        Row row(RowName(i), i);
+        row.PutWithoutUpdateTime("col", "val" + std::to_string(i));
+        std::string columns;
+        row.SerializeColumns(&columns);
+        builder.Add(row.Name(), columns);
+      }
+      ASSERT_EQ(SUCCESS, builder.Finish());
+    }
+    void TearDown() override {
+      remove(path_.c_str());
+    }
+    static std::string RowName(int i) {
+      char name[32];
+      snprintf(name, sizeof(name), "user/profile/%06d", i);
+      return name;
+    }
+    std::string path_;
+};
+
+TEST_F(SSTableTest, TestGet) {
+  std::unique_ptr<SSTable> ssTable = SSTable::Open(path_);
+  ASSERT_NE(nullptr, ssTable.get());
+  ASSERT_GT(ssTable->NumBlocks(), 10u);
+  ASSERT_EQ(RowName(0), ssTable->StartRow());
+  ASSERT_EQ(RowName(998), ssTable->EndRow());
+  std::unique_ptr<Row> row;
+  std::string val;
+  for (int i = 0; i < 1000; i++) {
+    if (i % 2 == 1) {
+      ASSERT_EQ(NOT_FOUND, ssTable->Get(RowName(i), &row));
+      continue;
+    }
+    ASSERT_EQ(SUCCESS, ssTable->Get(RowName(i), &row));
+    ASSERT_EQ(RowName(i), row->Name());
+    ASSERT_EQ(i, row->LastUpdateTime());
+    ASSERT_EQ(SUCCESS, row->Get("col", &val));
+    ASSERT_EQ("val" + std::to_string(i), val);
+  }
+  ASSERT_EQ(NOT_FOUND, ssTable->Get("a", &row));
+  ASSERT_EQ(NOT_FOUND, ssTable->Get("z", &row));
+}
+
+TEST_F(SSTableTest, TestRestartIntervals) {
+  // Rows between the samples are found by scanning from the one before.
+  for (uint32_t interval : {1, 3, 64}) {
+    Build(0, interval);
+    std::unique_ptr<SSTable> ssTable = SSTable::Open(path_);
+    ASSERT_NE(nullptr, ssTable.get());
+    std::unique_ptr<Row> row;
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_EQ(i % 2 == 0 ? SUCCESS : NOT_FOUND, ssTable->Get(RowName(i), &row));
+    }
+  }
+}
+
+TEST_F(SSTableTest, TestBloomFilter) {
+  std::unique_ptr<SSTable> ssTable = SSTable::Open(path_);
+  ASSERT_NE(nullptr, ssTable.get());
+  ASSERT_GT(ssTable->FilterSize(), 500 * BLOOM_FILTER_DEFAULT_BITS_PER_KEY / 8u);
+  int falsePositives = 0;
+  for (int i = 0; i < 1000; i++) {
+    if (i % 2 == 0) {
+      ASSERT_TRUE(ssTable->FilterMayMatch(RowName(i)));
+    } else if (ssTable->FilterMayMatch(RowName(i))) {
+      falsePositives++;
+    }
+  }
+  // About 1% is expected.
+  ASSERT_LT(falsePositives, 25);
+  ASSERT_NEAR(0.01, BloomFilter::FalsePositiveRate(BLOOM_FILTER_DEFAULT_BITS_PER_KEY), 0.005);
+  ASSERT_EQ(10u, BloomFilter::BitsPerKey(0.01));
+
+  ssTable.reset();
+  Build(0);
+  ssTable = SSTable::Open(path_);
+  ASSERT_NE(nullptr, ssTable.get());
+  ASSERT_EQ(0u, ssTable->FilterSize());
+  ASSERT_TRUE(ssTable->FilterMayMatch(RowName(1)));
+  std::unique_ptr<Row> row;
+  ASSERT_EQ(SUCCESS, ssTable->Get(RowName(2), &row));
+}
+
+TEST_F(SSTableTest, TestMergingIterator) {
+  // The odd rows go in a second, newer table that also rewrites row 0.
+  std::string newerPath = "./sstable_test_newer" SS_TABLE_FILE_EXT;
+  {
+    SSTableOptions options;
+    options.blockSize = 512;
+    options.level = 1;
+    SSTableBuilder builder(newerPath, options);
+    for (int i = 0; i < 1000; i++) {
+      if (i % 2 == 0 && i != 0) {
+        continue;
+      }
+      builder.Add(RowName(i), "newer" + std::to_string(i));
+    }
+    ASSERT_EQ(SUCCESS, builder.Finish());
+  }
+  std::unique_ptr<SSTable> older = SSTable::Open(path_);
+  std::unique_ptr<SSTable> newer = SSTable::Open(newerPath);
+  ASSERT_NE(nullptr, older.get());
+  ASSERT_NE(nullptr, newer.get());
+  ASSERT_EQ(0u, older->Level());
+  ASSERT_EQ(1u, newer->Level());
+  std::vector<std::unique_ptr<SSTable::Iterator> > children;
+  children.push_back(std::make_unique<SSTable::Iterator>(newer.get()));
+  children.push_back(std::make_unique<SSTable::Iterator>(older.get()));
+  MergingIterator it(std::move(children));
+  int i = 0;
+  for (it.SeekToFirst(); it.Valid(); it.Next(), i++) {
+    ASSERT_EQ(RowName(i), it.Key());
+    if (i % 2 == 1) {
+      ASSERT_EQ(1u, it.Values().size());
+      ASSERT_EQ("newer" + std::to_string(i), it.Values()[0].ToString());
+    } else {
+      // Newest first
+      ASSERT_EQ(i == 0 ? 2u : 1u, it.Values().size());
+      if (i == 0) {
+        ASSERT_EQ("newer0", it.Values().front().ToString());
+      }
+      std::unique_ptr<Row> row = Row::DeserializeColumns(it.Key(), it.Values().back());
+      ASSERT_NE(nullptr, row.get());
+    }
+  }
+  ASSERT_EQ(1000, i);
+  ASSERT_FALSE(it.Failed());
+  remove(newerPath.c_str());
+}
+
+TEST_F(SSTableTest, TestBlockCache) {
+  std::shared_ptr<BlockCache> cache = std::make_shared<BlockCache>(1024 * 1024, 4);
+  for (bool pinned : {true, false}) {
+    std::unique_ptr<SSTable> ssTable = SSTable::Open(path_, cache, pinned);
+    ASSERT_NE(nullptr, ssTable.get());
+    ASSERT_EQ(pinned, ssTable->Pinned());
+    std::unique_ptr<Row> row;
+    bool cacheHit;
+    ASSERT_EQ(SUCCESS, ssTable->Get(RowName(10), &row, &cacheHit));
+    ASSERT_FALSE(cacheHit);
+    ASSERT_EQ(SUCCESS, ssTable->Get(RowName(10), &row, &cacheHit));
+    ASSERT_TRUE(cacheHit);
+    std::string val;
+    ASSERT_EQ(SUCCESS, row->Get("col", &val));
+    ASSERT_EQ("val10", val);
+    ASSERT_FALSE(ssTable->FilterMayMatch(RowName(1)) && ssTable->FilterMayMatch(RowName(3)) &&
+                 ssTable->FilterMayMatch(RowName(5)) && ssTable->FilterMayMatch(RowName(7)));
+    // Scans read around the cache.
+    size_t cached = cache->Size();
+    SSTable::Iterator it(ssTable.get());
+    int rows = 0;
+    for (it.SeekToFirst(); it.Valid(); it.Next()) {
+      rows++;
+    }
+    ASSERT_EQ(500, rows);
+    ASSERT_FALSE(it.Failed());
+    ASSERT_EQ(cached, cache->Size());
+  }
+  // A data block for each table, and the unpinned one's index and filter
+  CacheStats stats;
+  cache->GetStats(&stats);
+  ASSERT_EQ(4u, stats.entries);
+  // Blocks past the budget are evicted.
+  std::shared_ptr<BlockCache> small = std::make_shared<BlockCache>(4096, 1);
+  std::unique_ptr<SSTable> ssTable = SSTable::Open(path_, small);
+  std::unique_ptr<Row> row;
+  for (int i = 0; i < 1000; i += 2) {
+    ASSERT_EQ(SUCCESS, ssTable->Get(RowName(i), &row));
+  }
+  ASSERT_LE(small->Size(), 4096u);
+  small->GetStats(&stats);
+  ASSERT_GT(stats.evictions, 0u);
+}
+
+TEST_F(SSTableTest, TestCorruption) {
+  // A damaged data block fails its checksum; the others still read.
+  int fd = open(path_.c_str(), O_WRONLY);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(1, pwrite(fd, "x", 1, 20));
+  close(fd);
+  std::unique_ptr<SSTable> ssTable = SSTable::Open(path_);
+  ASSERT_NE(nullptr, ssTable.get());
+  std::unique_ptr<Row> row;
+  ASSERT_EQ(READ_FAILED, ssTable->Get(RowName(0), &row));
+  ASSERT_EQ(SUCCESS, ssTable->Get(RowName(998), &row));
+  // Without its footer the file is not an SSTable.
+  ASSERT_EQ(0, truncate(path_.c_str(), 100));
+  ASSERT_EQ(nullptr, SSTable::Open(path_).get());
+}
+
+} // namespace KVStore
@@ -1,7 +1,14 @@
 #include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <iostream>
+#include <map>
 #include <string>
 #include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include "tabula.h"
 #include "../utils.h"
 
@@ -9,9 +16,84 @@ using std::string;
 
 namespace KVStore {
 
-Tabula::Tabula(const string& dir) : dir_(dir) {}
+Tabula::Table::Table()
+  : durability(COMMIT_LOG_SYNC_NONE),
+    syncIntervalMs(COMMIT_LOG_DEFAULT_SYNC_INTERVAL_MS),
+    filterNegatives(0),
+    filterFalsePositives(0),
+    blockReads(0),
+    blockCacheHits(0),
+    blockCacheMisses(0),
+    version(std::make_shared<Version>()),
+    compactionQueued(false),
+    compactions(0),
+    compactionBytesRead(0),
+    compactionBytesWritten(0),
+    compactionMicros(0),
+    tombstonesDropped(0),
+    flushFailures(0) {
+  pthread_mutex_init(&writeLock, nullptr);
+  pthread_mutex_init(&lock, nullptr);
+  pthread_cond_init(&flushed, nullptr);
+}
+
+Tabula::Table::~Table() {
+  pthread_cond_destroy(&flushed);
+  pthread_mutex_destroy(&lock);
+  pthread_mutex_destroy(&writeLock);
+}
+
+Tabula::Tabula(const string& dir) : Tabula(dir, MEMTABLE_DEFAULT_CAPACITY, MEMTABLE_MAP) {}
+
+Tabula::Tabula(
+  const string& dir,
+  uint64_t memtableCapacity,
+  int memtableType
+) : dir_(dir),
+    memtableCapacity_(memtableCapacity),
+    memtableType_(memtableType),
+    blockCache_(std::make_shared<BlockCache>(TABULA_DEFAULT_BLOCK_CACHE_BYTES, TABULA_BLOCK_CACHE_SHARDS)),
+    pinIndexAndFilter_(true),
+    flusherRunning_(false),
+    stopFlusher_(false),
+    compactorRunning_(false),
+    stopCompactor_(false),
+    compactionRate_(0),
+    lastFileId_(0) {
+  pthread_mutex_init(&tablesLock_, nullptr);
+  pthread_mutex_init(&flushLock_, nullptr);
+  pthread_cond_init(&flushCond_, nullptr);
+  pthread_mutex_init(&compactLock_, nullptr);
+  pthread_cond_init(&compactCond_, nullptr);
+}
 
-Tabula::~Tabula() {}
+Tabula::~Tabula() {
+  StopFlusher();
+  pthread_cond_destroy(&compactCond_);
+  pthread_mutex_destroy(&compactLock_);
+  pthread_cond_destroy(&flushCond_);
+  pthread_mutex_destroy(&flushLock_);
+  pthread_mutex_destroy(&tablesLock_);
+}
+
+Tabula::Table* Tabula::GetTable(const string& tab, bool create) {
+  pthread_mutex_lock(&tablesLock_);
+  auto it = tables_.find(tab);
+  if (it == tables_.end()) {
+    if (!create) {
+      pthread_mutex_unlock(&tablesLock_);
+      return nullptr;
+    }
+    std::unique_ptr<Table> table = std::make_unique<Table>();
+    table->name = tab;
+    table->active = std::make_shared<MemTable>(tab, memtableCapacity_, memtableType_);
+    table->commitlog = std::make_unique<CommitLog>(tab, dir_ + "/tabula-data");
+    it = tables_.emplace(tab, std::move(table)).first;
+  }
+  Table* table = it->second.get();
+  pthread_mutex_unlock(&tablesLock_);
+  return table;
+}
 
 int Tabula::Put(
   const std::string& tab, 
@@ -22,18 +104,41 @@ int Tabula::Put(
   if (!isValidTableName(tab)) {
     return INVALID_REQUEST;
   }
-  auto memtabIt = memtables_.find(tab);
-  auto commitIt = commitlogs_.find(tab);
-  if (memtabIt == memtables_.end()) {
-    memtabIt = memtables_.emplace(tab, std::make_unique<MemTable>(tab)).first;
-    commitIt = commitlogs_.emplace(tab, std::make_unique<CommitLog>(tab, dir_ + "/tabula-data")).first;
-  } else {
-    if (memtabIt->second->Size() + val.length() > memtabIt->second->Capacity()) {
-      Flush(memtabIt->second.get());
-    }
+  Table* table = GetTable(tab, true);
+  pthread_mutex_lock(&table->writeLock);
+  MakeRoom(tab, table, row.length() + col.length() + val.length());
+  // The log and the memtable take writes in the same order; the wait for
+  // the log write happens outside the lock, so writers can share it.
+  uint64_t ticket = table->commitlog->AppendPut(row, col, val);
+  int ret = table->active->Put(row, col, val);
+  pthread_mutex_unlock(&table->writeLock);
+  if (table->commitlog->Commit(ticket) != SUCCESS) {
+    return WRITE_FAILED;
+  }
+  return ret;
+}
+
+int Tabula::PutBatch(
+  const std::string& tab,
+  const std::vector<Mutation>& batch
+) {
+  if (!isValidTableName(tab)) {
+    return INVALID_REQUEST;
+  }
+  uint64_t batchSize = 0;
+  for (const Mutation& mutation : batch) {
+    batchSize += mutation.row.length() + mutation.col.length() + mutation.val.length();
+  }
+  Table* table = GetTable(tab, true);
+  pthread_mutex_lock(&table->writeLock);
+  MakeRoom(tab, table, batchSize);
+  uint64_t ticket = table->commitlog->AppendPutBatch(batch);
+  int ret = table->active->PutBatch(batch);
+  pthread_mutex_unlock(&table->writeLock);
+  if (table->commitlog->Commit(ticket) != SUCCESS) {
+    return WRITE_FAILED;
   }
-  commitIt->second->LogPut(row, col, val);
-  return memtabIt->second->Put(row, col, val);
+  return ret;
 }
 
 int Tabula::Get(
@@ -42,18 +147,52 @@ int Tabula::Get(
   const std::string& col, 
   std::string* val
 ) {
-  auto memtabIt = memtables_.find(tab);
-  if (memtabIt == memtables_.end()) {
+  Utils::SharedBuffer ref;
+  int ret = GetRef(tab, row, col, &ref);
+  if (ret == SUCCESS) {
+    *val = ref.ToString();
+  }
+  return ret;
+}
+
+int Tabula::GetRef(
+  const std::string& tab,
+  const std::string& row,
+  const std::string& col,
+  Utils::SharedBuffer* val
+) {
+  Table* table = GetTable(tab, false);
+  if (table == nullptr) {
     // No such table
     return NOT_FOUND;
   }
-  int ret = memtabIt->second->Get(row, col, val);
-  if (ret == SUCCESS) {
-    // Data is found in memtable.
-    return ret;
+  // Newest first: the active memtable, then the sealed ones. The copies keep
+  // them and the SSTables alive if the flush or the compaction thread
+  // retires one meanwhile.
+  std::vector<std::shared_ptr<MemTable> > memtables;
+  pthread_mutex_lock(&table->lock);
+  memtables.push_back(table->active);
+  for (auto it = table->immutables.rbegin(); it != table->immutables.rend(); it++) {
+    memtables.push_back(it->memtable);
+  }
+  std::shared_ptr<const Version> version = table->version;
+  pthread_mutex_unlock(&table->lock);
+  for (const std::shared_ptr<MemTable>& memtable : memtables) {
+    int ret = memtable->GetRef(row, col, val);
+    if (ret == SUCCESS) {
+      // Data is found in memtable.
+      return SUCCESS;
+    }
+    if (ret == DELETED) {
+      // Anything older is dead.
+      return NOT_FOUND;
+    }
   }
+  // A memtable is only retired in the same step that adds its SSTable to
+  // the version, so nothing falls in between.
   return GetFromDisk(
-    tab, 
+    table,
+    *version,
     row, 
     col, 
     val
@@ -65,13 +204,127 @@ int Tabula::Delete(
   const std::string& row, 
   const std::string& col
 ) {
-  auto memtabIt = memtables_.find(tab);
-  auto commitIt = commitlogs_.find(tab);
-  if (memtabIt == memtables_.end()) {
+  Table* table = GetTable(tab, false);
+  if (table == nullptr) {
     return NOT_FOUND;
   }
-  commitIt->second->LogDelete(row, col);
-  return memtabIt->second->Delete(row, col);
+  pthread_mutex_lock(&table->writeLock);
+  MakeRoom(tab, table, row.length() + col.length());
+  uint64_t ticket = table->commitlog->AppendDelete(row, col);
+  table->active->Delete(row, col);
+  pthread_mutex_unlock(&table->writeLock);
+  if (table->commitlog->Commit(ticket) != SUCCESS) {
+    return WRITE_FAILED;
+  }
+  return SUCCESS;
+}
+
+int Tabula::SetDurability(const std::string& tab, int mode, uint32_t intervalMs) {
+  if (!isValidTableName(tab)) {
+    return INVALID_REQUEST;
+  }
+  Table* table = GetTable(tab, true);
+  pthread_mutex_lock(&table->writeLock);
+  table->durability = mode;
+  table->syncIntervalMs = intervalMs;
+  table->commitlog->SetDurability(mode, intervalMs);
+  pthread_mutex_unlock(&table->writeLock);
+  return SUCCESS;
+}
+
+int Tabula::SetBloomFilter(const std::string& tab, uint32_t bitsPerKey) {
+  if (!isValidTableName(tab)) {
+    return INVALID_REQUEST;
+  }
+  Table* table = GetTable(tab, true);
+  pthread_mutex_lock(&table->lock);
+  table->ssTableOptions.bloomBitsPerKey = bitsPerKey;
+  pthread_mutex_unlock(&table->lock);
+  return SUCCESS;
+}
+
+int Tabula::SetIndexInterval(const std::string& tab, uint32_t restartInterval, uint32_t blockSize) {
+  if (!isValidTableName(tab) || restartInterval == 0 || blockSize == 0) {
+    return INVALID_REQUEST;
+  }
+  Table* table = GetTable(tab, true);
+  pthread_mutex_lock(&table->lock);
+  table->ssTableOptions.restartInterval = restartInterval;
+  table->ssTableOptions.blockSize = blockSize;
+  pthread_mutex_unlock(&table->lock);
+  return SUCCESS;
+}
+
+int Tabula::GetStats(const std::string& tab, Stats* stats) {
+  Table* table = GetTable(tab, false);
+  if (table == nullptr) {
+    return NOT_FOUND;
+  }
+  pthread_mutex_lock(&table->lock);
+  stats->bloomBitsPerKey = table->ssTableOptions.bloomBitsPerKey;
+  std::shared_ptr<const Version> version = table->version;
+  pthread_mutex_unlock(&table->lock);
+  stats->expectedFalsePositiveRate = BloomFilter::FalsePositiveRate(stats->bloomBitsPerKey);
+  stats->filterNegatives = table->filterNegatives.load();
+  stats->filterFalsePositives = table->filterFalsePositives.load();
+  stats->blockReads = table->blockReads.load();
+  stats->blockCacheHits = table->blockCacheHits.load();
+  stats->blockCacheMisses = table->blockCacheMisses.load();
+  stats->compactions = table->compactions.load();
+  stats->compactionBytesRead = table->compactionBytesRead.load();
+  stats->compactionBytesWritten = table->compactionBytesWritten.load();
+  stats->compactionMicros = table->compactionMicros.load();
+  stats->tombstonesDropped = table->tombstonesDropped.load();
+  stats->flushFailures = table->flushFailures.load();
+  stats->ssTables = 0;
+  stats->indexBytes = 0;
+  stats->filterBytes = 0;
+  for (uint32_t level = 0; level < TABULA_MAX_LEVELS; level++) {
+    stats->levelFiles[level] = version->levels[level].size();
+    stats->levelBytes[level] = 0;
+    for (const std::shared_ptr<SSTableFile>& file : version->levels[level]) {
+      stats->ssTables++;
+      stats->levelBytes[level] += file->ssTable->FileSize();
+      stats->indexBytes += file->ssTable->IndexSize();
+      stats->filterBytes += file->ssTable->FilterSize();
+    }
+  }
+  return SUCCESS;
+}
+
+void Tabula::SetBlockCache(size_t capacity, bool pinIndexAndFilter) {
+  // SSTables already open keep the cache they were opened with.
+  std::shared_ptr<BlockCache> cache;
+  if (capacity > 0) {
+    cache = std::make_shared<BlockCache>(capacity, TABULA_BLOCK_CACHE_SHARDS);
+  }
+  pthread_mutex_lock(&tablesLock_);
+  blockCache_ = std::move(cache);
+  pinIndexAndFilter_ = pinIndexAndFilter;
+  pthread_mutex_unlock(&tablesLock_);
+}
+
+void Tabula::GetBlockCacheStats(CacheStats* stats) {
+  pthread_mutex_lock(&tablesLock_);
+  std::shared_ptr<BlockCache> cache = blockCache_;
+  pthread_mutex_unlock(&tablesLock_);
+  if (cache == nullptr) {
+    *stats = CacheStats();
+    return;
+  }
+  cache->GetStats(stats);
+}
+
+std::unique_ptr<SSTable> Tabula::OpenSSTable(const string& path) {
+  pthread_mutex_lock(&tablesLock_);
+  std::shared_ptr<BlockCache> cache = blockCache_;
+  bool pinIndexAndFilter = pinIndexAndFilter_;
+  pthread_mutex_unlock(&tablesLock_);
+  return SSTable::Open(path, cache, pinIndexAndFilter);
+}
+
+void Tabula::SetCompactionRate(uint64_t bytesPerSecond) {
+  compactionRate_ = bytesPerSecond;
 }
 
 void Tabula::Recover(const std::string& dir) {
@@ -79,94 +332,564 @@ void Tabula::Recover(const std::string& dir) {
   if (dirPtr == nullptr) {
     return;
   }
+  std::vector<string> loggedTables;
+  std::map<string, std::vector<std::shared_ptr<SSTableFile> > > ssTableFiles;
+  uint64_t maxFileId = 0;
   struct dirent* entry = readdir(dirPtr);
   while (entry != nullptr) {
     SSFile ssFile;
     ParseSSFileName(entry->d_name, &ssFile);
     if (ssFile.ext == COMMMIT_LOG_FILE_EXT) {
-      // Replay commit log to populate memtable.
-      auto tableIt = memtables_.emplace(
-        ssFile.tableName, 
-        std::make_unique<MemTable>(ssFile.tableName)
-      ).first;
-      auto logIt = commitlogs_.emplace(
-        ssFile.tableName, 
-        std::make_unique<CommitLog>(dir.c_str(), ssFile.tableName)
-      ).first;
-      logIt->second->Replay(tableIt->second.get());
-    } else if (ssFile.ext == SS_INDEX_FILE_EXT) {
-      PutSSIndexToMap(
-        ssFile.tableName, 
-        ssFile.tableName + "-" + ssFile.uuid,
-        std::make_unique<SSIndex>(
-          dir_ + "/tabula-data", 
-          ssFile.tableName + "-" + ssFile.uuid
-        )
-      );
+      loggedTables.push_back(ssFile.tableName);
+    } else if (ssFile.ext == SS_TABLE_FILE_EXT) {
+      if (!ssFile.uuid.empty() && ssFile.uuid.find_first_not_of("0123456789") == string::npos) {
+        maxFileId = std::max(maxFileId, static_cast<uint64_t>(strtoull(ssFile.uuid.c_str(), nullptr, 10)));
+      }
+      std::unique_ptr<SSTable> ssTable = OpenSSTable(dir + "/" + entry->d_name);
+      if (ssTable != nullptr && ssTable->Level() < TABULA_MAX_LEVELS) {
+        std::shared_ptr<SSTableFile> file = std::make_shared<SSTableFile>();
+        file->fileName = ssFile.tableName + "-" + ssFile.uuid;
+        file->ssTable = std::move(ssTable);
+        ssTableFiles[ssFile.tableName].push_back(std::move(file));
+      }
     }
     entry = readdir(dirPtr);
   }
   closedir(dirPtr);
+  // New files must sort after the ones found, even if the clock went back
+  // since they were written.
+  uint64_t last = lastFileId_.load();
+  while (maxFileId > last && !lastFileId_.compare_exchange_weak(last, maxFileId)) {
+  }
+  for (const auto& tableFiles : ssTableFiles) {
+    // Each file records its level. A crash between writing a compaction's
+    // output and removing its inputs leaves both, which reads tolerate:
+    // the newer output is checked first and holds the same values.
+    Table* table = GetTable(tableFiles.first, true);
+    pthread_mutex_lock(&table->lock);
+    InstallVersion(table, tableFiles.second, {});
+    pthread_mutex_unlock(&table->lock);
+    EnqueueCompaction(table);
+  }
+  std::sort(loggedTables.begin(), loggedTables.end());
+  loggedTables.erase(std::unique(loggedTables.begin(), loggedTables.end()), loggedTables.end());
+  for (const string& tab : loggedTables) {
+    // Opening the table opens its log, which finds its segments. Replay
+    // seals memtables as they fill up, like live writes would.
+    Table* table = GetTable(tab, true);
+    pthread_mutex_lock(&table->writeLock);
+    table->commitlog->Replay([&](int operation, const string& row, const string& col, const string& val, uint32_t segment) {
+      if (table->active->Size() >= table->active->Capacity()) {
+        // Earlier segments hold only what the sealed memtables have.
+        Seal(tab, table, segment);
+      }
+      if (operation == PUT) {
+        table->active->Put(row, col, val);
+      } else {
+        table->active->Delete(row, col);
+      }
+    });
+    pthread_mutex_unlock(&table->writeLock);
+  }
 }
 
-void Tabula::Flush(MemTable* memtable) {
-  string uniqueFileName = MakeUniqueFileName(memtable->Name());
-  std::unique_ptr<SSIndex> ssIndex = std::make_unique<SSIndex>(
-    dir_ + "/tabula-data", 
-    uniqueFileName
-  );
-  memtable->Flush(
-    dir_ + "/tabula-data",
-    uniqueFileName, 
-    16,
-    ssIndex.get()
-  );
-  auto commitLogIt = commitlogs_.find(memtable->Name());
-  if (commitLogIt == commitlogs_.end()) {
-    return;
+void Tabula::MakeRoom(const string& tab, Table* table, uint64_t bytes) {
+  MemTable* active = table->active.get();
+  if (active->Size() + bytes > active->Capacity() && !active->Empty()) {
+    // The new memtable's writes start a new log segment.
+    Seal(tab, table, table->commitlog->Roll());
   }
-  commitLogIt->second->Clear();
-  ssIndex->Flush();
-  PutSSIndexToMap(memtable->Name(), uniqueFileName, std::move(ssIndex));
 }
 
-string Tabula::MakeUniqueFileName(const string& tableName) {
-  return tableName + "-" + string(Utils::GetTime());
+void Tabula::Seal(const string& tab, Table* table, uint32_t releaseSegment) {
+  pthread_mutex_lock(&table->lock);
+  while (table->immutables.size() >= TABULA_MAX_IMMUTABLE_MEMTABLES) {
+    // The flush thread is behind; hold writers back until it catches up.
+    pthread_cond_wait(&table->flushed, &table->lock);
+  }
+  Immutable immutable;
+  immutable.memtable = std::move(table->active);
+  immutable.fileName = MakeUniqueFileName(tab);
+  immutable.releaseSegment = releaseSegment;
+  table->immutables.push_back(std::move(immutable));
+  table->active = std::make_shared<MemTable>(tab, memtableCapacity_, memtableType_);
+  pthread_mutex_unlock(&table->lock);
+  EnqueueFlush(table);
+}
+
+void Tabula::EnqueueFlush(Table* table) {
+  pthread_mutex_lock(&flushLock_);
+  flushQueue_.push_back(table);
+  if (!flusherRunning_) {
+    flusherRunning_ = pthread_create(&flusher_, nullptr, &FlushThread, this) == 0;
+  }
+  pthread_cond_signal(&flushCond_);
+  pthread_mutex_unlock(&flushLock_);
+}
+
+void* Tabula::FlushThread(void* arg) {
+  static_cast<Tabula*>(arg)->FlushLoop();
+  return nullptr;
 }
 
-void Tabula::PutSSIndexToMap(
-  const string& tableName, 
-  const string& uniqueFileName, 
-  std::unique_ptr<SSIndex> ssIndex
+void Tabula::FlushLoop() {
+  uint64_t retryMs = TABULA_FLUSH_RETRY_MS;
+  pthread_mutex_lock(&flushLock_);
+  while (true) {
+    while (flushQueue_.empty() && !stopFlusher_) {
+      pthread_cond_wait(&flushCond_, &flushLock_);
+    }
+    if (flushQueue_.empty()) {
+      // Told to stop, and nothing is left.
+      break;
+    }
+    Table* table = flushQueue_.front();
+    flushQueue_.pop_front();
+    pthread_mutex_unlock(&flushLock_);
+    int ret = FlushOldest(table);
+    pthread_mutex_lock(&flushLock_);
+    if (ret == SUCCESS) {
+      retryMs = TABULA_FLUSH_RETRY_MS;
+      continue;
+    }
+    table->flushFailures++;
+    // Retry first, so the table's memtables still go out in order, once the
+    // disk had some time to recover.
+    flushQueue_.push_front(table);
+    if (stopFlusher_) {
+      // Left for a later flusher; the log keeps the writes for Recover too.
+      break;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += retryMs / 1000;
+    deadline.tv_nsec += (retryMs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (!stopFlusher_ && pthread_cond_timedwait(&flushCond_, &flushLock_, &deadline) != ETIMEDOUT) {
+    }
+    retryMs = std::min<uint64_t>(retryMs * 2, TABULA_FLUSH_RETRY_MAX_MS);
+  }
+  pthread_mutex_unlock(&flushLock_);
+}
+
+void Tabula::StopFlusher() {
+  pthread_mutex_lock(&flushLock_);
+  if (flusherRunning_) {
+    stopFlusher_ = true;
+    pthread_cond_signal(&flushCond_);
+    pthread_mutex_unlock(&flushLock_);
+    pthread_join(flusher_, nullptr);
+    pthread_mutex_lock(&flushLock_);
+    flusherRunning_ = false;
+    stopFlusher_ = false;
+  }
+  pthread_mutex_unlock(&flushLock_);
+  // Flushes queue compactions, so the compactor stops second.
+  StopCompactor();
+}
+
+int Tabula::FlushOldest(Table* table) {
+  // Only this thread removes immutables, so the front stays put while it is
+  // written, and no writer touches a sealed memtable.
+  pthread_mutex_lock(&table->lock);
+  Immutable& immutable = table->immutables.front();
+  SSTableOptions options = table->ssTableOptions;
+  pthread_mutex_unlock(&table->lock);
+  options.level = 0;
+  MemTable* memtable = immutable.memtable.get();
+  string path = dir_ + "/tabula-data/" + immutable.fileName + SS_TABLE_FILE_EXT;
+  SSTableBuilder builder(path, options);
+  memtable->Flush(&builder);
+  std::unique_ptr<SSTable> ssTable;
+  if (builder.Finish() == SUCCESS && builder.NumRows() > 0) {
+    ssTable = OpenSSTable(path);
+  }
+  if (builder.NumRows() == 0) {
+    // Everything in it was deleted.
+    unlink(path.c_str());
+  } else if (ssTable == nullptr) {
+    std::cerr << "Failed to write " << path << ": " << strerror(errno) << std::endl;
+    unlink(path.c_str());
+    return -1;
+  }
+  uint32_t releaseSegment = immutable.releaseSegment;
+  pthread_mutex_lock(&table->lock);
+  if (ssTable != nullptr) {
+    std::shared_ptr<SSTableFile> file = std::make_shared<SSTableFile>();
+    file->fileName = immutable.fileName;
+    file->ssTable = std::move(ssTable);
+    InstallVersion(table, {file}, {});
+  }
+  table->immutables.pop_front();
+  pthread_cond_broadcast(&table->flushed);
+  pthread_mutex_unlock(&table->lock);
+  // The data is on disk, so the log segments up to it can go. Memtables
+  // are flushed in order, so older ones are already out.
+  table->commitlog->Release(releaseSegment);
+  EnqueueCompaction(table);
+  return SUCCESS;
+}
+
+void Tabula::InstallVersion(
+  Table* table,
+  const std::vector<std::shared_ptr<SSTableFile> >& added,
+  const std::vector<std::shared_ptr<SSTableFile> >& removed
 ) {
-  ssIndex->MemoizeStartAndEndRowFromFile();
-  auto tableIt = ssIndices_.find(tableName);
-  if (tableIt == ssIndices_.end()) {
-    tableIt = ssIndices_.emplace(
-      tableName, 
-      std::make_unique<std::map<string, std::unique_ptr<SSIndex> > >()
-    ).first;
+  std::shared_ptr<Version> version = std::make_shared<Version>(*table->version);
+  for (const std::shared_ptr<SSTableFile>& file : removed) {
+    std::vector<std::shared_ptr<SSTableFile> >& files = version->levels[file->ssTable->Level()];
+    files.erase(std::remove(files.begin(), files.end(), file), files.end());
+  }
+  for (const std::shared_ptr<SSTableFile>& file : added) {
+    version->levels[file->ssTable->Level()].push_back(file);
+  }
+  for (std::vector<std::shared_ptr<SSTableFile> >& files : version->levels) {
+    // File names sort in the order they were made, and a newer file never
+    // holds older values than an older one of the same level.
+    std::sort(files.begin(), files.end(), [](
+      const std::shared_ptr<SSTableFile>& left,
+      const std::shared_ptr<SSTableFile>& right
+    ) {
+      return left->fileName > right->fileName;
+    });
+  }
+  table->version = std::move(version);
+}
+
+void Tabula::EnqueueCompaction(Table* table) {
+  pthread_mutex_lock(&compactLock_);
+  if (!table->compactionQueued) {
+    table->compactionQueued = true;
+    compactQueue_.push_back(table);
+  }
+  if (!compactorRunning_) {
+    compactorRunning_ = pthread_create(&compactor_, nullptr, &CompactionThread, this) == 0;
+  }
+  pthread_cond_signal(&compactCond_);
+  pthread_mutex_unlock(&compactLock_);
+}
+
+void* Tabula::CompactionThread(void* arg) {
+  static_cast<Tabula*>(arg)->CompactionLoop();
+  return nullptr;
+}
+
+void Tabula::CompactionLoop() {
+  pthread_mutex_lock(&compactLock_);
+  while (true) {
+    while (compactQueue_.empty() && !stopCompactor_) {
+      pthread_cond_wait(&compactCond_, &compactLock_);
+    }
+    if (stopCompactor_) {
+      // Whatever is still queued runs when the thread next starts.
+      break;
+    }
+    Table* table = compactQueue_.front();
+    pthread_mutex_unlock(&compactLock_);
+    // One compaction at a time, until the table needs no more or the
+    // thread is told to stop.
+    while (true) {
+      pthread_mutex_lock(&table->lock);
+      std::shared_ptr<const Version> version = table->version;
+      pthread_mutex_unlock(&table->lock);
+      Compaction compaction;
+      if (!PickCompaction(table, *version, &compaction) ||
+          RunCompaction(table, compaction) != SUCCESS) {
+        break;
+      }
+      pthread_mutex_lock(&compactLock_);
+      bool stop = stopCompactor_;
+      pthread_mutex_unlock(&compactLock_);
+      if (stop) {
+        break;
+      }
+    }
+    pthread_mutex_lock(&compactLock_);
+    if (stopCompactor_) {
+      break;
+    }
+    compactQueue_.pop_front();
+    table->compactionQueued = false;
+  }
+  pthread_mutex_unlock(&compactLock_);
+}
+
+void Tabula::StopCompactor() {
+  pthread_mutex_lock(&compactLock_);
+  if (!compactorRunning_) {
+    pthread_mutex_unlock(&compactLock_);
+    return;
+  }
+  stopCompactor_ = true;
+  pthread_cond_signal(&compactCond_);
+  pthread_mutex_unlock(&compactLock_);
+  pthread_join(compactor_, nullptr);
+  pthread_mutex_lock(&compactLock_);
+  compactorRunning_ = false;
+  stopCompactor_ = false;
+  pthread_mutex_unlock(&compactLock_);
+}
+
+static bool Overlaps(const SSTable& ssTable, const string& start, const string& end) {
+  return ssTable.StartRow() <= end && ssTable.EndRow() >= start;
+}
+
+bool Tabula::PickCompaction(Table* table, const Version& version, Compaction* compaction) {
+  const std::vector<std::shared_ptr<SSTableFile> >* levels = version.levels;
+  std::vector<std::shared_ptr<SSTableFile> > picked;
+  if (levels[0].size() >= TABULA_L0_COMPACTION_TRIGGER) {
+    // Level 0 files overlap, so they all go at once.
+    compaction->level = 0;
+    picked = levels[0];
+  } else {
+    uint64_t target = TABULA_LEVEL1_BYTES;
+    uint32_t level = 1;
+    for (; level + 1 < TABULA_MAX_LEVELS; level++, target *= TABULA_LEVEL_SIZE_RATIO) {
+      uint64_t bytes = 0;
+      for (const std::shared_ptr<SSTableFile>& file : levels[level]) {
+        bytes += file->ssTable->FileSize();
+      }
+      if (bytes > target) {
+        break;
+      }
+    }
+    if (level + 1 >= TABULA_MAX_LEVELS) {
+      return false;
+    }
+    // Take turns over the key space: the first file that starts after the
+    // last one moved down, wrapping around at the end.
+    compaction->level = level;
+    std::shared_ptr<SSTableFile> first;
+    std::shared_ptr<SSTableFile> next;
+    const string& pointer = table->compactPointer[level];
+    for (const std::shared_ptr<SSTableFile>& file : levels[level]) {
+      const string& start = file->ssTable->StartRow();
+      if (first == nullptr || start < first->ssTable->StartRow()) {
+        first = file;
+      }
+      if (start > pointer && (next == nullptr || start < next->ssTable->StartRow())) {
+        next = file;
+      }
+    }
+    picked.push_back(next != nullptr ? next : first);
+    table->compactPointer[level] = picked.front()->ssTable->EndRow();
+  }
+  string start = picked.front()->ssTable->StartRow();
+  string end = picked.front()->ssTable->EndRow();
+  for (const std::shared_ptr<SSTableFile>& file : picked) {
+    start = std::min(start, file->ssTable->StartRow());
+    end = std::max(end, file->ssTable->EndRow());
+  }
+  if (compaction->level > 0) {
+    // Files of a level only overlap after a crash mid-compaction. Older ones
+    // overlapping the range must go down with it, or they would hide it.
+    bool grew = true;
+    while (grew) {
+      grew = false;
+      for (const std::shared_ptr<SSTableFile>& file : levels[compaction->level]) {
+        if (std::find(picked.begin(), picked.end(), file) == picked.end() &&
+            Overlaps(*file->ssTable, start, end)) {
+          picked.push_back(file);
+          start = std::min(start, file->ssTable->StartRow());
+          end = std::max(end, file->ssTable->EndRow());
+          grew = true;
+        }
+      }
+    }
+    std::sort(picked.begin(), picked.end(), [](
+      const std::shared_ptr<SSTableFile>& left,
+      const std::shared_ptr<SSTableFile>& right
+    ) {
+      return left->fileName > right->fileName;
+    });
+  }
+  compaction->inputs = std::move(picked);
+  for (const std::shared_ptr<SSTableFile>& file : levels[compaction->level + 1]) {
+    if (Overlaps(*file->ssTable, start, end)) {
+      compaction->inputs.push_back(file);
+    } else {
+      compaction->older.push_back(file);
+    }
+  }
+  for (uint32_t level = compaction->level + 2; level < TABULA_MAX_LEVELS; level++) {
+    compaction->older.insert(compaction->older.end(), levels[level].begin(), levels[level].end());
+  }
+  return true;
+}
+
+int Tabula::RunCompaction(Table* table, const Compaction& compaction) {
+  struct timespec startTime;
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  uint32_t outputLevel = compaction.level + 1;
+  std::vector<std::unique_ptr<SSTable::Iterator> > children;
+  uint64_t bytesRead = 0;
+  for (const std::shared_ptr<SSTableFile>& file : compaction.inputs) {
+    children.push_back(std::make_unique<SSTable::Iterator>(file->ssTable.get()));
+    bytesRead += file->ssTable->FileSize();
+  }
+  MergingIterator it(std::move(children));
+  pthread_mutex_lock(&table->lock);
+  SSTableOptions options = table->ssTableOptions;
+  pthread_mutex_unlock(&table->lock);
+  options.level = outputLevel;
+
+  std::vector<std::shared_ptr<SSTableFile> > outputs;
+  std::unique_ptr<SSTableBuilder> builder;
+  string path;
+  uint64_t bytesWritten = 0;
+  uint64_t pacedBytes = 0;
+  bool failed = false;
+  // Writes out the current output file, if there is one.
+  auto finishOutput = [&]() {
+    if (builder == nullptr) {
+      return;
+    }
+    std::unique_ptr<SSTable> ssTable;
+    if (builder->Finish() == SUCCESS) {
+      ssTable = OpenSSTable(path);
+    }
+    bytesWritten += builder->FileSize();
+    builder.reset();
+    if (ssTable == nullptr) {
+      std::cerr << "Failed to write " << path << ": " << strerror(errno) << std::endl;
+      failed = true;
+      return;
+    }
+    outputs.back()->ssTable = std::move(ssTable);
+  };
+  // Files flushed meanwhile only go to level 0, so [older] stays complete.
+  auto mayHoldOlder = [&compaction](const string& row) {
+    for (const std::shared_ptr<SSTableFile>& file : compaction.older) {
+      if (file->ssTable->InRange(row) && file->ssTable->FilterMayMatch(row)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  string columns;
+  for (it.SeekToFirst(); it.Valid() && !failed; it.Next()) {
+    const std::vector<Utils::SharedBuffer>& values = it.Values();
+    bool keepTombstones = mayHoldOlder(it.Key());
+    if (values.size() == 1 && keepTombstones) {
+      columns = values.front().ToString();
+    } else {
+      // The row was written again later, or may have tombstones to drop;
+      // newer columns and tombstones win.
+      std::unique_ptr<Row> row = Row::DeserializeColumns(it.Key(), values.front());
+      for (size_t i = 1; i < values.size() && row != nullptr; i++) {
+        std::unique_ptr<Row> older = Row::DeserializeColumns(it.Key(), values[i]);
+        if (older == nullptr) {
+          row.reset();
+          break;
+        }
+        row->Merge(*older);
+      }
+      if (row == nullptr) {
+        std::cerr << "Corrupt row " << it.Key() << " in " << table->name << std::endl;
+        failed = true;
+        break;
+      }
+      if (!keepTombstones && row->NumTombstones() > 0) {
+        row->DropTombstones();
+        table->tombstonesDropped++;
+      }
+      if (row->NumColumns() == 0 && row->NumTombstones() == 0) {
+        continue;
+      }
+      columns.clear();
+      row->SerializeColumns(&columns);
+    }
+    if (builder == nullptr) {
+      std::shared_ptr<SSTableFile> file = std::make_shared<SSTableFile>();
+      file->fileName = MakeUniqueFileName(table->name);
+      path = dir_ + "/tabula-data/" + file->fileName + SS_TABLE_FILE_EXT;
+      outputs.push_back(std::move(file));
+      builder = std::make_unique<SSTableBuilder>(path, options);
+    }
+    builder->Add(it.Key(), columns);
+    pacedBytes += it.Key().length() + columns.length();
+    if (builder->FileSize() >= TABULA_COMPACTION_FILE_BYTES) {
+      finishOutput();
+    }
+    uint64_t rate = compactionRate_.load();
+    if (rate > 0 && pacedBytes >= 64 * 1024) {
+      // Sleep off whatever the last stretch wrote faster than the rate.
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      int64_t elapsedMicros = (now.tv_sec - startTime.tv_sec) * 1000000 +
+                              (now.tv_nsec - startTime.tv_nsec) / 1000;
+      int64_t dueMicros = (bytesWritten + pacedBytes) * 1000000 / rate;
+      if (dueMicros > elapsedMicros) {
+        usleep(dueMicros - elapsedMicros);
+      }
+    }
+  }
+  finishOutput();
+  if (failed || it.Failed()) {
+    // The inputs stay, so nothing is lost; the outputs go.
+    for (const std::shared_ptr<SSTableFile>& file : outputs) {
+      unlink((dir_ + "/tabula-data/" + file->fileName + SS_TABLE_FILE_EXT).c_str());
+    }
+    std::cerr << "Compaction of " << table->name << " level " << compaction.level
+              << " failed" << std::endl;
+    return -1;
+  }
+  pthread_mutex_lock(&table->lock);
+  InstallVersion(table, outputs, compaction.inputs);
+  pthread_mutex_unlock(&table->lock);
+  // Readers still holding the old version keep the files open.
+  for (const std::shared_ptr<SSTableFile>& file : compaction.inputs) {
+    unlink((dir_ + "/tabula-data/" + file->fileName + SS_TABLE_FILE_EXT).c_str());
+  }
+  struct timespec endTime;
+  clock_gettime(CLOCK_MONOTONIC, &endTime);
+  table->compactions++;
+  table->compactionBytesRead += bytesRead;
+  table->compactionBytesWritten += bytesWritten;
+  table->compactionMicros += (endTime.tv_sec - startTime.tv_sec) * 1000000 +
+                             (endTime.tv_nsec - startTime.tv_nsec) / 1000;
+  return SUCCESS;
+}
+
+string Tabula::MakeUniqueFileName(const string& tableName) {
+  // Nanoseconds since the epoch, bumped past the last id handed out so ids
+  // never repeat. Zero padding makes them sort in sealing order.
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64_t id = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+  uint64_t last = lastFileId_.load();
+  while (true) {
+    uint64_t next = id > last ? id : last + 1;
+    if (lastFileId_.compare_exchange_weak(last, next)) {
+      id = next;
+      break;
+    }
   }
-  tableIt->second->insert({uniqueFileName, std::move(ssIndex)});
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%020llu", static_cast<unsigned long long>(id));
+  return tableName + "-" + buf;
 }
 
 void Tabula::ParseSSFileName(const char* fileName, SSFile* ssFile) {
-  // Parse fileName into xxx-yyyy.zzz.
+  // Parse fileName into xxx-yyyy.zzz, or xxx.zzz with an empty uuid.
   // Must receive a null terminated string 
-  size_t offsetHyphen;
-  size_t offsetDot;
-  size_t offset = 0;
-  for (const char* trv = fileName; *trv; trv++) {
-    if (*trv == '-') {
-      offsetHyphen = offset;
-    } else if (*trv == '.') {
-      offsetDot = offset;
-    }
-    offset++;
+  string name(fileName);
+  size_t offsetDot = name.rfind('.');
+  if (offsetDot == string::npos) {
+    offsetDot = name.length();
+  }
+  size_t offsetHyphen = offsetDot == 0 ? string::npos : name.rfind('-', offsetDot - 1);
+  if (offsetHyphen == string::npos) {
+    ssFile->tableName = name.substr(0, offsetDot);
+    ssFile->uuid = "";
+  } else {
+    ssFile->tableName = name.substr(0, offsetHyphen);
+    ssFile->uuid = name.substr(offsetHyphen + 1, offsetDot - offsetHyphen - 1); // exclude hyphen
   }
-  ssFile->tableName = string(fileName, offsetHyphen);
-  ssFile->uuid = string(fileName + offsetHyphen + 1, offsetDot - offsetHyphen - 1); // exclude hyphen
-  ssFile->ext = string(fileName + offsetDot); // include dot
+  ssFile->ext = name.substr(offsetDot); // include dot
 }
 
 bool Tabula::isValidTableName(const std::string& tableName) {
@@ -182,45 +905,55 @@ bool Tabula::isValidTableName(const std::string& tableName) {
 }
 
 int Tabula::GetFromDisk(
-  const std::string& tab, 
+  Table* table,
+  const Version& version,
   const std::string& row, 
   const std::string& col, 
-  std::string* val
+  Utils::SharedBuffer* val
 ) {
-  auto ssIndexIt = ssIndices_.find(tab);
-  if (ssIndexIt == ssIndices_.end()) {
-    return NOT_FOUND;
-  }
-  std::map<std::string, std::unique_ptr<SSIndex> >* ssindexSet = ssIndexIt->second.get();
-  std::unique_ptr<Row> selectedRow;
-  for (auto it = ssindexSet->begin(); it != ssindexSet->end(); it++) {
-    uint64_t offset;
-    if (it->second->GetOffset(row, &offset) == SUCCESS) {
-      // Read row into memory.
-      // Keep the row with the latest update time.
-      std::unique_ptr<Row> candidateRow = ReadRowFromSSTable(it->first + SS_INDEX_FILE_EXT, offset);
-      if (selectedRow.get() == nullptr) {
-        selectedRow = std::move(candidateRow);
-      } else if (candidateRow->LastUpdateTime() > selectedRow->LastUpdateTime()) {
-        selectedRow = std::move(candidateRow);
+  // Lower levels hold newer values, and so do newer files within a level,
+  // so the first SSTable holding the column or its tombstone has its latest
+  // state. A row can be spread over several of them.
+  for (const std::vector<std::shared_ptr<SSTableFile> >& files : version.levels) {
+    for (const std::shared_ptr<SSTableFile>& file : files) {
+      SSTable* ssTable = file->ssTable.get();
+      if (!ssTable->InRange(row)) {
+        continue;
+      }
+      if (!ssTable->FilterMayMatch(row)) {
+        table->filterNegatives++;
+        continue;
+      }
+      table->blockReads++;
+      std::unique_ptr<Row> candidateRow;
+      bool cacheHit;
+      int found = ssTable->Get(row, &candidateRow, &cacheHit);
+      if (cacheHit) {
+        table->blockCacheHits++;
+      } else {
+        table->blockCacheMisses++;
+      }
+      if (found == READ_FAILED) {
+        // Older files may hold what this one overwrote or deleted.
+        return READ_FAILED;
+      }
+      if (found == NOT_FOUND) {
+        // The filter let the row through, and its block does not have it.
+        if (ssTable->FilterSize() > 0) {
+          table->filterFalsePositives++;
+        }
+        continue;
+      }
+      int ret = candidateRow->GetRef(col, val);
+      if (ret == SUCCESS) {
+        return SUCCESS;
+      }
+      if (ret == DELETED) {
+        return NOT_FOUND;
       }
     }
   }
-  if (selectedRow.get() == nullptr) {
-    // If row is still nullptr, row does not exist in the table
-    return NOT_FOUND;
-  }
-  return selectedRow->Get(col, val);
-
-}
-
-std::unique_ptr<Row> Tabula::ReadRowFromSSTable(
-  const string& fileName,
-  uint64_t offset
-) {
-  string path = dir_ + "/" + fileName;
-  int fd = open(path.c_str(), O_RDONLY);
-  return Row::Deserialize(fd, offset); 
+  return NOT_FOUND;
 }
 
-} // namespace KVStore
\ No newline at end of file
+} // namespace KVStore
@@ -1,11 +1,37 @@
 #ifndef TABULA_H_
 #define TABULA_H_
 
+// Sealed memtables a table may have waiting for the flush thread before
+// writers stall.
+#define TABULA_MAX_IMMUTABLE_MEMTABLES 4
+// A failed flush is retried after this long, doubling up to the maximum.
+#define TABULA_FLUSH_RETRY_MS 100
+#define TABULA_FLUSH_RETRY_MAX_MS 10000
+// Leveled compaction: level 0 holds flushed SSTables, which may overlap, and
+// is merged into level 1 once it has this many.
+#define TABULA_L0_COMPACTION_TRIGGER 4
+#define TABULA_MAX_LEVELS 7
+// Level 1 may hold this many bytes, and each level after it this many times
+// the one before, before a file moves down.
+#define TABULA_LEVEL1_BYTES 1024 * 1024 * 64 // 64 MB
+#define TABULA_LEVEL_SIZE_RATIO 10
+// Compaction cuts its output into files of about this size.
+#define TABULA_COMPACTION_FILE_BYTES 1024 * 1024 * 8 // 8 MB
+// Data blocks all tables may keep cached
+#define TABULA_DEFAULT_BLOCK_CACHE_BYTES 1024 * 1024 * 8 // 8 MB
+#define TABULA_BLOCK_CACHE_SHARDS 16
+
+#include <atomic>
+#include <deque>
+#include <pthread.h>
 #include <string>
 #include <unordered_map>
 #include <memory>
+#include <vector>
 #include "memtable.h"
 #include "commitlog.h"
+#include "mergingiterator.h"
+#include "sstable.h"
 #include "tabulaenums.h"
 
 namespace KVStore {
@@ -13,25 +39,110 @@ namespace KVStore {
 class Tabula {
   public:
     Tabula(const std::string& dir);
+    // Each table's memtable is sealed and handed to the flush thread once it
+    // holds [memtableCapacity] bytes. [memtableType] is MEMTABLE_MAP or
+    // MEMTABLE_SKIPLIST.
+    Tabula(const std::string& dir, uint64_t memtableCapacity, int memtableType);
+    // Writes out the sealed memtables first.
     ~Tabula();
+    // The writes return WRITE_FAILED if the commit log could not take the
+    // change. It is still visible to reads until a restart.
     int Put(
       const std::string& tab, 
       const std::string& row, 
       const std::string& col, 
       const std::string& val
     );
+    // Writes all of [batch] to [tab] with one commit log write and one
+    // memtable lock acquisition.
+    int PutBatch(
+      const std::string& tab,
+      const std::vector<Mutation>& batch
+    );
+    // Returns READ_FAILED if an SSTable that may hold the column is damaged
+    // or unreadable, rather than falling back to an older copy.
     int Get(
       const std::string& tab, 
       const std::string& row, 
       const std::string& col, 
       std::string* val
     );
+    // Like Get, but [val] shares the stored bytes: memtable data, or a slice
+    // of the block read from an SSTable. The bytes stay valid for as long as
+    // [val] does.
+    int GetRef(
+      const std::string& tab,
+      const std::string& row,
+      const std::string& col,
+      Utils::SharedBuffer* val
+    );
+    // Writes a tombstone, which hides the column in older memtables and
+    // SSTables until compaction drops both. Succeeds whether or not the
+    // column exists.
     int Delete(
       const std::string& tab, 
       const std::string& row, 
       const std::string& col
     );
     void Recover(const std::string& dir);
+    // Sets how [tab]'s commit log syncs: one of the COMMIT_LOG_SYNC_ modes,
+    // with [intervalMs] for COMMIT_LOG_SYNC_INTERVAL. Tables start with
+    // COMMIT_LOG_SYNC_NONE.
+    int SetDurability(const std::string& tab, int mode, uint32_t intervalMs);
+    // Sets the Bloom filter bits per key of [tab]'s SSTables from the next
+    // flush on; 0 writes none. BloomFilter::BitsPerKey converts a false
+    // positive rate. Tables start with BLOOM_FILTER_DEFAULT_BITS_PER_KEY.
+    int SetBloomFilter(const std::string& tab, uint32_t bitsPerKey);
+    // Sets how [tab]'s SSTables are indexed from the next flush on. A lookup
+    // binary searches the in-memory index, which has an entry per data block
+    // of [blockSize] bytes, reads that block, binary searches its samples,
+    // one every [restartInterval] rows, and scans forward from the nearest
+    // one before the row. Bigger values use less memory and scan more.
+    int SetIndexInterval(const std::string& tab, uint32_t restartInterval, uint32_t blockSize);
+    // Replaces the block cache all tables share with one of [capacity]
+    // bytes, 0 for none. With [pinIndexAndFilter] false, SSTables keep their
+    // index and filter blocks in the cache too, so [capacity] bounds them as
+    // well. Applies to SSTables opened from then on, so call it before
+    // Recover. Tabula starts with TABULA_DEFAULT_BLOCK_CACHE_BYTES, pinned.
+    void SetBlockCache(size_t capacity, bool pinIndexAndFilter);
+    // Zeros if there is no block cache.
+    void GetBlockCacheStats(CacheStats* stats);
+    struct Stats {
+      uint64_t ssTables;
+      // Index and filter bytes, held in memory if pinned and in the block
+      // cache otherwise
+      uint64_t indexBytes;
+      uint64_t filterBytes;
+      uint32_t bloomBitsPerKey;
+      // What bloomBitsPerKey should give
+      double expectedFalsePositiveRate;
+      // SSTable lookups the filters ruled out, and ones they let through
+      // that found no row
+      uint64_t filterNegatives;
+      uint64_t filterFalsePositives;
+      // Data blocks read, from the block cache or from disk
+      uint64_t blockReads;
+      uint64_t blockCacheHits;
+      uint64_t blockCacheMisses;
+      uint64_t levelFiles[TABULA_MAX_LEVELS];
+      uint64_t levelBytes[TABULA_MAX_LEVELS];
+      uint64_t compactions;
+      uint64_t compactionBytesRead;
+      uint64_t compactionBytesWritten;
+      uint64_t compactionMicros;
+      // Rows whose tombstones compaction found nothing left to hide
+      uint64_t tombstonesDropped;
+      // Memtable flushes that failed and were retried
+      uint64_t flushFailures;
+    };
+    int GetStats(const std::string& tab, Stats* stats);
+    // Caps how fast compaction writes, across all tables; 0, the default,
+    // leaves it unthrottled.
+    void SetCompactionRate(uint64_t bytesPerSecond);
+    // Writes out every sealed memtable, lets a running compaction finish and
+    // stops both background threads; the next flush starts them again. Call
+    // before fork(), which keeps no threads.
+    void StopFlusher();
     
     struct SSFile {
       std::string tableName;
@@ -42,31 +153,136 @@ class Tabula {
     static void ParseSSFileName(const char* fileName, SSFile* ssFile);
 
   private:
+    // A full memtable waiting to be written out.
+    struct Immutable {
+      std::shared_ptr<MemTable> memtable;
+      std::string fileName;
+      // Log segments before this one hold nothing newer than this memtable.
+      uint32_t releaseSegment;
+    };
+    struct SSTableFile {
+      std::string fileName;
+      std::shared_ptr<SSTable> ssTable;
+    };
+    // A table's SSTables by level, newest first within each. A version is
+    // never changed once installed, so readers can keep using one while a
+    // compaction replaces it.
+    struct Version {
+      std::vector<std::shared_ptr<SSTableFile> > levels[TABULA_MAX_LEVELS];
+    };
+    // Inputs from [level] and the files of level + 1 they overlap, newest
+    // first, to be merged into level + 1.
+    struct Compaction {
+      uint32_t level;
+      std::vector<std::shared_ptr<SSTableFile> > inputs;
+      // The other files of level + 1 and below. A tombstone can go once
+      // none of them may hold its row.
+      std::vector<std::shared_ptr<SSTableFile> > older;
+    };
+    struct Table {
+      Table();
+      ~Table();
+      std::string name;
+      // Serializes writers, so the log and the memtable agree on order.
+      pthread_mutex_t writeLock;
+      // Guards active, immutables and version. Readers hold it only to copy
+      // them.
+      pthread_mutex_t lock;
+      // Signaled when the flush thread retires an immutable.
+      pthread_cond_t flushed;
+      std::shared_ptr<MemTable> active;
+      std::unique_ptr<CommitLog> commitlog;
+      int durability;
+      uint32_t syncIntervalMs;
+      // For the next flush; guarded by lock.
+      SSTableOptions ssTableOptions;
+      std::atomic<uint64_t> filterNegatives;
+      std::atomic<uint64_t> filterFalsePositives;
+      std::atomic<uint64_t> blockReads;
+      std::atomic<uint64_t> blockCacheHits;
+      std::atomic<uint64_t> blockCacheMisses;
+      // Oldest first
+      std::deque<Immutable> immutables;
+      std::shared_ptr<const Version> version;
+      // Guarded by compactLock_
+      bool compactionQueued;
+      // Where the next compaction of each level starts, so they take turns
+      // over the key space; only the compaction thread uses it.
+      std::string compactPointer[TABULA_MAX_LEVELS];
+      std::atomic<uint64_t> compactions;
+      std::atomic<uint64_t> compactionBytesRead;
+      std::atomic<uint64_t> compactionBytesWritten;
+      std::atomic<uint64_t> compactionMicros;
+      std::atomic<uint64_t> tombstonesDropped;
+      std::atomic<uint64_t> flushFailures;
+    };
+
     std::string dir_;
-    // One memtable per table
-    std::unordered_map<std::string, std::unique_ptr<MemTable> > memtables_;
-    // One commit log per table
-    std::unordered_map<std::string, std::unique_ptr<CommitLog> > commitlogs_;
-    // Might have more than one SSIndex per table
-    // table name -> unique file name -> SSIndex
-    std::unordered_map<std::string, std::unique_ptr<std::map<std::string, std::unique_ptr<SSIndex> > > > ssIndices_;
-    void Flush(MemTable* memtable);
+    uint64_t memtableCapacity_;
+    int memtableType_;
+    // Tables are created on first write and never removed. The lock also
+    // guards blockCache_ and pinIndexAndFilter_.
+    pthread_mutex_t tablesLock_;
+    std::unordered_map<std::string, std::unique_ptr<Table> > tables_;
+    std::shared_ptr<BlockCache> blockCache_;
+    bool pinIndexAndFilter_;
+    // One entry per sealed memtable, in sealing order.
+    pthread_mutex_t flushLock_;
+    pthread_cond_t flushCond_;
+    std::deque<Table*> flushQueue_;
+    pthread_t flusher_;
+    bool flusherRunning_;
+    bool stopFlusher_;
+    // Tables that may need compacting, one entry each.
+    pthread_mutex_t compactLock_;
+    pthread_cond_t compactCond_;
+    std::deque<Table*> compactQueue_;
+    pthread_t compactor_;
+    bool compactorRunning_;
+    bool stopCompactor_;
+    std::atomic<uint64_t> compactionRate_;
+    // Highest SSTable id handed out or found by Recover
+    std::atomic<uint64_t> lastFileId_;
+
+    Table* GetTable(const std::string& tab, bool create);
+    // Seals the active memtable of [tab] if [bytes] more would overflow it,
+    // waiting while too many sealed ones are pending. Caller holds writeLock.
+    void MakeRoom(const std::string& tab, Table* table, uint64_t bytes);
+    // Seals the active memtable. Once it is flushed, log segments before
+    // [releaseSegment] can go.
+    void Seal(const std::string& tab, Table* table, uint32_t releaseSegment);
+    void EnqueueFlush(Table* table);
+    static void* FlushThread(void* arg);
+    void FlushLoop();
+    // Writes [table]'s oldest immutable memtable to an SSTable and drops it.
+    // Returns -1 if the write failed, leaving the memtable for a retry.
+    int FlushOldest(Table* table);
+    // Opens [path] with the current block cache settings.
+    std::unique_ptr<SSTable> OpenSSTable(const std::string& path);
     bool isValidTableName(const std::string& tableName);
     std::string MakeUniqueFileName(const std::string& tableName); 
-    void PutSSIndexToMap(
-      const std::string& tablerName,
-      const std::string& uniqueFileName,
-      std::unique_ptr<SSIndex> ssIndex
+    // Installs a version of [table] with [added] put in their levels and
+    // [removed] taken out. Caller holds table->lock.
+    void InstallVersion(
+      Table* table,
+      const std::vector<std::shared_ptr<SSTableFile> >& added,
+      const std::vector<std::shared_ptr<SSTableFile> >& removed
     );
+    void EnqueueCompaction(Table* table);
+    static void* CompactionThread(void* arg);
+    void CompactionLoop();
+    void StopCompactor();
+    // Picks the most needed compaction of [version]; false if none is.
+    bool PickCompaction(Table* table, const Version& version, Compaction* compaction);
+    // Merges the inputs into new files of the next level and installs them.
+    // The inputs are left alone if anything fails.
+    int RunCompaction(Table* table, const Compaction& compaction);
     int GetFromDisk(
-      const std::string& tab, 
+      Table* table,
+      const Version& version,
       const std::string& row, 
       const std::string& col, 
-      std::string* val
-    );
-    std::unique_ptr<Row> Tabula::ReadRowFromSSTable(
-      const std::string& fileName,
-      uint64_t offset
+      Utils::SharedBuffer* val
     );
 
 };
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <string>
 #include <memory>
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <iostream>
@@ -16,6 +18,352 @@ TEST(TabulaTest, TestParseSSFileName) {
   ASSERT_EQ("table", ssFile.tableName);
   ASSERT_EQ("uuid", ssFile.uuid);
   ASSERT_EQ(".sst", ssFile.ext);
+  Tabula::ParseSSFileName("table.cl", &ssFile);
+  ASSERT_EQ("table", ssFile.tableName);
+  ASSERT_EQ("", ssFile.uuid);
+  ASSERT_EQ(".cl", ssFile.ext);
+}
+
+class TabulaFlushTest : public ::testing::TestWithParam<int> {
+  protected:
+    void SetUp() override {
+      char dir[] = "/tmp/tabula_testXXXXXX";
+      dir_ = mkdtemp(dir);
+    }
+    void TearDown() override {
+      std::string data = dir_ + "/tabula-data";
+      DIR* dirPtr = opendir(data.c_str());
+      struct dirent* entry;
+      while (dirPtr != nullptr && (entry = readdir(dirPtr)) != nullptr) {
+        unlink((data + "/" + entry->d_name).c_str());
+      }
+      if (dirPtr != nullptr) {
+        closedir(dirPtr);
+      }
+      rmdir(data.c_str());
+      rmdir(dir_.c_str());
+    }
+    std::string dir_;
+};
+
+TEST_P(TabulaFlushTest, TestReadsAcrossFlushes) {
+  // Small memtables, so the rows end up spread over several SSTables, the
+  // sealed memtables and the active one.
+  Tabula tabula(dir_, 64 * 1024, GetParam());
+  for (int i = 0; i < 2000; i++) {
+    std::string row = "row" + std::to_string(i);
+    ASSERT_EQ(SUCCESS, tabula.Put("table", row, "col", row + std::string(100, 'v')));
+  }
+  // Later columns of early rows land in a newer memtable than the first.
+  ASSERT_EQ(SUCCESS, tabula.Put("table", "row0", "col2", "new"));
+  tabula.Put("table", "row0", "col2", "newer");
+  std::string val;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 2000; i++) {
+      std::string row = "row" + std::to_string(i);
+      ASSERT_EQ(SUCCESS, tabula.Get("table", row, "col", &val));
+      ASSERT_EQ(row + std::string(100, 'v'), val);
+    }
+    ASSERT_EQ(SUCCESS, tabula.Get("table", "row0", "col2", &val));
+    ASSERT_EQ("newer", val);
+    // Read again once everything sealed is on disk.
+    tabula.StopFlusher();
+  }
+  ASSERT_EQ(NOT_FOUND, tabula.Get("table", "row2000", "col", &val));
+  ASSERT_EQ(NOT_FOUND, tabula.Get("other", "row0", "col", &val));
+  // Each hit reads one block; the filters keep the other SSTables from
+  // reading any.
+  Tabula::Stats stats;
+  ASSERT_EQ(SUCCESS, tabula.GetStats("table", &stats));
+  ASSERT_GT(stats.ssTables, 1u);
+  ASSERT_GT(stats.indexBytes, 0u);
+  ASSERT_GT(stats.filterBytes, 0u);
+  ASSERT_GT(stats.filterNegatives, 0u);
+  ASSERT_LE(stats.filterFalsePositives, stats.filterNegatives / 20);
+  // The second round finds the blocks the first one read.
+  ASSERT_EQ(stats.blockReads, stats.blockCacheHits + stats.blockCacheMisses);
+  ASSERT_GT(stats.blockCacheHits, 0u);
+  CacheStats cacheStats;
+  tabula.GetBlockCacheStats(&cacheStats);
+  ASSERT_GE(cacheStats.hits, stats.blockCacheHits);
+  ASSERT_EQ(NOT_FOUND, tabula.GetStats("other", &stats));
+}
+
+TEST_P(TabulaFlushTest, TestRecover) {
+  {
+    Tabula tabula(dir_, 64 * 1024, GetParam());
+    for (int i = 0; i < 2000; i++) {
+      std::string row = "row" + std::to_string(i);
+      ASSERT_EQ(SUCCESS, tabula.Put("table", row, "col", row));
+    }
+    tabula.Delete("table", "row1999", "col");
+  }
+  // What never reached an SSTable comes back from the log.
+  Tabula tabula(dir_, 64 * 1024, GetParam());
+  tabula.Recover(dir_ + "/tabula-data");
+  std::string val;
+  for (int i = 0; i < 1999; i++) {
+    std::string row = "row" + std::to_string(i);
+    ASSERT_EQ(SUCCESS, tabula.Get("table", row, "col", &val));
+    ASSERT_EQ(row, val);
+  }
+  ASSERT_EQ(NOT_FOUND, tabula.Get("table", "row1999", "col", &val));
 }
 
+TEST_P(TabulaFlushTest, TestRecoverFileIds) {
+  {
+    // Few enough rows to stay in level 0
+    Tabula tabula(dir_, 64 * 1024, GetParam());
+    for (int i = 0; i < 700; i++) {
+      std::string row = "row" + std::to_string(i);
+      ASSERT_EQ(SUCCESS, tabula.Put("table", row, "col", row + std::string(100, 'v')));
+    }
+  }
+  // Ids from a clock that has since gone back
+  std::string data = dir_ + "/tabula-data";
+  std::vector<std::string> files;
+  DIR* dirPtr = opendir(data.c_str());
+  struct dirent* entry;
+  while ((entry = readdir(dirPtr)) != nullptr) {
+    std::string name = entry->d_name;
+    if (name.length() > 4 && name.compare(name.length() - 4, 4, ".sst") == 0) {
+      files.push_back(name);
+    }
+  }
+  closedir(dirPtr);
+  ASSERT_FALSE(files.empty());
+  std::sort(files.begin(), files.end());
+  for (size_t i = 0; i < files.size(); i++) {
+    char future[64];
+    snprintf(future, sizeof(future), "table-%020llu.sst", 9000000000000000000ULL + i);
+    ASSERT_EQ(0, rename((data + "/" + files[i]).c_str(), (data + "/" + future).c_str()));
+  }
+  Tabula tabula(dir_, 64 * 1024, GetParam());
+  tabula.Recover(data);
+  ASSERT_EQ(SUCCESS, tabula.Put("table", "row0", "col", "new"));
+  for (int i = 0; i < 700; i++) {
+    ASSERT_EQ(SUCCESS, tabula.Put("table", "other" + std::to_string(i), "col", std::string(100, 'v')));
+  }
+  tabula.StopFlusher();
+  // The new SSTables have to sort after the recovered ones to shadow them.
+  std::string val;
+  ASSERT_EQ(SUCCESS, tabula.Get("table", "row0", "col", &val));
+  ASSERT_EQ("new", val);
+}
+
+TEST_P(TabulaFlushTest, TestCompaction) {
+  // Rewrites the same rows in every memtable, so compaction has older
+  // copies to merge away.
+  Tabula tabula(dir_, 64 * 1024, GetParam());
+  for (int round = 0; round < 8; round++) {
+    for (int i = 0; i < 500; i++) {
+      std::string row = "row" + std::to_string(i);
+      std::string val = std::to_string(round) + std::string(100, 'v');
+      ASSERT_EQ(SUCCESS, tabula.Put("table", row, "col", val));
+      ASSERT_EQ(SUCCESS, tabula.Put("table", row, "col" + std::to_string(round), val));
+    }
+  }
+  Tabula::Stats stats;
+  for (int wait = 0; wait < 1000; wait++) {
+    ASSERT_EQ(SUCCESS, tabula.GetStats("table", &stats));
+    if (stats.compactions > 0 && stats.levelFiles[0] < TABULA_L0_COMPACTION_TRIGGER) {
+      break;
+    }
+    usleep(10000);
+  }
+  ASSERT_GT(stats.compactions, 0u);
+  ASSERT_GT(stats.levelFiles[1], 0u);
+  ASSERT_LT(stats.levelFiles[0], (uint64_t)TABULA_L0_COMPACTION_TRIGGER);
+  ASSERT_GT(stats.compactionBytesRead, stats.compactionBytesWritten);
+  tabula.StopFlusher();
+  // Files keep their level across a restart.
+  Tabula recovered(dir_, 64 * 1024, GetParam());
+  recovered.Recover(dir_ + "/tabula-data");
+  ASSERT_EQ(SUCCESS, recovered.GetStats("table", &stats));
+  ASSERT_GT(stats.levelFiles[1], 0u);
+  std::string val;
+  for (Tabula* reader : {&tabula, &recovered}) {
+    for (int i = 0; i < 500; i++) {
+      std::string row = "row" + std::to_string(i);
+      ASSERT_EQ(SUCCESS, reader->Get("table", row, "col", &val));
+      ASSERT_EQ("7" + std::string(100, 'v'), val);
+      for (int round = 0; round < 8; round++) {
+        ASSERT_EQ(SUCCESS, reader->Get("table", row, "col" + std::to_string(round), &val));
+        ASSERT_EQ(std::to_string(round) + std::string(100, 'v'), val);
+      }
+    }
+  }
+}
+
+TEST_P(TabulaFlushTest, TestDeleteAfterFlush) {
+  Tabula tabula(dir_, 64 * 1024, GetParam());
+  for (int i = 0; i < 2000; i++) {
+    std::string row = "row" + std::to_string(i);
+    ASSERT_EQ(SUCCESS, tabula.Put("table", row, "col", row + std::string(100, 'v')));
+  }
+  tabula.StopFlusher();
+  // The values are in SSTables by now; the tombstones have to hide them,
+  // from the memtable first and from newer SSTables later.
+  for (int i = 0; i < 2000; i += 2) {
+    ASSERT_EQ(SUCCESS, tabula.Delete("table", "row" + std::to_string(i), "col"));
+  }
+  ASSERT_EQ(SUCCESS, tabula.Delete("table", "missing", "col"));
+  std::string val;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 2000; i++) {
+      std::string row = "row" + std::to_string(i);
+      ASSERT_EQ(i % 2 == 0 ? NOT_FOUND : SUCCESS, tabula.Get("table", row, "col", &val));
+    }
+    // Push the tombstones out to disk and through compaction, which has
+    // nothing older for them to hide.
+    for (int i = 0; i < 4000; i++) {
+      ASSERT_EQ(SUCCESS, tabula.Put("table", "other" + std::to_string(i), "col", std::string(100, 'v')));
+    }
+    Tabula::Stats stats;
+    for (int wait = 0; wait < 1000; wait++) {
+      ASSERT_EQ(SUCCESS, tabula.GetStats("table", &stats));
+      if (stats.tombstonesDropped > 0 && stats.levelFiles[0] < TABULA_L0_COMPACTION_TRIGGER) {
+        break;
+      }
+      usleep(10000);
+    }
+    ASSERT_GT(stats.tombstonesDropped, 0u);
+  }
+  // A put after the delete brings the column back.
+  ASSERT_EQ(SUCCESS, tabula.Put("table", "row0", "col", "again"));
+  ASSERT_EQ(SUCCESS, tabula.Get("table", "row0", "col", &val));
+  ASSERT_EQ("again", val);
+}
+
+TEST_P(TabulaFlushTest, TestUnpinnedIndex) {
+  // A cache too small for every table's index and filter, which then have
+  // to be read back as lookups need them.
+  Tabula tabula(dir_, 64 * 1024, GetParam());
+  tabula.SetBlockCache(16 * 1024, false);
+  for (int i = 0; i < 2000; i++) {
+    std::string row = "row" + std::to_string(i);
+    ASSERT_EQ(SUCCESS, tabula.Put("table", row, "col", row + std::string(100, 'v')));
+  }
+  tabula.StopFlusher();
+  std::string val;
+  for (int i = 0; i < 2000; i++) {
+    std::string row = "row" + std::to_string(i);
+    ASSERT_EQ(SUCCESS, tabula.Get("table", row, "col", &val));
+    ASSERT_EQ(row + std::string(100, 'v'), val);
+  }
+  CacheStats cacheStats;
+  tabula.GetBlockCacheStats(&cacheStats);
+  ASSERT_LE(cacheStats.bytes, 16 * 1024u);
+  ASSERT_GT(cacheStats.evictions, 0u);
+  tabula.SetBlockCache(0, true);
+  tabula.GetBlockCacheStats(&cacheStats);
+  ASSERT_EQ(0u, cacheStats.entries);
+}
+
+TEST_P(TabulaFlushTest, TestCorruptBlock) {
+  Tabula tabula(dir_, 64 * 1024, GetParam());
+  // The fillers sort after row0, so it lands in the first block of each
+  // SSTable, and each batch seals one memtable.
+  ASSERT_EQ(SUCCESS, tabula.Put("table", "row0", "col", "old"));
+  for (int i = 0; i < 40; i++) {
+    ASSERT_EQ(SUCCESS, tabula.Put("table", "za" + std::to_string(i), "col", std::string(2000, 'v')));
+  }
+  ASSERT_EQ(SUCCESS, tabula.Put("table", "row0", "col", "new"));
+  for (int i = 0; i < 40; i++) {
+    ASSERT_EQ(SUCCESS, tabula.Put("table", "zb" + std::to_string(i), "col", std::string(2000, 'v')));
+  }
+  tabula.StopFlusher();
+  Tabula::Stats stats;
+  ASSERT_EQ(SUCCESS, tabula.GetStats("table", &stats));
+  ASSERT_EQ(2u, stats.levelFiles[0]);
+  std::string data = dir_ + "/tabula-data";
+  std::vector<std::string> files;
+  DIR* dirPtr = opendir(data.c_str());
+  struct dirent* entry;
+  while ((entry = readdir(dirPtr)) != nullptr) {
+    std::string name = entry->d_name;
+    if (name.length() > 4 && name.compare(name.length() - 4, 4, ".sst") == 0) {
+      files.push_back(name);
+    }
+  }
+  closedir(dirPtr);
+  std::sort(files.begin(), files.end());
+  // Damage the newer file's first block, which holds "new".
+  int fd = open((data + "/" + files.back()).c_str(), O_RDWR);
+  ASSERT_NE(-1, fd);
+  char byte;
+  ASSERT_EQ(1, pread(fd, &byte, 1, 8));
+  byte ^= 0xff;
+  ASSERT_EQ(1, pwrite(fd, &byte, 1, 8));
+  close(fd);
+  std::string val;
+  ASSERT_EQ(READ_FAILED, tabula.Get("table", "row0", "col", &val));
+  // A failed read says nothing about the filter.
+  ASSERT_EQ(SUCCESS, tabula.GetStats("table", &stats));
+  ASSERT_EQ(0u, stats.filterFalsePositives);
+}
+
+TEST_P(TabulaFlushTest, TestFlushRetry) {
+  Tabula tabula(dir_, 64 * 1024, GetParam());
+  ASSERT_EQ(SUCCESS, tabula.Put("table", "first", "col", "val"));
+  // The log keeps writing to the segment it has open, but SSTables can't
+  // be created until the directory is back. Enough rows to seal one
+  // memtable, and too few to stall writers on the flush.
+  std::string data = dir_ + "/tabula-data";
+  ASSERT_EQ(0, rename(data.c_str(), (data + ".moved").c_str()));
+  int fd = open(data.c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+  ASSERT_NE(-1, fd);
+  close(fd);
+  for (int i = 0; i < 50; i++) {
+    std::string row = "row" + std::to_string(i);
+    ASSERT_EQ(SUCCESS, tabula.Put("table", row, "col", row + std::string(2000, 'v')));
+  }
+  Tabula::Stats stats;
+  for (int wait = 0; wait < 1000; wait++) {
+    ASSERT_EQ(SUCCESS, tabula.GetStats("table", &stats));
+    if (stats.flushFailures >= 2) {
+      break;
+    }
+    usleep(10000);
+  }
+  ASSERT_GE(stats.flushFailures, 2u);
+  ASSERT_EQ(0u, stats.ssTables);
+  // The sealed memtable is still there to read.
+  std::string val;
+  ASSERT_EQ(SUCCESS, tabula.Get("table", "row0", "col", &val));
+  unlink(data.c_str());
+  ASSERT_EQ(0, rename((data + ".moved").c_str(), data.c_str()));
+  for (int wait = 0; wait < 1000; wait++) {
+    ASSERT_EQ(SUCCESS, tabula.GetStats("table", &stats));
+    if (stats.ssTables > 0) {
+      break;
+    }
+    usleep(10000);
+  }
+  ASSERT_GT(stats.ssTables, 0u);
+  for (int i = 0; i < 50; i++) {
+    std::string row = "row" + std::to_string(i);
+    ASSERT_EQ(SUCCESS, tabula.Get("table", row, "col", &val));
+    ASSERT_EQ(row + std::string(2000, 'v'), val);
+  }
+}
+
+TEST_P(TabulaFlushTest, TestWriteFailure) {
+  // A file where the data directory should be leaves the commit log
+  // nowhere to write.
+  std::string data = dir_ + "/tabula-data";
+  int fd = open(data.c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+  ASSERT_NE(-1, fd);
+  close(fd);
+  {
+    Tabula tabula(dir_, 64 * 1024, GetParam());
+    ASSERT_EQ(WRITE_FAILED, tabula.Put("table", "row", "col", "val"));
+    ASSERT_EQ(WRITE_FAILED, tabula.PutBatch("table", {{"row", "col2", "val"}}));
+    ASSERT_EQ(WRITE_FAILED, tabula.Delete("table", "row", "col"));
+  }
+  unlink(data.c_str());
+}
+
+INSTANTIATE_TEST_SUITE_P(Types, TabulaFlushTest, ::testing::Values(MEMTABLE_MAP, MEMTABLE_SKIPLIST));
+
 } // namespce KVStore
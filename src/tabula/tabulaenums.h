@@ -4,9 +4,16 @@
 namespace KVStore{
 
 const static int NOT_FOUND = -1;
+// The column was deleted and older copies must not be read.
+const static int DELETED = -2;
 const static int SUCCESS = 0;
 const static int OVERWRITE = 1;
 const static int INVALID_REQUEST = 2;
+// The commit log could not write the change, so it may not survive a restart.
+const static int WRITE_FAILED = 3;
+// A block on disk could not be read or failed its checksum, so whatever it
+// holds, older copies must not be read in its place.
+const static int READ_FAILED = 4;
 
 } // namespace KVStore
 
@@ -2,9 +2,11 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <iostream>
+#include <memory>
 
 #include "tcpconnection.h"
 
@@ -12,6 +14,22 @@ using std::string;
 
 namespace Cerver {
 
+#define READ_BUFFER_BYTES 16384
+
+// One read buffer per thread, rather than per connection or per call.
+static thread_local std::unique_ptr<char[]> read_buffer;
+
+static char* ThreadBuffer() {
+  if (read_buffer == nullptr) {
+    read_buffer.reset(new char[READ_BUFFER_BYTES]);
+  }
+  return read_buffer.get();
+}
+
+void TCPConnection::PrepareThreadBuffer() {
+  memset(ThreadBuffer(), 0, READ_BUFFER_BYTES);
+}
+
 TCPConnection::TCPConnection() : sockfd_(-1) {}
 TCPConnection::TCPConnection(int sockfd) : sockfd_(sockfd) {}
 TCPConnection::~TCPConnection() {}
@@ -38,10 +56,44 @@ int TCPConnection::Send(const string& msg) {
   return WriteToSocket(sockfd_, msg);
 }
 
+int TCPConnection::Send(const Utils::SharedBuffer& header, const Utils::SharedBuffer& body) {
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<char*>(header.Data());
+  iov[0].iov_len = header.Size();
+  iov[1].iov_base = const_cast<char*>(body.Data());
+  iov[1].iov_len = body.Size();
+  struct iovec* next = iov;
+  int remaining = body.Size() > 0 ? 2 : 1;
+  size_t bytes_written = 0;
+  while (remaining > 0) {
+    ssize_t res = writev(sockfd_, next, remaining);
+    if (res == -1) {
+      if (errno == EAGAIN || errno == EINTR) {continue;}
+      break;
+    }
+    if (res == 0) {
+      break;
+    }
+    bytes_written += res;
+    // Skip what was written, possibly part of an iovec.
+    size_t written = res;
+    while (remaining > 0 && written >= next->iov_len) {
+      written -= next->iov_len;
+      next++;
+      remaining--;
+    }
+    if (remaining > 0) {
+      next->iov_base = static_cast<char*>(next->iov_base) + written;
+      next->iov_len -= written;
+    }
+  }
+  return bytes_written;
+}
+
 int TCPConnection::ReadFromSocket() {
   int res;
-  char buffer[1024];
-  res = read(sockfd_, buffer, 1024);
+  char* buffer = ThreadBuffer();
+  res = read(sockfd_, buffer, READ_BUFFER_BYTES);
   if (res <= 0) {
     return res;
   }
@@ -79,15 +131,15 @@ void TCPConnection::ReadSize(size_t size, string* msg) {
     return;
   }
   while (buff_.length() < size) {
-    char buffer[1024];
-    int res = read(sockfd_, buffer, 1024);
-    if (res == -1) {
+    char* buffer = ThreadBuffer();
+    int res = read(sockfd_, buffer, READ_BUFFER_BYTES);
+    if (res <= 0) {
       break;
     }
     buff_ += string(buffer, res);
   }
   *msg = buff_.substr(0, size);
-  buff_ = buff_.substr(size);
+  buff_ = buff_.substr(msg->length());
 }
 
 void TCPConnection::Close() {
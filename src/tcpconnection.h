@@ -2,6 +2,7 @@
 #define TCP_CONNECTION_H_
 
 #include <string>
+#include "sharedbuffer.h"
 
 namespace Cerver {
 
@@ -17,6 +18,8 @@ class TCPConnection {
     int Connect(const std::string& addr, int port);
     // Sends [msg] through the connection
     int Send(const std::string& msg);
+    // Sends [header] followed by [body] with one writev where possible.
+    int Send(const Utils::SharedBuffer& header, const Utils::SharedBuffer& body);
     // Reads until <CR><LF>. May block. Returns result through [msg]
     int ReadUntilDoubleCRLF(std::string* msg);
     // Reads [size] from socket. May block. Returns result through [msg]
@@ -24,6 +27,10 @@ class TCPConnection {
     // Ends connection and closes socket
     void Close();
     void SetSocketFd(int sockfd);
+    // Allocates the calling thread's read buffer and touches every page, so
+    // it is placed on the NUMA node the thread is pinned to. Threads that
+    // do not call this get the buffer on their first read.
+    static void PrepareThreadBuffer();
 
   private:
     int ReadFromSocket();
@@ -1,6 +1,8 @@
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <time.h>
 #include "threadpool.h"
 
 using std::vector;
@@ -14,6 +16,15 @@ namespace Cerver {
 void* SysiphusLoop(void* thread_pool) {
   ThreadPool* pool = static_cast<ThreadPool*>(thread_pool);
   pthread_mutex_lock(&(pool->q_lock_));
+  int index = pool->num_threads_started_++;
+  pthread_mutex_unlock(&(pool->q_lock_));
+  if (!pool->cpus_.empty()) {
+    ThreadPool::PinThread(pthread_self(), {pool->cpus_[index % pool->cpus_.size()]});
+  }
+  if (pool->thread_init_) {
+    pool->thread_init_();
+  }
+  pthread_mutex_lock(&(pool->q_lock_));
   pool->num_threads_running_++;
 
   while (!pool->killthreads_) {
@@ -31,7 +42,10 @@ void* SysiphusLoop(void* thread_pool) {
   return nullptr;
 }
 
-ThreadPool::ThreadPool(int max_threads) : killthreads_(false), num_threads_running_(0) {
+ThreadPool::ThreadPool(int max_threads) : ThreadPool(max_threads, {}, nullptr) { }
+
+ThreadPool::ThreadPool(int max_threads, const vector<int>& cpus, std::function<void()> thread_init)
+  : killthreads_(false), num_threads_running_(0), num_threads_started_(0), cpus_(cpus), thread_init_(thread_init) {
   pthread_mutex_init(&q_lock_, nullptr);
   pthread_cond_init(&q_cond_, nullptr);
   thread_array_ = vector<pthread_t>(max_threads);
@@ -69,12 +83,40 @@ ThreadPool::~ThreadPool() {
 }
 
 void ThreadPool::Dispatch(std::unique_ptr<Task> task) {
+  task->enqueue_us = NowMicros();
   pthread_mutex_lock(&q_lock_);
   work_queue_.push_back(std::move(task));
   pthread_cond_signal(&q_cond_);
   pthread_mutex_unlock(&q_lock_);
 }
 
+size_t ThreadPool::QueueDepth(uint64_t* oldest_enqueue_us) {
+  pthread_mutex_lock(&q_lock_);
+  size_t depth = work_queue_.size();
+  *oldest_enqueue_us = depth > 0 ? work_queue_.front()->enqueue_us : 0;
+  pthread_mutex_unlock(&q_lock_);
+  return depth;
+}
+
+uint64_t ThreadPool::NowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+int ThreadPool::PinThread(pthread_t thread, const vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0 ? 0 : -1;
+#else
+  return -1;
+#endif
+}
+
 void ThreadPool::KillThreads() {
   killthreads_ = true;
   for (size_t i = 0; i < thread_array_.size(); i++) {
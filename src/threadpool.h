@@ -1,9 +1,12 @@
 #ifndef THREAD_POOL_H_
 #define THREAD_POOL_H_
 
+#include <functional>
 #include <list>
 #include <vector>
 #include <memory>
+#include <stdint.h>
+#include <pthread.h>
 
 namespace Cerver {
 
@@ -14,20 +17,37 @@ namespace Cerver {
 class ThreadPool {
   public:
     ThreadPool(int max_threads);
+    // Thread i pins itself to cpus[i % cpus.size()] and then runs
+    // [thread_init], before taking any task. Memory that [thread_init]
+    // touches first is therefore placed on the thread's NUMA node.
+    ThreadPool(int max_threads, const std::vector<int>& cpus, std::function<void()> thread_init);
     ~ThreadPool();
     class Task {
       public:
-        Task() { }
+        Task() : enqueue_us(0) { }
         virtual ~Task() { }
         virtual void Run() = 0;
+        // Set by Dispatch, from a monotonic clock.
+        uint64_t enqueue_us;
     };
     void Dispatch(std::unique_ptr<Task> task);
+    // Number of queued tasks. [oldest_enqueue_us] is set to the enqueue time
+    // of the task at the front, or 0 if there is none.
+    size_t QueueDepth(uint64_t* oldest_enqueue_us);
+    static uint64_t NowMicros();
+    // Restricts [thread] to [cpus]. Returns -1 if that fails or is not
+    // supported on this platform.
+    static int PinThread(pthread_t thread, const std::vector<int>& cpus);
     void KillThreads();
     pthread_mutex_t q_lock_;
     pthread_cond_t  q_cond_;
     std::list<std::unique_ptr<Task> > work_queue_;
     bool killthreads_;
     int num_threads_running_;
+    int num_threads_started_;
+
+    std::vector<int> cpus_;
+    std::function<void()> thread_init_;
 
   private:
     std::vector<pthread_t> thread_array_;
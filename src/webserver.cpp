@@ -3,135 +3,235 @@
 #include <sys/stat.h>
 #include "httpserver.h"
 #include "utils.h"
+#include "singleflight.h"
+#include "assetloader.h"
+#include "prefork.h"
+#include "sharedstats.h"
+#include "handoff.h"
 #include "tabula/tabula.h"
 
 using std::string;
 using std::unique_ptr;
+using std::vector;
 using namespace Cerver;
 using namespace KVStore;
 
 static string dir;
+static const char* kStatsPath = "cerverlog/stats.shm";
+static const char* kUpgradePath = "cerverlog/upgrade.sock";
+// Concurrent requests for the same asset share one Tabula read.
+static SingleFlight<string, Utils::SharedBuffer> asset_flights;
 
-void LoadFileToDatabase(const string& dir, KVStore::Tabula* tabula) {
-  HttpResponse res;
-  HttpServer::ReadFile(&res, dir + "/index.html");
-  tabula->Put("assets", "page", "index.html", res.Body());
-  HttpServer::ReadFile(&res, dir + "/poetry.html");
-  tabula->Put("assets", "page", "poetry.html", res.Body());
-  HttpServer::ReadFile(&res, dir + "/translated.html");
-  tabula->Put("assets", "page", "translated.html", res.Body());
-  HttpServer::ReadFile(&res, dir + "/map.html");
-  tabula->Put("assets", "page", "map.html", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/allegory.png");
-  tabula->Put("assets", "image", "allegory.png", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/bookshelf.png");
-  tabula->Put("assets", "image", "bookshelf.png", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/CA-Chinese.jpeg");
-  tabula->Put("assets", "image", "CA-Chinese.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/CA-English.jpeg");
-  tabula->Put("assets", "image", "CA-English.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/favicon.png");
-  tabula->Put("assets", "image", "favicon.png", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/HNTDA-Chinese.jpeg");
-  tabula->Put("assets", "image", "HNTDA-Chinese.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/HNTDA-English.jpeg");
-  tabula->Put("assets", "image", "HNTDA-English.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/HOAX-Chinese.jpeg");
-  tabula->Put("assets", "image", "HOAX-Chinese.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/HOAX-English.jpeg");
-  tabula->Put("assets", "image", "HOAX-English.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/HST-Chinese.jpeg");
-  tabula->Put("assets", "image", "HST-Chinese.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/HST-English.jpeg");
-  tabula->Put("assets", "image", "HST-English.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/kung.png");
-  tabula->Put("assets", "image", "kung.png", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/network.png");
-  tabula->Put("assets", "image", "network.png", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/programing.png");
-  tabula->Put("assets", "image", "programing.png", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/right-arrow.png");
-  tabula->Put("assets", "image", "right-arrow.png", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/TAW-Chinese.jpeg");
-  tabula->Put("assets", "image", "TAW-Chinese.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/TAW-English.jpeg");
-  tabula->Put("assets", "image", "TAW-English.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/TGA-Chinese.jpeg");
-  tabula->Put("assets", "image", "TGA-Chinese.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/TGA-English.jpeg");
-  tabula->Put("assets", "image", "TGA-English.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/translating.png");
-  tabula->Put("assets", "image", "translating.png", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/TTM-Chinese.jpeg");
-  tabula->Put("assets", "image", "TTM-Chinese.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/images/TTM-English.jpeg");
-  tabula->Put("assets", "image", "TTM-English.jpeg", res.Body());
-  HttpServer::ReadFile(&res, dir + "/css/style.css");
-  tabula->Put("assets", "css", "style.css", res.Body());
-}
-
-void DefineGet(KVStore::Tabula* tabula) {
-  server->Get("/", [tabula](const HttpRequest& req, HttpResponse* res) {
-    tabula->Get("assets", "page", "index.html", res->BodyPtr());
-    res->UseBody();
-    return "";
+void GetAsset(KVStore::Tabula* tabula, const string& row, const string& col, HttpResponse* res) {
+  Utils::SharedBuffer body;
+  asset_flights.Do(row + "/" + col, &body, [tabula, &row, &col](Utils::SharedBuffer* val) {
+    return tabula->GetRef("assets", row, col, val);
   });
+  res->SetBody(body);
+}
 
-  server->Get("/poetry", [tabula](const HttpRequest& req, HttpResponse* res) {
-    tabula->Get("assets", "page", "poetry.html", res->BodyPtr());
-    res->UseBody();
-    return "";
-  });
+// Routes the pages link to that do not match their file name.
+static const std::pair<const char*, const char*> kPageAliases[] = {
+  {"/map", "/travel"},
+};
 
-  server->Get("/translated", [tabula](const HttpRequest& req, HttpResponse* res) {
-    tabula->Get("assets", "page", "translated.html", res->BodyPtr());
-    res->UseBody();
-    return "";
+// Loads the top-level pages under [dir] into Tabula, reading on [pool], and
+// returns their file names.
+vector<string> LoadPages(const string& dir, KVStore::Tabula* tabula, ThreadPool* pool) {
+  AssetLoader loader(pool);
+  // Everything else is served from the directory, so only read the pages.
+  loader.SetFilter([](const string& path, bool is_dir) {
+    return !is_dir && Utils::EndsWith(path, ".html");
   });
+  vector<AssetLoader::Asset> assets;
+  AssetLoader::Report report;
+  loader.Load(dir, &assets, &report);
 
-  server->Get("/travel", [tabula](const HttpRequest& req, HttpResponse* res) {
-    tabula->Get("assets", "page", "map.html", res->BodyPtr());
-    res->UseBody();
-    return "";
-  });
+  vector<string> pages;
+  vector<KVStore::Mutation> batch;
+  for (const AssetLoader::Asset& asset : assets) {
+    batch.push_back({".", asset.path, asset.content.ToString()});
+    pages.push_back(asset.path);
+  }
+  tabula->PutBatch("assets", batch);
 
-  server->Get("/images/:imageFile", [tabula](const HttpRequest& req, HttpResponse* res) {
-    string image_file;
-    req.PathParam("imageFile", &image_file);
-    tabula->Get("assets", "image", image_file, res->BodyPtr());
-    res->UseBody();
-    return "";
-  });
+  std::cout << "Loaded " << report.files << " files (" << report.bytes / 1024 << " KB) in "
+            << report.seconds * 1000 << " ms, "
+            << (report.seconds > 0 ? report.bytes / report.seconds / (1024 * 1024) : 0) << " MB/s";
+  if (report.failed > 0) {
+    std::cout << ", " << report.failed << " failed";
+  }
+  std::cout << std::endl;
+  return pages;
+}
 
-  server->Get("/CSS/:cssFile", [tabula](const HttpRequest& req, HttpResponse* res) {
-    string css_file;
-    req.PathParam("cssFile", &css_file);
-    tabula->Get("assets", "css", css_file, res->BodyPtr());
-    res->UseBody();
-    return "";
-  });
+// Serves the loaded [pages] at /<name> (index.html at /). Every other file is
+// served straight from [dir], so edits to images and styles go live without
+// a restart.
+void DefineAssetRoutes(const string& dir, const vector<string>& pages, KVStore::Tabula* tabula) {
+  for (const string& col : pages) {
+    string row = ".";
+    vector<string> routes = {col == "index.html" ? "/" : "/" + Utils::RemoveExt(col)};
+    for (const auto& alias : kPageAliases) {
+      if (routes[0] == alias.first) {
+        routes.push_back(alias.second);
+      }
+    }
+    for (const string& route : routes) {
+      server->Get(route, [tabula, row, col](const HttpRequest& req, HttpResponse* res) {
+        GetAsset(tabula, row, col, res);
+        return "";
+      });
+    }
+  }
+  StaticFileHandler* files = server->ServeDirectory("/", dir);
+  files->Exclude("tabula-data");
+  // The pages link to their stylesheet as /CSS/.
+  server->ServeDirectory("/CSS", dir + "/css");
+}
 
+void DefineGet() {
   server->Get("/stats", [](const HttpRequest& req, HttpResponse* res) {
     server->GetStats(req, res);
     return "";
   });
 }
 
+void ConfigureServer(const string& capture_path, double rate) {
+  if (!capture_path.empty()) {
+    server->EnableCapture(capture_path);
+  }
+  if (rate > 0) {
+    server->LimitClients(rate, 2 * rate);
+  }
+}
+
+// Loads the pages once, before forking, so every worker shares them
+// copy-on-write, then runs the pre-fork master until it is told to stop.
+// [inherited], [hot_keys] and [upgrade_conn] come from an upgrade, if any.
+void RunPrefork(const ServerConfig& config, KVStore::Tabula* tabula, bool capture, double rate,
+                const vector<int>& inherited, const vector<string>& hot_keys, int upgrade_conn) {
+  vector<string> pages;
+  {
+    // No thread may be left running when the master forks.
+    ThreadPool loader_pool(config.threads);
+    pages = LoadPages(dir, tabula, &loader_pool);
+    tabula->StopFlusher();
+  }
+  mkdir("cerverlog", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  SharedStats stats;
+  if (stats.Create(kStatsPath, config.workers) == -1) {
+    std::cout << "Failed to create " << kStatsPath << std::endl;
+    return;
+  }
+  Prefork master(config, &stats, [&](int worker, int listen_fd, SharedStats::Slot* slot) {
+    server = std::make_unique<HttpServer>(config);
+    server->UseListenSocket(listen_fd);
+    server->AttachStats(slot);
+    // Workers must not interleave records in one capture file.
+    ConfigureServer(capture ? "cerverlog/capture." + std::to_string(worker) + ".bin" : "", rate);
+    DefineAssetRoutes(dir, pages, tabula);
+    DefineGet();
+    server->Warm(hot_keys);
+    server->Run();
+    return EXIT_SUCCESS;
+  });
+  if (!inherited.empty()) {
+    master.UseListenSockets(inherited);
+  }
+  master.EnableUpgrade(kUpgradePath);
+  if (upgrade_conn != -1) {
+    master.OnServing([&upgrade_conn]() {
+      CompleteUpgrade(upgrade_conn);
+      upgrade_conn = -1;
+    });
+  }
+  master.Run();
+  if (upgrade_conn != -1) {
+    // Never served; the old process carries on.
+    close(upgrade_conn);
+  }
+  stats.Remove();
+}
+
+void PrintSharedStats(SharedStats* shared) {
+  SharedStats::Totals totals;
+  shared->Sum(&totals);
+  std::cout << "Workers running: " << totals.workers << " of " << shared->NumSlots() << "\n";
+  std::cout << "Worker restarts: " << totals.restarts << "\n";
+  std::cout << "Number of active connections: " << totals.connections << "\n";
+  std::cout << "Accumulative number of requests: " << totals.requests << "\n";
+  std::cout << "Connections shed: " << totals.shed << "\n";
+  std::cout << "Requests rate limited: " << totals.rate_limited << "\n";
+  for (int i = 0; i < shared->NumSlots(); i++) {
+    SharedStats::Slot* slot = shared->GetSlot(i);
+    std::cout << "Worker " << i << ": pid " << slot->pid
+              << ", " << slot->connections << " connections"
+              << ", " << slot->requests << " requests"
+              << ", " << slot->restarts << " restarts\n";
+  }
+  std::cout << std::flush;
+}
+
+void WritePid(pid_t pid) {
+  int fd = open("cerverlog/process.txt", O_RDWR | O_CREAT, S_IRWXO | S_IRWXG | S_IRWXU);
+  write(fd, &pid, sizeof(pid_t));
+  close(fd);
+}
+
+void PrintBanner(const ServerConfig& config, pid_t pid) {
+  std::cout << "Webserver is running\n";
+  std::cout << "Listenting on port " << config.port << "\n";
+  if (config.workers > 0) {
+    std::cout << "Workers: " << config.workers << (config.reuseport ? " (SO_REUSEPORT)" : "") << "\n";
+  }
+  std::cout << "Reading from directory " << dir << "\n";
+  std::cout << "pid = " << pid << std::endl;
+}
+
 int main(int argc, char** argv) {
-  int port = 80;
   int c;
   bool background = true;
-  while ((c = getopt(argc, argv, "p:t")) != -1) {
+  bool capture = false;
+  double rate = 0;
+  string config_file;
+  // Command line settings override the config file.
+  vector<std::pair<string, string> > settings;
+  while ((c = getopt(argc, argv, "p:tcr:f:n:a:w:P:R")) != -1) {
     switch(c) {
       case 'p':
+        settings.push_back({"port", optarg});
+        break;
+      case 't':
+        background = false;
+        break;
+      case 'c':
+        capture = true;
+        break;
+      case 'r':
         if (!Utils::IsNumber(string(optarg))) {
-          std::cout << "-p argument must be a number that specifies a port" << std::endl;
+          std::cout << "-r argument must be a number of requests per second per client" << std::endl;
           return EXIT_FAILURE;
         }
-        port = atoi(optarg);
+        rate = atof(optarg);
         break;
-      case 't':
-        background = false;
+      case 'f':
+        config_file = optarg;
+        break;
+      case 'n':
+        settings.push_back({"threads", optarg});
+        break;
+      case 'a':
+        settings.push_back({"acceptor_cpus", optarg});
+        break;
+      case 'w':
+        settings.push_back({"worker_cpus", optarg});
+        break;
+      case 'P':
+        settings.push_back({"workers", optarg});
+        break;
+      case 'R':
+        settings.push_back({"reuseport", "on"});
         break;
       case '?':
         std::cout << optopt << " is not an accepted argument." << std::endl;
@@ -140,6 +240,18 @@ int main(int argc, char** argv) {
         abort();
     }
   }
+  ServerConfig config;
+  string error;
+  if (!config_file.empty() && config.LoadFile(config_file, &error) == -1) {
+    std::cout << error << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (const auto& setting : settings) {
+    if (config.Set(setting.first, setting.second, &error) == -1) {
+      std::cout << error << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
   if (optind >= argc) {
     std::cout << "./webserver run\n./webserver end" << std::endl;
     return EXIT_FAILURE;
@@ -165,51 +277,85 @@ int main(int argc, char** argv) {
     }
     pid_t pid;
     read(fd, &pid, sizeof(pid_t));
-    kill(pid, SIGUSR1);
     close(fd);
+    // A pre-fork master leaves its workers' counters where we can read them.
+    SharedStats shared;
+    if (shared.Open(kStatsPath) == 0) {
+      PrintSharedStats(&shared);
+      return EXIT_SUCCESS;
+    }
+    kill(pid, SIGUSR1);
     return EXIT_SUCCESS;
   }
-  if (string(argv[optind]) != "run" || optind + 1 >= argc) {
-     std::cout << "./webserver run <directory>" << std::endl;
+  bool upgrade = string(argv[optind]) == "upgrade";
+  if ((string(argv[optind]) != "run" && !upgrade) || optind + 1 >= argc) {
+     std::cout << "./webserver run <directory>\n./webserver upgrade <directory>" << std::endl;
     return EXIT_FAILURE;
   }
   dir = string(argv[optind + 1]);
-  unique_ptr<KVStore::Tabula> tabula = std::make_unique<KVStore::Tabula>(dir);
+  // Take over the listen sockets of the running server, which keeps
+  // serving until we are ready.
+  int upgrade_conn = -1;
+  vector<int> inherited;
+  vector<string> hot_keys;
+  if (upgrade) {
+    upgrade_conn = RequestUpgrade(kUpgradePath, &inherited, &hot_keys);
+    if (upgrade_conn == -1) {
+      std::cout << "No cerver is running to upgrade" << std::endl;
+      return EXIT_FAILURE;
+    }
+    size_t expected = config.workers > 0 && config.reuseport ? config.workers : 1;
+    if (inherited.size() != expected) {
+      std::cout << "The running cerver has " << inherited.size() << " listen sockets; "
+                << "upgrade with the same -P and -R settings" << std::endl;
+      close(upgrade_conn);
+      return EXIT_FAILURE;
+    }
+    std::cout << "Received " << inherited.size() << " listen sockets and "
+              << hot_keys.size() << " hot keys" << std::endl;
+  }
   if (background) {
-    pid_t pid = 0;
-    pid = fork();
-    if (pid == 0) {
-      server = std::make_unique<HttpServer>(32, 80);
-      LoadFileToDatabase(dir, tabula.get());
-      // tabula->Recover("/Users/seankung/projects/cerver/assets/tabula-data");
-      DefineGet(tabula.get());
-      server->Run();
-      exit(EXIT_SUCCESS);
-    } else {
-      int fd = open("cerverlog/process.txt", O_RDWR | O_CREAT, S_IRWXO | S_IRWXG | S_IRWXU);
-      write(fd, &pid, sizeof(pid_t));
-      close(fd);
-      std::cout << "Webserver is running\n";
-      std::cout << "Listenting on port " << port << "\n";
-      std::cout << "Reading from directory " << argv[optind + 1] << "\n";
-      std::cout << "pid = " << pid << std::endl;
+    pid_t pid = fork();
+    if (pid != 0) {
+      if (upgrade) {
+        close(upgrade_conn);
+        for (int fd : inherited) {
+          close(fd);
+        }
+      }
+      WritePid(pid);
+      PrintBanner(config, pid);
       return EXIT_SUCCESS;
     }
-  } else {
-    server = std::make_unique<HttpServer>(32, 80);
-    LoadFileToDatabase(dir, tabula.get());
-    // tabula->Recover("/Users/seankung/projects/cerver/assets/data");
-    DefineGet(tabula.get());
-    pid_t pid = getpid();
-    int fd = open("cerverlog/process.txt", O_RDWR | O_CREAT, S_IRWXO | S_IRWXG | S_IRWXU);
-    write(fd, &pid, sizeof(pid_t));
-    close(fd);
-    std::cout << "Webserver is running\n";
-    std::cout << "Listenting on port " << port << "\n";
-    std::cout << "Reading from directory " << argv[optind + 1] << "\n";
-    std::cout << "pid = " << pid << std::endl;
-    server->Run();
+  }
+  unique_ptr<KVStore::Tabula> tabula = std::make_unique<KVStore::Tabula>(dir);
+  // tabula->Recover("/Users/seankung/projects/cerver/assets/tabula-data");
+  if (config.workers > 0) {
+    if (!background) {
+      WritePid(getpid());
+      PrintBanner(config, getpid());
+    }
+    RunPrefork(config, tabula.get(), capture, rate, inherited, hot_keys, upgrade_conn);
     return EXIT_SUCCESS;
   }
-  
-}
\ No newline at end of file
+  server = std::make_unique<HttpServer>(config);
+  if (upgrade) {
+    server->UseListenSocket(inherited[0]);
+  }
+  server->EnableUpgrade(kUpgradePath);
+  ConfigureServer(capture ? "cerverlog/capture.bin" : "", rate);
+  vector<string> pages = LoadPages(dir, tabula.get(), server->GetThreadPool());
+  DefineAssetRoutes(dir, pages, tabula.get());
+  DefineGet();
+  server->Warm(hot_keys);
+  if (!background) {
+    WritePid(getpid());
+    PrintBanner(config, getpid());
+  }
+  if (upgrade) {
+    // Both processes accept from here on; the old one now drains.
+    CompleteUpgrade(upgrade_conn);
+  }
+  server->Run();
+  return EXIT_SUCCESS;
+}